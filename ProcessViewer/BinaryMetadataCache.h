@@ -0,0 +1,791 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "MappedFile.h"
+
+// Identifies a version of a file without reading it: a binary that is
+// replaced or rebuilt gets a new size or modification time.
+struct BinaryFileStamp
+{
+    uint64_t Size = 0;
+    // In the file system clock's ticks
+    uint64_t LastWriteTime = 0;
+};
+
+inline bool operator==(BinaryFileStamp const& left, BinaryFileStamp const& right)
+{
+    return left.Size == right.Size && left.LastWriteTime == right.LastWriteTime;
+}
+
+inline bool operator!=(BinaryFileStamp const& left, BinaryFileStamp const& right)
+{
+    return !(left == right);
+}
+
+inline std::optional<BinaryFileStamp> GetBinaryFileStamp(std::filesystem::path const& path)
+{
+    std::error_code error;
+    auto size = std::filesystem::file_size(path, error);
+    if (error)
+    {
+        return std::nullopt;
+    }
+    auto time = std::filesystem::last_write_time(path, error);
+    if (error)
+    {
+        return std::nullopt;
+    }
+    return BinaryFileStamp{ static_cast<uint64_t>(size), static_cast<uint64_t>(time.time_since_epoch().count()) };
+}
+
+// What the PE headers (and version resource) of a binary say
+struct BinaryMetadata
+{
+    // IMAGE_FILE_MACHINE_*
+    uint16_t Machine = 0;
+    // IMAGE_SUBSYSTEM_*
+    uint16_t Subsystem = 0;
+    // From the version resource, major version in the top 16 bits. 0 if the
+    // binary doesn't have one.
+    uint64_t FileVersion = 0;
+};
+
+// An icon as 32-bit BGRA pixels with straight alpha, rows top to bottom.
+// Pixels is null if the binary has no icon.
+struct IconBitmapView
+{
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    uint8_t const* Pixels = nullptr;
+};
+
+// What the cache knows about a version of a binary. Icons point into the
+// cache and stay valid as long as it exists.
+struct BinaryCacheEntry
+{
+    std::optional<BinaryMetadata> Metadata;
+    std::optional<IconBitmapView> Icon;
+};
+
+struct BinaryMetadataCacheStatistics
+{
+    uint64_t Hits = 0;
+    uint64_t Misses = 0;
+    // Lookups that found the binary, but an older version of it
+    uint64_t Stale = 0;
+    uint64_t Compactions = 0;
+    size_t MappedEntries = 0;
+    size_t MappedBytes = 0;
+    size_t PendingEntries = 0;
+    size_t PendingBytes = 0;
+};
+
+// On disk, the cache is a hash table of path -> entry offset followed by the
+// entries, so opening it is a matter of mapping it: lookups probe the mapped
+// table directly and icons are handed out as pointers into the mapping. The
+// file is never modified in place: what is found during a session is kept in
+// memory, and compaction writes everything worth keeping, most recently used
+// first and up to the size cap, to "<cache>.new" or "<cache>.new2", whichever
+// isn't mapped. The compacted file is mapped in place of the old one and the
+// entries written to it are dropped from memory. The newest of the two
+// replaces the cache the next time it is opened, so a mapped file is never
+// overwritten.
+//
+// Paths are stored as wchar_t, so caches are only readable on the platform
+// that wrote them.
+namespace BinaryCacheFormat
+{
+    constexpr char Magic[8] = { 'P', 'V', 'B', 'I', 'N', 'C', 'C', 0 };
+    constexpr uint32_t Version = 1;
+
+    struct FileHeader
+    {
+        char Magic[8];
+        uint32_t Version;
+        uint32_t BucketCount;
+        uint64_t EntryCount;
+        uint64_t FileSize;
+    };
+
+    struct Bucket
+    {
+        uint64_t PathHash;
+        // 0 if the bucket is empty
+        uint64_t Offset;
+    };
+
+    enum EntryFlags : uint8_t
+    {
+        HasMetadata = 1 << 0,
+        // Set once the icon was extracted, even if there was none
+        HasIcon = 1 << 1,
+    };
+
+    // Followed by the path (PathLength wchar_ts) and then the pixels
+    // (IconWidth * IconHeight * 4 bytes), each padded to 8 bytes
+    struct EntryHeader
+    {
+        uint64_t FileSize;
+        uint64_t LastWriteTime;
+        // Microseconds since the Unix epoch
+        uint64_t LastUsed;
+        uint64_t FileVersion;
+        uint32_t PathLength;
+        uint16_t Machine;
+        uint16_t Subsystem;
+        uint16_t IconWidth;
+        uint16_t IconHeight;
+        uint8_t Flags;
+        uint8_t Reserved[3];
+    };
+    static_assert(sizeof(EntryHeader) == 48, "Entries are written as is");
+
+    // Compactions alternate between two files, so they never write to the
+    // one that is mapped
+    inline std::filesystem::path GetCompactedPath(std::filesystem::path const& path, size_t index)
+    {
+        auto compacted = path;
+        compacted += index == 0 ? L".new" : L".new2";
+        return compacted;
+    }
+
+    // FNV-1a
+    inline uint64_t HashPath(std::wstring_view path)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (auto c : path)
+        {
+            hash = (hash ^ static_cast<uint32_t>(c)) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    constexpr size_t Align(size_t size)
+    {
+        return (size + 7) & ~static_cast<size_t>(7);
+    }
+
+    inline size_t GetPixelsSize(uint32_t width, uint32_t height)
+    {
+        return static_cast<size_t>(width) * height * 4;
+    }
+
+    inline uint64_t Now()
+    {
+        using namespace std::chrono;
+        return static_cast<uint64_t>(duration_cast<microseconds>(system_clock::now().time_since_epoch()).count());
+    }
+}
+
+class BinaryMetadataCache
+{
+public:
+    static constexpr size_t DefaultSizeCap = 64 * 1024 * 1024;
+    // Compacts in the background once this much was stored since the last
+    // compaction
+    static constexpr size_t DefaultCompactionThreshold = 4 * 1024 * 1024;
+
+    // Starts out empty if the file doesn't exist or isn't a valid cache
+    explicit BinaryMetadataCache(std::filesystem::path path, size_t sizeCap = DefaultSizeCap, size_t compactionThreshold = DefaultCompactionThreshold)
+        : m_path(std::move(path)), m_sizeCap(sizeCap), m_compactionThreshold(compactionThreshold)
+    {
+        // Left behind by the last session's compactions, the newest that is
+        // valid wins
+        std::error_code error;
+        std::vector<std::filesystem::path> compacted;
+        for (size_t index = 0; index < 2; index++)
+        {
+            auto path = BinaryCacheFormat::GetCompactedPath(m_path, index);
+            if (std::filesystem::exists(path, error))
+            {
+                compacted.push_back(path);
+            }
+        }
+        std::sort(compacted.begin(), compacted.end(), [](auto const& left, auto const& right)
+            {
+                std::error_code error;
+                return std::filesystem::last_write_time(left, error) > std::filesystem::last_write_time(right, error);
+            });
+        auto replaced = false;
+        for (auto&& path : compacted)
+        {
+            MappedFile file;
+            auto valid = file.Open(path) && IsValid(file);
+            file = MappedFile();
+            if (valid && !replaced)
+            {
+                std::filesystem::rename(path, m_path, error);
+                replaced = !error;
+            }
+            else
+            {
+                std::filesystem::remove(path, error);
+            }
+        }
+        MappedFile file;
+        if (file.Open(m_path) && IsValid(file))
+        {
+            m_mapped = std::move(file);
+        }
+    }
+
+    ~BinaryMetadataCache()
+    {
+        if (m_compactor.joinable())
+        {
+            m_compactor.join();
+        }
+        if (m_dirty)
+        {
+            Compact();
+        }
+    }
+
+    BinaryMetadataCache(BinaryMetadataCache const&) = delete;
+    BinaryMetadataCache& operator=(BinaryMetadataCache const&) = delete;
+
+    // Returns std::nullopt if nothing is known about this version of the
+    // binary
+    std::optional<BinaryCacheEntry> Lookup(std::wstring const& path, BinaryFileStamp const& stamp)
+    {
+        std::scoped_lock lock(m_lock);
+        auto pending = m_pending.find(path);
+        if (pending != m_pending.end())
+        {
+            if (pending->second.Stamp == stamp)
+            {
+                m_statistics.Hits++;
+                pending->second.HandedOut = true;
+                return GetEntry(pending->second);
+            }
+        }
+        else if (auto offset = FindMapped(path))
+        {
+            auto& header = GetMappedHeader(*offset);
+            if (header.FileSize == stamp.Size && header.LastWriteTime == stamp.LastWriteTime)
+            {
+                m_statistics.Hits++;
+                m_used.insert(*offset);
+                return GetEntry(*offset);
+            }
+            // Dropped at the next compaction
+            m_statistics.Stale++;
+            m_stale.insert(*offset);
+            m_dirty = true;
+            return std::nullopt;
+        }
+        m_statistics.Misses++;
+        return std::nullopt;
+    }
+
+    void StoreMetadata(std::wstring const& path, BinaryFileStamp const& stamp, BinaryMetadata const& metadata)
+    {
+        std::unique_lock lock(m_lock);
+        auto& entry = GetPending(path, stamp);
+        entry.Metadata = metadata;
+        entry.Version = ++m_pendingVersion;
+        OnStored(lock, sizeof(EntryHeader) + path.size() * sizeof(wchar_t));
+    }
+
+    // pixels is width * height BGRA values, or null if the binary has no icon
+    void StoreIcon(std::wstring const& path, BinaryFileStamp const& stamp, uint32_t width, uint32_t height, uint8_t const* pixels)
+    {
+        std::unique_lock lock(m_lock);
+        auto& entry = GetPending(path, stamp);
+        if (entry.HasIcon)
+        {
+            // Icons that were handed out have to stay where they are
+            return;
+        }
+        entry.HasIcon = true;
+        entry.Version = ++m_pendingVersion;
+        auto stored = sizeof(EntryHeader) + path.size() * sizeof(wchar_t);
+        if (pixels != nullptr && width > 0 && height > 0 && width <= UINT16_MAX && height <= UINT16_MAX)
+        {
+            entry.IconWidth = width;
+            entry.IconHeight = height;
+            auto size = BinaryCacheFormat::GetPixelsSize(width, height);
+            entry.Pixels = std::make_unique<uint8_t[]>(size);
+            memcpy(entry.Pixels.get(), pixels, size);
+            m_pendingBytes += size;
+            stored += size;
+        }
+        OnStored(lock, stored);
+    }
+
+    // Compacts on a background thread, unless a compaction is already running
+    void CompactInBackground()
+    {
+        std::scoped_lock lock(m_lock);
+        StartCompaction();
+    }
+
+    BinaryMetadataCacheStatistics GetStatistics()
+    {
+        std::scoped_lock lock(m_lock);
+        auto statistics = m_statistics;
+        statistics.MappedEntries = m_mapped.size() > 0 ? static_cast<size_t>(GetFileHeader().EntryCount) : 0;
+        statistics.MappedBytes = m_mapped.size();
+        statistics.PendingEntries = m_pending.size();
+        statistics.PendingBytes = m_pendingBytes;
+        return statistics;
+    }
+
+private:
+    using EntryHeader = BinaryCacheFormat::EntryHeader;
+
+    // Found this session and not in the mapped file yet
+    struct PendingEntry
+    {
+        BinaryFileStamp Stamp;
+        std::optional<BinaryMetadata> Metadata;
+        bool HasIcon = false;
+        uint32_t IconWidth = 0;
+        uint32_t IconHeight = 0;
+        std::unique_ptr<uint8_t[]> Pixels;
+        // Changes with every store, so compaction can tell whether the entry
+        // it wrote is still the current one
+        uint64_t Version = 0;
+        // Lookup returned the pixels, they have to outlive the entry
+        bool HandedOut = false;
+    };
+
+    // An entry on its way into the compacted file
+    struct CompactionEntry
+    {
+        std::wstring_view Path;
+        EntryHeader Header;
+        uint8_t const* Pixels;
+        size_t Size;
+        // Of the pending entry it was written from, 0 if it came from the
+        // mapped file
+        uint64_t PendingVersion;
+    };
+
+    static bool IsValid(MappedFile const& file)
+    {
+        using namespace BinaryCacheFormat;
+        FileHeader header = {};
+        if (file.size() < sizeof(header))
+        {
+            return false;
+        }
+        memcpy(&header, file.data(), sizeof(header));
+        auto bucketsEnd = sizeof(header) + static_cast<uint64_t>(header.BucketCount) * sizeof(Bucket);
+        return memcmp(header.Magic, BinaryCacheFormat::Magic, sizeof(header.Magic)) == 0 &&
+            header.Version == BinaryCacheFormat::Version &&
+            header.FileSize == file.size() &&
+            header.BucketCount > 0 && (header.BucketCount & (header.BucketCount - 1)) == 0 &&
+            bucketsEnd <= file.size();
+    }
+
+    BinaryCacheFormat::FileHeader const& GetFileHeader() const
+    {
+        return *reinterpret_cast<BinaryCacheFormat::FileHeader const*>(m_mapped.data());
+    }
+
+    EntryHeader const& GetMappedHeader(uint64_t offset) const
+    {
+        return *reinterpret_cast<EntryHeader const*>(m_mapped.data() + offset);
+    }
+
+    std::wstring_view GetMappedPath(uint64_t offset) const
+    {
+        auto& header = GetMappedHeader(offset);
+        return { reinterpret_cast<wchar_t const*>(m_mapped.data() + offset + sizeof(EntryHeader)), header.PathLength };
+    }
+
+    std::optional<uint64_t> FindMapped(std::wstring_view path) const
+    {
+        using namespace BinaryCacheFormat;
+        if (m_mapped.size() == 0)
+        {
+            return std::nullopt;
+        }
+        auto& fileHeader = GetFileHeader();
+        auto buckets = reinterpret_cast<Bucket const*>(m_mapped.data() + sizeof(FileHeader));
+        auto mask = static_cast<size_t>(fileHeader.BucketCount) - 1;
+        auto hash = HashPath(path);
+        for (size_t probe = 0, index = hash & mask; probe <= mask; probe++, index = (index + 1) & mask)
+        {
+            auto& bucket = buckets[index];
+            if (bucket.Offset == 0)
+            {
+                return std::nullopt;
+            }
+            if (bucket.PathHash == hash && IsInBounds(bucket.Offset) && GetMappedPath(bucket.Offset) == path)
+            {
+                return bucket.Offset;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Everything else trusts the offsets that pass this
+    bool IsInBounds(uint64_t offset) const
+    {
+        using namespace BinaryCacheFormat;
+        if (offset % 8 != 0 || offset < sizeof(FileHeader) || offset > m_mapped.size() || m_mapped.size() - offset < sizeof(EntryHeader))
+        {
+            return false;
+        }
+        auto& header = GetMappedHeader(offset);
+        auto pathEnd = offset + sizeof(EntryHeader) + Align(static_cast<size_t>(header.PathLength) * sizeof(wchar_t));
+        return pathEnd + GetPixelsSize(header.IconWidth, header.IconHeight) <= m_mapped.size();
+    }
+
+    BinaryCacheEntry GetEntry(uint64_t offset) const
+    {
+        using namespace BinaryCacheFormat;
+        auto& header = GetMappedHeader(offset);
+        BinaryCacheEntry entry;
+        if (header.Flags & HasMetadata)
+        {
+            entry.Metadata = BinaryMetadata{ header.Machine, header.Subsystem, header.FileVersion };
+        }
+        if (header.Flags & HasIcon)
+        {
+            IconBitmapView icon;
+            if (header.IconWidth > 0 && header.IconHeight > 0)
+            {
+                icon.Width = header.IconWidth;
+                icon.Height = header.IconHeight;
+                icon.Pixels = m_mapped.data() + offset + sizeof(EntryHeader) + Align(static_cast<size_t>(header.PathLength) * sizeof(wchar_t));
+            }
+            entry.Icon = icon;
+        }
+        return entry;
+    }
+
+    static BinaryCacheEntry GetEntry(PendingEntry const& pending)
+    {
+        BinaryCacheEntry entry;
+        entry.Metadata = pending.Metadata;
+        if (pending.HasIcon)
+        {
+            entry.Icon = IconBitmapView{ pending.IconWidth, pending.IconHeight, pending.Pixels.get() };
+        }
+        return entry;
+    }
+
+    PendingEntry& GetPending(std::wstring const& path, BinaryFileStamp const& stamp)
+    {
+        auto [search, inserted] = m_pending.try_emplace(path);
+        auto& entry = search->second;
+        if (inserted || entry.Stamp != stamp)
+        {
+            if (!inserted)
+            {
+                // The binary changed while we were running
+                // A running compaction may still be writing the old pixels
+                m_pendingBytes -= BinaryCacheFormat::GetPixelsSize(entry.IconWidth, entry.IconHeight);
+                m_retiredPixels.push_back(std::move(entry.Pixels));
+                entry = PendingEntry{};
+            }
+            else
+            {
+                m_pendingBytes += sizeof(EntryHeader) + path.size() * sizeof(wchar_t);
+            }
+            entry.Stamp = stamp;
+            entry.Version = ++m_pendingVersion;
+            // Start from what the file knows about this version, so the entry
+            // replacing it doesn't lose anything
+            if (auto offset = FindMapped(path))
+            {
+                auto& header = GetMappedHeader(*offset);
+                if (header.FileSize == stamp.Size && header.LastWriteTime == stamp.LastWriteTime)
+                {
+                    auto mapped = GetEntry(*offset);
+                    entry.Metadata = mapped.Metadata;
+                    if (mapped.Icon)
+                    {
+                        entry.HasIcon = true;
+                        if (mapped.Icon->Pixels != nullptr)
+                        {
+                            auto size = BinaryCacheFormat::GetPixelsSize(mapped.Icon->Width, mapped.Icon->Height);
+                            entry.IconWidth = mapped.Icon->Width;
+                            entry.IconHeight = mapped.Icon->Height;
+                            entry.Pixels = std::make_unique<uint8_t[]>(size);
+                            memcpy(entry.Pixels.get(), mapped.Icon->Pixels, size);
+                            m_pendingBytes += size;
+                        }
+                    }
+                }
+            }
+        }
+        return entry;
+    }
+
+    void OnStored(std::unique_lock<std::mutex> const&, size_t bytes)
+    {
+        m_dirty = true;
+        m_uncompactedBytes += bytes;
+        if (m_uncompactedBytes >= m_compactionThreshold)
+        {
+            StartCompaction();
+        }
+    }
+
+    // Called with the lock held
+    void StartCompaction()
+    {
+        if (m_compacting)
+        {
+            return;
+        }
+        if (m_compactor.joinable())
+        {
+            m_compactor.join();
+        }
+        m_compacting = true;
+        m_compactor = std::thread([this]()
+            {
+                Compact();
+                std::scoped_lock lock(m_lock);
+                m_compacting = false;
+            });
+    }
+
+    // Everything the next file should hold, most recently used first and cut
+    // off at the size cap. Called with the lock held. Only reads the mapping
+    // and the pending entries, which stay put until the next file is mapped.
+    std::vector<CompactionEntry> CollectEntries()
+    {
+        using namespace BinaryCacheFormat;
+        auto now = Now();
+        std::vector<CompactionEntry> entries;
+        entries.reserve(m_pending.size());
+        for (auto&& [path, pending] : m_pending)
+        {
+            EntryHeader header = {};
+            header.FileSize = pending.Stamp.Size;
+            header.LastWriteTime = pending.Stamp.LastWriteTime;
+            header.LastUsed = now;
+            header.PathLength = static_cast<uint32_t>(path.size());
+            if (pending.Metadata)
+            {
+                header.Flags |= HasMetadata;
+                header.Machine = pending.Metadata->Machine;
+                header.Subsystem = pending.Metadata->Subsystem;
+                header.FileVersion = pending.Metadata->FileVersion;
+            }
+            if (pending.HasIcon)
+            {
+                header.Flags |= HasIcon;
+                header.IconWidth = static_cast<uint16_t>(pending.IconWidth);
+                header.IconHeight = static_cast<uint16_t>(pending.IconHeight);
+            }
+            entries.push_back({ path, header, pending.Pixels.get(), 0, pending.Version });
+        }
+        if (m_mapped.size() > 0)
+        {
+            auto& fileHeader = GetFileHeader();
+            auto buckets = reinterpret_cast<Bucket const*>(m_mapped.data() + sizeof(FileHeader));
+            for (size_t i = 0; i < fileHeader.BucketCount; i++)
+            {
+                auto offset = buckets[i].Offset;
+                if (offset == 0 || m_stale.count(offset) > 0 || !IsInBounds(offset))
+                {
+                    continue;
+                }
+                auto path = GetMappedPath(offset);
+                if (m_pending.count(std::wstring(path)) > 0)
+                {
+                    continue;
+                }
+                auto header = GetMappedHeader(offset);
+                if (m_used.count(offset) > 0)
+                {
+                    header.LastUsed = now;
+                }
+                auto pixels = header.IconWidth > 0 ? m_mapped.data() + offset + sizeof(EntryHeader) + Align(static_cast<size_t>(header.PathLength) * sizeof(wchar_t)) : nullptr;
+                entries.push_back({ path, header, pixels, 0, 0 });
+            }
+        }
+
+        std::stable_sort(entries.begin(), entries.end(), [](CompactionEntry const& left, CompactionEntry const& right)
+            {
+                return left.Header.LastUsed > right.Header.LastUsed;
+            });
+        size_t total = sizeof(FileHeader);
+        size_t kept = 0;
+        for (auto&& entry : entries)
+        {
+            entry.Size = sizeof(EntryHeader) + Align(entry.Path.size() * sizeof(wchar_t)) + Align(GetPixelsSize(entry.Header.IconWidth, entry.Header.IconHeight));
+            // Budgets for the most buckets an entry can need
+            if (total + entry.Size + 4 * sizeof(Bucket) > m_sizeCap)
+            {
+                break;
+            }
+            total += entry.Size + 4 * sizeof(Bucket);
+            kept++;
+        }
+        entries.resize(kept);
+        return entries;
+    }
+
+    // At most half full, so probes stay short
+    static uint32_t GetBucketCount(size_t entryCount)
+    {
+        uint32_t bucketCount = 16;
+        while (bucketCount < entryCount * 2)
+        {
+            bucketCount *= 2;
+        }
+        return bucketCount;
+    }
+
+    void Compact()
+    {
+        using namespace BinaryCacheFormat;
+        std::vector<CompactionEntry> entries;
+        {
+            std::scoped_lock lock(m_lock);
+            m_dirty = false;
+            m_uncompactedBytes = 0;
+            m_statistics.Compactions++;
+            entries = CollectEntries();
+        }
+
+        auto bucketCount = GetBucketCount(entries.size());
+        std::vector<Bucket> buckets(bucketCount, Bucket{ 0, 0 });
+        uint64_t offset = sizeof(FileHeader) + static_cast<uint64_t>(bucketCount) * sizeof(Bucket);
+        for (auto&& entry : entries)
+        {
+            auto hash = HashPath(entry.Path);
+            auto index = hash & (bucketCount - 1);
+            while (buckets[index].Offset != 0)
+            {
+                index = (index + 1) & (bucketCount - 1);
+            }
+            buckets[index] = { hash, offset };
+            offset += entry.Size;
+        }
+
+        FileHeader header = {};
+        memcpy(header.Magic, BinaryCacheFormat::Magic, sizeof(header.Magic));
+        header.Version = BinaryCacheFormat::Version;
+        header.BucketCount = bucketCount;
+        header.EntryCount = entries.size();
+        header.FileSize = offset;
+
+        auto compactedPath = GetCompactedPath(m_path, m_compactedIndex);
+        {
+            // A mapping of an earlier compaction may still be using the file,
+            // it keeps the old contents
+            std::error_code error;
+            std::filesystem::remove(compactedPath, error);
+            std::ofstream stream(compactedPath, std::ios::binary | std::ios::trunc);
+            static constexpr char padding[8] = {};
+            stream.write(reinterpret_cast<char const*>(&header), sizeof(header));
+            stream.write(reinterpret_cast<char const*>(buckets.data()), buckets.size() * sizeof(Bucket));
+            for (auto&& entry : entries)
+            {
+                auto pathSize = entry.Path.size() * sizeof(wchar_t);
+                auto pixelsSize = GetPixelsSize(entry.Header.IconWidth, entry.Header.IconHeight);
+                stream.write(reinterpret_cast<char const*>(&entry.Header), sizeof(entry.Header));
+                stream.write(reinterpret_cast<char const*>(entry.Path.data()), pathSize);
+                stream.write(padding, Align(pathSize) - pathSize);
+                if (pixelsSize > 0)
+                {
+                    stream.write(reinterpret_cast<char const*>(entry.Pixels), pixelsSize);
+                    stream.write(padding, Align(pixelsSize) - pixelsSize);
+                }
+            }
+            stream.flush();
+            if (!stream)
+            {
+                return;
+            }
+        }
+
+        MappedFile compacted;
+        if (!compacted.Open(compactedPath) || !IsValid(compacted))
+        {
+            return;
+        }
+        std::scoped_lock lock(m_lock);
+        AdoptCompacted(std::move(compacted), entries);
+    }
+
+    // Switches lookups over to the compacted file and drops the pending
+    // entries that were written to it, unless they changed since. Icons that
+    // were handed out from the old mapping or from a dropped entry keep
+    // pointing there. Called with the lock held.
+    void AdoptCompacted(MappedFile compacted, std::vector<CompactionEntry> const& entries)
+    {
+        for (auto&& entry : entries)
+        {
+            if (entry.PendingVersion == 0)
+            {
+                continue;
+            }
+            auto search = m_pending.find(std::wstring(entry.Path));
+            if (search == m_pending.end() || search->second.Version != entry.PendingVersion)
+            {
+                continue;
+            }
+            auto& pending = search->second;
+            m_pendingBytes -= sizeof(EntryHeader) + search->first.size() * sizeof(wchar_t) +
+                BinaryCacheFormat::GetPixelsSize(pending.IconWidth, pending.IconHeight);
+            if (pending.HandedOut && pending.Pixels)
+            {
+                m_retiredPixels.push_back(std::move(pending.Pixels));
+            }
+            m_pending.erase(search);
+        }
+
+        if (m_mapped.size() > 0 && !m_used.empty())
+        {
+            m_retiredMappings.push_back(std::move(m_mapped));
+        }
+        m_mapped = std::move(compacted);
+        m_compactedIndex = 1 - m_compactedIndex;
+        // Offsets into the old mapping. What was used was just written as
+        // used now, stale entries were left out.
+        m_used.clear();
+        m_stale.clear();
+    }
+
+private:
+    std::filesystem::path m_path;
+    size_t m_sizeCap = DefaultSizeCap;
+    size_t m_compactionThreshold = DefaultCompactionThreshold;
+
+    std::mutex m_lock;
+    MappedFile m_mapped;
+    std::unordered_map<std::wstring, PendingEntry> m_pending;
+    size_t m_pendingBytes = 0;
+    // Offsets into the mapping of entries that were looked up this session,
+    // and of ones that turned out to be for an older version of the binary
+    std::unordered_set<uint64_t> m_used;
+    std::unordered_set<uint64_t> m_stale;
+    bool m_dirty = false;
+    BinaryMetadataCacheStatistics m_statistics;
+
+    // Stored since the last compaction started
+    size_t m_uncompactedBytes = 0;
+    // Replaced by a newer version of their binary, or written to the
+    // compacted file, but possibly still pointed into
+    std::vector<std::unique_ptr<uint8_t[]>> m_retiredPixels;
+    // Mappings replaced by a compacted file that icons were handed out from
+    std::vector<MappedFile> m_retiredMappings;
+    uint64_t m_pendingVersion = 0;
+    // Which of the compacted files the next compaction writes
+    size_t m_compactedIndex = 0;
+
+    bool m_compacting = false;
+    std::thread m_compactor;
+};
@@ -0,0 +1,167 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum class OverflowPolicy
+{
+    // Submit waits for room in the queue, slowing the producer down
+    Block,
+    // Submit fails right away and the producer decides what to do
+    Reject,
+};
+
+// A fixed number of worker threads serving a queue with a capacity limit.
+// Items are handled in submission order (though with several workers they
+// can finish in any order). Items still queued when the pool is destroyed
+// are dropped, items being handled are finished. The queue is a circular
+// buffer allocated up front, queueing an item only moves it into a slot.
+template <typename TItem>
+class BoundedWorkerPool
+{
+public:
+    using Handler = std::function<void(TItem&)>;
+
+    BoundedWorkerPool(size_t workerCount, size_t capacity, Handler handler)
+        : m_capacity(std::max<size_t>(capacity, 1)), m_handler(std::move(handler)), m_items(m_capacity)
+    {
+        for (size_t i = 0; i < std::max<size_t>(workerCount, 1); i++)
+        {
+            m_workers.emplace_back([this]() { Run(); });
+        }
+    }
+
+    ~BoundedWorkerPool()
+    {
+        {
+            std::scoped_lock lock(m_lock);
+            m_stopping = true;
+            m_count = 0;
+        }
+        m_itemAvailable.notify_all();
+        m_spaceAvailable.notify_all();
+        for (auto&& worker : m_workers)
+        {
+            worker.join();
+        }
+    }
+
+    BoundedWorkerPool(BoundedWorkerPool const&) = delete;
+    BoundedWorkerPool& operator=(BoundedWorkerPool const&) = delete;
+
+    // Returns false if the item wasn't queued, either because the queue is
+    // full and the policy is Reject or because the pool is shutting down.
+    bool Submit(TItem item, OverflowPolicy policy)
+    {
+        {
+            std::unique_lock lock(m_lock);
+            if (policy == OverflowPolicy::Block)
+            {
+                m_spaceAvailable.wait(lock, [this]() { return m_stopping || m_count < m_capacity; });
+            }
+            if (m_stopping || m_count >= m_capacity)
+            {
+                return false;
+            }
+            At(m_count) = std::move(item);
+            m_count++;
+            m_peakDepth = std::max(m_peakDepth, m_count);
+        }
+        m_itemAvailable.notify_one();
+        return true;
+    }
+
+    // Drops queued items that match the predicate. Returns how many were
+    // dropped.
+    template <typename TPredicate>
+    size_t RemoveIf(TPredicate&& predicate)
+    {
+        size_t removed = 0;
+        {
+            std::scoped_lock lock(m_lock);
+            // Closes the gaps in place, keeping the order
+            size_t kept = 0;
+            for (size_t i = 0; i < m_count; i++)
+            {
+                if (!predicate(static_cast<TItem const&>(At(i))))
+                {
+                    if (kept != i)
+                    {
+                        At(kept) = std::move(At(i));
+                    }
+                    kept++;
+                }
+            }
+            removed = m_count - kept;
+            m_count = kept;
+        }
+        if (removed > 0)
+        {
+            m_spaceAvailable.notify_all();
+        }
+        return removed;
+    }
+
+    size_t QueueDepth()
+    {
+        std::scoped_lock lock(m_lock);
+        return m_count;
+    }
+
+    size_t PeakQueueDepth()
+    {
+        std::scoped_lock lock(m_lock);
+        return m_peakDepth;
+    }
+
+    size_t Capacity() const
+    {
+        return m_capacity;
+    }
+
+private:
+    // The queued item at the given index, 0 being the oldest
+    TItem& At(size_t index)
+    {
+        return m_items[(m_first + index) % m_capacity];
+    }
+
+    void Run()
+    {
+        while (true)
+        {
+            TItem item;
+            {
+                std::unique_lock lock(m_lock);
+                m_itemAvailable.wait(lock, [this]() { return m_stopping || m_count > 0; });
+                if (m_stopping)
+                {
+                    return;
+                }
+                item = std::move(At(0));
+                m_first = (m_first + 1) % m_capacity;
+                m_count--;
+            }
+            m_spaceAvailable.notify_one();
+            m_handler(item);
+        }
+    }
+
+private:
+    size_t m_capacity = 0;
+    Handler m_handler;
+
+    std::mutex m_lock;
+    std::condition_variable m_itemAvailable;
+    std::condition_variable m_spaceAvailable;
+    // m_count items starting at m_first, wrapping around
+    std::vector<TItem> m_items;
+    size_t m_first = 0;
+    size_t m_count = 0;
+    size_t m_peakDepth = 0;
+    bool m_stopping = false;
+    std::vector<std::thread> m_workers;
+};
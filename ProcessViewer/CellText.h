@@ -0,0 +1,223 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include "Process.h"
+
+// Writes cell text straight into a caller provided buffer (e.g. the one the
+// list view hands out in LVN_GETDISPINFO) without allocating. Text that
+// doesn't fit is truncated, and the buffer is always null terminated.
+class CellWriter
+{
+public:
+    CellWriter(wchar_t* buffer, size_t capacity) : m_buffer(buffer), m_capacity(capacity)
+    {
+        if (m_capacity > 0)
+        {
+            m_buffer[0] = L'\0';
+        }
+    }
+
+    void Append(std::wstring_view text)
+    {
+        if (m_capacity == 0)
+        {
+            m_truncated = m_truncated || !text.empty();
+            return;
+        }
+        auto available = m_capacity - 1 - m_length;
+        auto count = std::min(available, text.size());
+        std::copy_n(text.data(), count, m_buffer + m_length);
+        m_length += count;
+        m_buffer[m_length] = L'\0';
+        m_truncated = m_truncated || count < text.size();
+    }
+
+    // Same output as streaming the integer into a std::wostream
+    void AppendUnsigned(uint64_t value)
+    {
+        wchar_t digits[20];
+        auto end = std::end(digits);
+        auto current = end;
+        do
+        {
+            *--current = static_cast<wchar_t>(L'0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        Append(std::wstring_view(current, static_cast<size_t>(end - current)));
+    }
+
+    void Append(Architecture arch)
+    {
+        Append(GetArchitectureName(arch));
+    }
+
+    void Append(ProcessType type)
+    {
+        Append(GetProcessTypeName(type));
+    }
+
+    void Append(IntegrityLevel ilevel)
+    {
+        Append(GetIntegrityLevelName(ilevel));
+    }
+
+    template <typename T>
+    void Append(std::optional<T> const& optional)
+    {
+        if (optional.has_value())
+        {
+            Append(*optional);
+        }
+        else
+        {
+            Append(std::wstring_view(L"Unknown"));
+        }
+    }
+
+    std::wstring_view str() const
+    {
+        return std::wstring_view(m_buffer, m_length);
+    }
+
+    size_t size() const
+    {
+        return m_length;
+    }
+
+    bool truncated() const
+    {
+        return m_truncated;
+    }
+
+private:
+    wchar_t* m_buffer = nullptr;
+    size_t m_capacity = 0;
+    size_t m_length = 0;
+    bool m_truncated = false;
+};
+
+// Formatted text for every (row, column) cell, so that repainting a row
+// that hasn't changed is a copy. Storage is a flat array of fixed size cells
+// that is sized when rows are added, never while painting. Columns whose text
+// is already stored somewhere (e.g. names, in the table's string pool) aren't
+// cached, formatting them is a copy already. Text longer than a cell is
+// marked as not cacheable and formatted again each time. Callers invalidate a
+// row whenever its process changes.
+class FormattedCellCache
+{
+public:
+    static constexpr size_t CellCapacity = 16;
+
+    FormattedCellCache() = default;
+
+    // One entry per column, whether to cache it
+    explicit FormattedCellCache(std::vector<bool> const& cachedColumns)
+    {
+        for (auto cached : cachedColumns)
+        {
+            m_columnCells.push_back(cached ? static_cast<uint8_t>(m_columnCount++) : NoCell);
+        }
+    }
+
+    bool enabled() const
+    {
+        return m_columnCount > 0;
+    }
+
+    bool IsCached(size_t column) const
+    {
+        return column < m_columnCells.size() && m_columnCells[column] != NoCell;
+    }
+
+    // Grows or shrinks to the given number of rows; new rows start empty
+    void Resize(size_t rowCount)
+    {
+        if (!enabled())
+        {
+            return;
+        }
+        m_text.resize(rowCount * m_columnCount * CellCapacity);
+        m_lengths.resize(rowCount * m_columnCount, Empty);
+    }
+
+    void Clear()
+    {
+        std::fill(m_lengths.begin(), m_lengths.end(), Empty);
+    }
+
+    void Invalidate(size_t row)
+    {
+        if (!enabled())
+        {
+            return;
+        }
+        if (row >= RowCount())
+        {
+            Resize(row + 1);
+        }
+        std::fill_n(m_lengths.begin() + row * m_columnCount, m_columnCount, Empty);
+    }
+
+    // Copies the cell into the writer using the cached text when there is
+    // any, otherwise formats it with format(CellWriter&) and caches the
+    // result if it fits.
+    template <typename TFormat>
+    void Write(size_t row, size_t column, CellWriter& writer, TFormat&& format)
+    {
+        if (!enabled() || row >= RowCount() || !IsCached(column))
+        {
+            format(writer);
+            return;
+        }
+
+        auto cell = row * m_columnCount + m_columnCells[column];
+        auto length = m_lengths[cell];
+        auto text = m_text.data() + cell * CellCapacity;
+        if (length < CellCapacity)
+        {
+            writer.Append(std::wstring_view(text, length));
+        }
+        else if (length == NotCacheable)
+        {
+            format(writer);
+        }
+        else
+        {
+            // The cell keeps a terminator, so it holds CellCapacity - 1 characters
+            CellWriter cellWriter(text, CellCapacity);
+            format(cellWriter);
+            if (cellWriter.truncated())
+            {
+                m_lengths[cell] = NotCacheable;
+                format(writer);
+            }
+            else
+            {
+                m_lengths[cell] = static_cast<uint8_t>(cellWriter.size());
+                writer.Append(cellWriter.str());
+            }
+        }
+    }
+
+private:
+    static constexpr uint8_t Empty = 0xFF;
+    static constexpr uint8_t NotCacheable = 0xFE;
+    static constexpr uint8_t NoCell = 0xFF;
+
+    size_t RowCount() const
+    {
+        return m_lengths.size() / m_columnCount;
+    }
+
+private:
+    // Of the cached columns, a row's cells are stored together
+    size_t m_columnCount = 0;
+    // Column -> its cell within a row, NoCell if it isn't cached
+    std::vector<uint8_t> m_columnCells;
+    std::vector<wchar_t> m_text;
+    std::vector<uint8_t> m_lengths;
+};
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+
+// Days from 1601-01-01 (the FILETIME epoch) to the given date of the
+// proleptic Gregorian calendar
+constexpr int64_t DaysSinceFileTimeEpoch(int64_t year, int64_t month, int64_t day)
+{
+    // Counts from March, so the leap day is the last day of its year
+    year -= month <= 2 ? 1 : 0;
+    auto era = year / 400;
+    auto yearOfEra = year - era * 400;
+    auto dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    auto dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    // 0000-03-01 to 1601-01-01
+    constexpr int64_t EpochDays = 584694;
+    return era * 146097 + dayOfEra - EpochDays;
+}
+
+// Converts a CIM DATETIME ("yyyymmddHHMMSS.mmmmmm+UUU", local time with the
+// offset from UTC in minutes) to a FILETIME. Returns 0 if it can't be parsed
+// or is out of the range SYSTEMTIME covers.
+inline uint64_t ParseCimDateTime(std::wstring_view text)
+{
+    if (text.size() != 25 || text[14] != L'.' || (text[21] != L'+' && text[21] != L'-'))
+    {
+        return 0;
+    }
+    auto parse = [&text](size_t offset, size_t length, int64_t& value)
+    {
+        value = 0;
+        for (auto c : text.substr(offset, length))
+        {
+            if (c < L'0' || c > L'9')
+            {
+                return false;
+            }
+            value = value * 10 + (c - L'0');
+        }
+        return true;
+    };
+    int64_t year, month, day, hour, minute, second, microseconds, offset;
+    if (!parse(0, 4, year) || !parse(4, 2, month) || !parse(6, 2, day) || !parse(8, 2, hour) || !parse(10, 2, minute) ||
+        !parse(12, 2, second) || !parse(15, 6, microseconds) || !parse(22, 3, offset))
+    {
+        return 0;
+    }
+
+    // What SystemTimeToFileTime accepts
+    constexpr int64_t DaysInMonth[] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    auto leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+    if (year < 1601 || month < 1 || month > 12 || day < 1 || day > DaysInMonth[month - 1] ||
+        (month == 2 && day == 29 && !leap) || hour > 23 || minute > 59 || second > 59)
+    {
+        return 0;
+    }
+
+    constexpr int64_t TicksPerSecond = 1000 * 1000 * 10;
+    constexpr int64_t TicksPerMinute = 60 * TicksPerSecond;
+    auto seconds = ((DaysSinceFileTimeEpoch(year, month, day) * 24 + hour) * 60 + minute) * 60 + second;
+    auto time = seconds * TicksPerSecond + microseconds * 10;
+    time -= (text[21] == L'+' ? offset : -offset) * TicksPerMinute;
+    return time > 0 ? static_cast<uint64_t>(time) : 0;
+}
@@ -0,0 +1,155 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <type_traits>
+
+// A bounded lock-free queue of preallocated slots, for handing events from
+// producer threads to a single consumer without allocating. Producers write
+// straight into a slot; the consumer reads slots in place and drains in
+// bulk. With SingleProducer set, pushes skip the compare-exchange that
+// arbitrates between producers. Capacity is rounded up to a power of two.
+//
+// Each cell carries a sequence number that says whose turn it is: the
+// position a producer may claim it at, that position + 1 once it holds a
+// value for the consumer, and position + capacity once it is free again.
+template <typename TSlot, bool SingleProducer = false>
+class EventRing
+{
+    static_assert(std::is_trivially_copyable_v<TSlot>, "Slots are reused without being constructed or destroyed");
+
+public:
+    explicit EventRing(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size *= 2;
+        }
+        m_mask = size - 1;
+        m_cells = std::make_unique<Cell[]>(size);
+        for (size_t i = 0; i < size; i++)
+        {
+            m_cells[i].Sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    EventRing(EventRing const&) = delete;
+    EventRing& operator=(EventRing const&) = delete;
+
+    // Calls fill(TSlot&) to write the event into a free slot. Returns false
+    // without calling it if the ring is full.
+    template <typename TFill>
+    bool TryPush(TFill&& fill)
+    {
+        Cell* cell = nullptr;
+        auto position = m_enqueuePosition.load(std::memory_order_relaxed);
+        while (true)
+        {
+            cell = &m_cells[position & m_mask];
+            auto sequence = cell->Sequence.load(std::memory_order_acquire);
+            auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (difference == 0)
+            {
+                if constexpr (SingleProducer)
+                {
+                    m_enqueuePosition.store(position + 1, std::memory_order_relaxed);
+                    break;
+                }
+                else if (m_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (difference < 0)
+            {
+                // The consumer hasn't freed this cell from the last lap yet
+                return false;
+            }
+            else
+            {
+                position = m_enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+        fill(cell->Value);
+        cell->Sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Calls consume(TSlot const&) for up to maxCount events in
+    // the order they were claimed and returns how many there were. Stops
+    // early at a slot whose producer hasn't finished writing it.
+    template <typename TConsume>
+    size_t Drain(TConsume&& consume, size_t maxCount = SIZE_MAX)
+    {
+        auto position = m_dequeuePosition.load(std::memory_order_relaxed);
+        size_t count = 0;
+        while (count < maxCount)
+        {
+            auto& cell = m_cells[position & m_mask];
+            if (cell.Sequence.load(std::memory_order_acquire) != position + 1)
+            {
+                break;
+            }
+            consume(static_cast<TSlot const&>(cell.Value));
+            cell.Sequence.store(position + m_mask + 1, std::memory_order_release);
+            position++;
+            count++;
+        }
+        m_dequeuePosition.store(position, std::memory_order_relaxed);
+        return count;
+    }
+
+    // Consumer only. Like Drain, but waits for producers that have claimed
+    // a slot and are still writing it, until every slot claimed before the
+    // given position (see ClaimedPosition) is consumed.
+    template <typename TConsume>
+    size_t DrainThrough(size_t position, TConsume&& consume)
+    {
+        size_t count = 0;
+        while (m_dequeuePosition.load(std::memory_order_relaxed) < position)
+        {
+            auto drained = Drain(consume, position - m_dequeuePosition.load(std::memory_order_relaxed));
+            if (drained == 0)
+            {
+                std::this_thread::yield();
+            }
+            count += drained;
+        }
+        return count;
+    }
+
+    // How many slots producers have claimed so far
+    size_t ClaimedPosition() const
+    {
+        return m_enqueuePosition.load(std::memory_order_acquire);
+    }
+
+    size_t Capacity() const
+    {
+        return m_mask + 1;
+    }
+
+    // Only a snapshot, producers and the consumer keep moving
+    size_t ApproximateSize() const
+    {
+        auto enqueue = m_enqueuePosition.load(std::memory_order_relaxed);
+        auto dequeue = m_dequeuePosition.load(std::memory_order_relaxed);
+        return enqueue > dequeue ? enqueue - dequeue : 0;
+    }
+
+private:
+    struct alignas(64) Cell
+    {
+        std::atomic<size_t> Sequence;
+        TSlot Value;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask = 0;
+    // On separate cache lines so producers and the consumer don't contend
+    alignas(64) std::atomic<size_t> m_enqueuePosition = 0;
+    alignas(64) std::atomic<size_t> m_dequeuePosition = 0;
+};
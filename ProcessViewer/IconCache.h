@@ -0,0 +1,211 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct IconCacheStatistics
+{
+    uint64_t Hits = 0;
+    uint64_t Misses = 0;
+    uint64_t Evictions = 0;
+    size_t Entries = 0;
+    // Slots holding an icon right now, and every slot ever handed out (freed
+    // ones are reused, so the image list is SlotCount icons long)
+    size_t UsedSlots = 0;
+    size_t SlotCount = 0;
+    size_t Bytes = 0;
+    size_t Budget = 0;
+
+    double HitRate() const
+    {
+        auto lookups = Hits + Misses;
+        return lookups > 0 ? static_cast<double>(Hits) / lookups : 0.0;
+    }
+
+    double Occupancy() const
+    {
+        return Budget > 0 ? static_cast<double>(Bytes) / Budget : 0.0;
+    }
+};
+
+// Which image list slot holds the icon of each executable path, within a
+// memory budget. Every entry costs its path plus, if the binary has an icon,
+// slotBytes for its slot. Once the budget is used up, entries are evicted in
+// CLOCK order: looking an entry up marks it, and the hand sweeping over the
+// entries clears marks and evicts the first unmarked one, so icons of rows
+// that keep being drawn stay. Slots of evicted icons are reused for the next
+// ones rather than growing the image list.
+class IconCache
+{
+public:
+    // defaultSlot is what Find returns for binaries without an icon
+    IconCache(size_t budget = 0, size_t slotBytes = 0, int defaultSlot = 0)
+        : m_budget(budget), m_slotBytes(slotBytes), m_defaultSlot(defaultSlot)
+    {
+    }
+
+    // Returns std::nullopt if the path isn't cached (anymore)
+    std::optional<int> Find(std::wstring const& path)
+    {
+        auto search = m_index.find(path);
+        if (search == m_index.end())
+        {
+            m_statistics.Misses++;
+            return std::nullopt;
+        }
+        m_statistics.Hits++;
+        auto& entry = m_entries[search->second];
+        entry.Referenced = true;
+        return entry.Slot == NoSlot ? m_defaultSlot : entry.Slot;
+    }
+
+    // Doesn't count as a lookup
+    bool Contains(std::wstring const& path) const
+    {
+        return m_index.find(path) != m_index.end();
+    }
+
+    // Adds (or replaces) the path's entry, evicting others to make room.
+    // For binaries with an icon, place(std::optional<int> freeSlot) puts the
+    // icon in freeSlot (or a new slot if there is none) and returns the slot
+    // it ended up in, or a negative value if it couldn't be placed.
+    template <typename TPlace>
+    void Insert(std::wstring const& path, bool hasIcon, TPlace&& place)
+    {
+        Remove(path);
+        auto cost = sizeof(Entry) + path.size() * sizeof(wchar_t) + (hasIcon ? m_slotBytes : 0);
+        while (m_statistics.Bytes + cost > m_budget && m_index.size() > 0)
+        {
+            Evict();
+        }
+
+        auto slot = NoSlot;
+        if (hasIcon)
+        {
+            std::optional<int> freeSlot;
+            if (!m_freeSlots.empty())
+            {
+                freeSlot = m_freeSlots.back();
+                m_freeSlots.pop_back();
+            }
+            slot = place(freeSlot);
+            if (slot < 0)
+            {
+                if (freeSlot.has_value())
+                {
+                    m_freeSlots.push_back(*freeSlot);
+                }
+                return;
+            }
+            if (!freeSlot.has_value())
+            {
+                m_statistics.SlotCount++;
+            }
+            m_statistics.UsedSlots++;
+        }
+
+        uint32_t index = 0;
+        if (!m_freeEntries.empty())
+        {
+            index = m_freeEntries.back();
+            m_freeEntries.pop_back();
+        }
+        else
+        {
+            index = static_cast<uint32_t>(m_entries.size());
+            m_entries.emplace_back();
+        }
+        auto inserted = m_index.emplace(path, index).first;
+        // Not marked, so a hot entry's mark outlives a burst of new ones. The
+        // new entry usually takes the place the hand just freed, which gives
+        // it a whole sweep to be looked up.
+        m_entries[index] = { &inserted->first, slot, cost, false };
+        m_statistics.Bytes += cost;
+    }
+
+    // Its slot is reused for the next icon
+    void Remove(std::wstring const& path)
+    {
+        auto search = m_index.find(path);
+        if (search != m_index.end())
+        {
+            Free(search->second);
+        }
+    }
+
+    void Clear()
+    {
+        *this = IconCache(m_budget, m_slotBytes, m_defaultSlot);
+    }
+
+    IconCacheStatistics GetStatistics() const
+    {
+        auto statistics = m_statistics;
+        statistics.Entries = m_index.size();
+        statistics.Budget = m_budget;
+        return statistics;
+    }
+
+private:
+    static constexpr int NoSlot = -1;
+
+    struct Entry
+    {
+        // The key in m_index, null if the entry is free
+        std::wstring const* Path = nullptr;
+        int Slot = NoSlot;
+        size_t Cost = 0;
+        bool Referenced = false;
+    };
+
+    void Evict()
+    {
+        while (true)
+        {
+            auto index = static_cast<uint32_t>(m_hand);
+            m_hand = (m_hand + 1) % m_entries.size();
+            auto& entry = m_entries[index];
+            if (entry.Path == nullptr)
+            {
+                continue;
+            }
+            if (entry.Referenced)
+            {
+                entry.Referenced = false;
+                continue;
+            }
+            m_statistics.Evictions++;
+            Free(index);
+            return;
+        }
+    }
+
+    void Free(uint32_t index)
+    {
+        auto& entry = m_entries[index];
+        if (entry.Slot != NoSlot)
+        {
+            m_freeSlots.push_back(entry.Slot);
+            m_statistics.UsedSlots--;
+        }
+        m_statistics.Bytes -= entry.Cost;
+        m_index.erase(m_index.find(*entry.Path));
+        entry = {};
+        m_freeEntries.push_back(index);
+    }
+
+private:
+    size_t m_budget = 0;
+    size_t m_slotBytes = 0;
+    int m_defaultSlot = 0;
+
+    std::unordered_map<std::wstring, uint32_t> m_index;
+    // The clock, free entries are skipped
+    std::vector<Entry> m_entries;
+    size_t m_hand = 0;
+    std::vector<uint32_t> m_freeEntries;
+    std::vector<int> m_freeSlots;
+    IconCacheStatistics m_statistics;
+};
@@ -0,0 +1,171 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+struct IconLoaderStatistics
+{
+    uint64_t Requested = 0;
+    // Requests for a path that was still on its way
+    uint64_t Merged = 0;
+    uint64_t Loaded = 0;
+    uint64_t Wakeups = 0;
+    size_t Queued = 0;
+};
+
+// Loads icons for executable paths in the background, so a slow binary
+// (e.g. one on a network share) doesn't hold up the thread that shows them.
+// Requests for a path that is still queued, loading or waiting to be drained
+// are merged. Once drained, keeping track of it is up to the consumer, so a
+// path it dropped can be asked for again. At most workerCount loads run at a
+// time.
+//
+// Loaded icons are collected until the consumer drains them. wake is called
+// (on a worker thread) for the first icon after the consumer last started
+// draining, so the consumer can pick up a whole burst of icons in one go.
+template <typename TIcon>
+class IconLoader
+{
+public:
+    static constexpr size_t DefaultWorkerCount = 4;
+
+    using LoadCallback = std::function<TIcon(std::wstring const&)>;
+    using WakeCallback = std::function<void()>;
+
+    IconLoader(LoadCallback load, WakeCallback wake, size_t workerCount = DefaultWorkerCount)
+        : m_load(std::move(load)), m_wake(std::move(wake))
+    {
+        for (size_t i = 0; i < std::max<size_t>(workerCount, 1); i++)
+        {
+            m_workers.emplace_back([this]() { Run(); });
+        }
+    }
+
+    ~IconLoader()
+    {
+        {
+            std::scoped_lock lock(m_lock);
+            m_stopping = true;
+        }
+        m_queueChanged.notify_all();
+        for (auto&& worker : m_workers)
+        {
+            worker.join();
+        }
+    }
+
+    IconLoader(IconLoader const&) = delete;
+    IconLoader& operator=(IconLoader const&) = delete;
+
+    // Returns false if the path is already on its way
+    bool Request(std::wstring const& path)
+    {
+        {
+            std::scoped_lock lock(m_lock);
+            m_statistics.Requested++;
+            if (!m_requested.insert(path).second)
+            {
+                m_statistics.Merged++;
+                return false;
+            }
+            m_queue.push_back(path);
+        }
+        m_queueChanged.notify_one();
+        return true;
+    }
+
+    // Calls consume(std::wstring&& path, TIcon&& icon) for every icon loaded
+    // since the last drain, including ones that failed to load (whatever
+    // load returned for them). Returns how many there were.
+    template <typename TConsume>
+    size_t Drain(TConsume&& consume)
+    {
+        {
+            std::scoped_lock lock(m_lock);
+            m_loaded.swap(m_draining);
+            m_signalled = false;
+            for (auto&& loaded : m_draining)
+            {
+                m_requested.erase(loaded.first);
+            }
+        }
+        for (auto&& [path, icon] : m_draining)
+        {
+            consume(std::move(path), std::move(icon));
+        }
+        auto count = m_draining.size();
+        m_draining.clear();
+        return count;
+    }
+
+    IconLoaderStatistics GetStatistics()
+    {
+        std::scoped_lock lock(m_lock);
+        auto statistics = m_statistics;
+        statistics.Queued = m_queue.size();
+        return statistics;
+    }
+
+private:
+    void Run()
+    {
+        while (true)
+        {
+            std::wstring path;
+            {
+                std::unique_lock lock(m_lock);
+                m_queueChanged.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+                if (m_stopping)
+                {
+                    return;
+                }
+                path = std::move(m_queue.front());
+                m_queue.pop_front();
+            }
+
+            auto icon = m_load(path);
+
+            bool wake = false;
+            {
+                std::scoped_lock lock(m_lock);
+                m_statistics.Loaded++;
+                m_loaded.emplace_back(std::move(path), std::move(icon));
+                if (!m_signalled)
+                {
+                    m_signalled = true;
+                    m_statistics.Wakeups++;
+                    wake = true;
+                }
+            }
+            if (wake)
+            {
+                m_wake();
+            }
+        }
+    }
+
+private:
+    LoadCallback m_load;
+    WakeCallback m_wake;
+
+    std::mutex m_lock;
+    std::condition_variable m_queueChanged;
+    std::deque<std::wstring> m_queue;
+    // Queued, loading or loaded but not drained yet
+    std::unordered_set<std::wstring> m_requested;
+    std::vector<std::pair<std::wstring, TIcon>> m_loaded;
+    bool m_signalled = false;
+    bool m_stopping = false;
+    IconLoaderStatistics m_statistics;
+    // Consumer only, swapped with m_loaded so both keep their capacity
+    std::vector<std::pair<std::wstring, TIcon>> m_draining;
+
+    std::vector<std::thread> m_workers;
+};
@@ -0,0 +1,459 @@
+#pragma once
+#ifdef __linux__
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <dirent.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "ProcessSource.h"
+
+class unique_fd
+{
+public:
+    unique_fd() = default;
+    explicit unique_fd(int fd) : m_fd(fd) {}
+    unique_fd(unique_fd&& other) noexcept : m_fd(other.release()) {}
+    unique_fd& operator=(unique_fd&& other) noexcept
+    {
+        reset(other.release());
+        return *this;
+    }
+    unique_fd(unique_fd const&) = delete;
+    unique_fd& operator=(unique_fd const&) = delete;
+    ~unique_fd() { reset(); }
+
+    int get() const { return m_fd; }
+    bool is_valid() const { return m_fd >= 0; }
+    int release()
+    {
+        auto fd = m_fd;
+        m_fd = -1;
+        return fd;
+    }
+    void reset(int fd = -1)
+    {
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+        }
+        m_fd = fd;
+    }
+
+private:
+    int m_fd = -1;
+};
+
+// Not exposed by glibc, see getdents64(2)
+struct linux_dirent64
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+inline std::wstring WideStringFromUtf8(std::string_view input)
+{
+    std::wstring result;
+    result.reserve(input.size());
+    size_t i = 0;
+    while (i < input.size())
+    {
+        auto lead = static_cast<unsigned char>(input[i]);
+        uint32_t codePoint = lead;
+        size_t length = 1;
+        if (lead >= 0xF0) { codePoint = lead & 0x07; length = 4; }
+        else if (lead >= 0xE0) { codePoint = lead & 0x0F; length = 3; }
+        else if (lead >= 0xC0) { codePoint = lead & 0x1F; length = 2; }
+        else if (lead >= 0x80) { codePoint = 0xFFFD; }
+
+        if (i + length > input.size())
+        {
+            codePoint = 0xFFFD;
+            length = input.size() - i;
+        }
+        else
+        {
+            for (size_t j = 1; j < length; j++)
+            {
+                codePoint = (codePoint << 6) | (static_cast<unsigned char>(input[i + j]) & 0x3F);
+            }
+        }
+        result.push_back(static_cast<wchar_t>(codePoint));
+        i += length;
+    }
+    return result;
+}
+
+inline bool TryParseProcessId(const char* name, uint32_t& pid)
+{
+    if (*name == '\0')
+    {
+        return false;
+    }
+    uint64_t value = 0;
+    for (auto current = name; *current != '\0'; current++)
+    {
+        if (*current < '0' || *current > '9')
+        {
+            return false;
+        }
+        value = value * 10 + (*current - '0');
+        if (value > UINT32_MAX)
+        {
+            return false;
+        }
+    }
+    pid = static_cast<uint32_t>(value);
+    return true;
+}
+
+// Pulls the name and start time (in clock ticks since boot) out of
+// /proc/<pid>/stat. The name is in parentheses and may itself contain
+// spaces and parentheses, so the fields are found from the last ')'.
+inline bool TryParseProcessStat(std::string_view stat, std::string_view& name, uint64_t& startTime)
+{
+    auto nameStart = stat.find('(');
+    auto nameEnd = stat.rfind(')');
+    if (nameStart == std::string_view::npos || nameEnd == std::string_view::npos || nameEnd < nameStart)
+    {
+        return false;
+    }
+    name = stat.substr(nameStart + 1, nameEnd - nameStart - 1);
+
+    // The fields after the name start with "state" (field 3), starttime is field 22
+    const size_t startTimeField = 22 - 3;
+    size_t field = 0;
+    size_t position = nameEnd + 2;
+    while (position < stat.size() && field < startTimeField)
+    {
+        if (stat[position] == ' ')
+        {
+            field++;
+        }
+        position++;
+    }
+    if (field != startTimeField)
+    {
+        return false;
+    }
+    startTime = strtoull(std::string(stat.substr(position, 24)).c_str(), nullptr, 10);
+    return true;
+}
+
+// Reads up to size bytes of a file relative to a directory fd. Returns the
+// number of bytes read, or -1 with errno set.
+inline ssize_t ReadFileAt(int directoryFd, const char* path, char* buffer, size_t size)
+{
+    unique_fd file(openat(directoryFd, path, O_RDONLY | O_CLOEXEC));
+    if (!file.is_valid())
+    {
+        return -1;
+    }
+    size_t total = 0;
+    while (total < size)
+    {
+        auto count = read(file.get(), buffer + total, size - total);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (count == 0)
+        {
+            break;
+        }
+        total += static_cast<size_t>(count);
+    }
+    return static_cast<ssize_t>(total);
+}
+
+inline QueryError QueryErrorFromErrno(int error)
+{
+    switch (error)
+    {
+    case EACCES:
+    case EPERM:
+        return QueryError::AccessDenied;
+    case ENOENT:
+    case ESRCH:
+        return QueryError::ProcessExited;
+    default:
+        return QueryError::Unexpected;
+    }
+}
+
+inline uint16_t ElfMachineToMachineValue(uint16_t machine)
+{
+    switch (machine)
+    {
+    case EM_386:
+        return IMAGE_FILE_MACHINE_I386;
+    case EM_X86_64:
+        return IMAGE_FILE_MACHINE_AMD64;
+    case EM_ARM:
+        return IMAGE_FILE_MACHINE_ARMNT;
+    case EM_AARCH64:
+        return IMAGE_FILE_MACHINE_ARM64;
+    default:
+        return IMAGE_FILE_MACHINE_UNKNOWN;
+    }
+}
+
+// There is no integrity level on Linux, so approximate one from the
+// credentials in /proc/<pid>/status:
+//   euid 0                     -> System
+//   effective capabilities     -> High
+//   seccomp filtered (sandbox) -> Low
+//   everything else            -> Medium
+inline std::optional<IntegrityLevel> IntegrityLevelFromProcessStatus(std::string_view status)
+{
+    auto findField = [status](std::string_view name) -> std::optional<std::string_view>
+    {
+        size_t position = 0;
+        while (position < status.size())
+        {
+            auto end = status.find('\n', position);
+            if (end == std::string_view::npos)
+            {
+                end = status.size();
+            }
+            auto line = status.substr(position, end - position);
+            if (line.size() > name.size() && line.substr(0, name.size()) == name && line[name.size()] == ':')
+            {
+                auto value = line.substr(name.size() + 1);
+                auto start = value.find_first_not_of(" \t");
+                return start == std::string_view::npos ? std::string_view() : value.substr(start);
+            }
+            position = end + 1;
+        }
+        return std::nullopt;
+    };
+
+    // Uid: real effective saved filesystem
+    auto uids = findField("Uid");
+    if (!uids)
+    {
+        return std::nullopt;
+    }
+    auto effective = uids->find_first_of(" \t");
+    if (effective == std::string_view::npos)
+    {
+        return std::nullopt;
+    }
+    auto euid = strtoul(std::string(uids->substr(effective)).c_str(), nullptr, 10);
+    if (euid == 0)
+    {
+        return IntegrityLevel::System;
+    }
+
+    if (auto capabilities = findField("CapEff"))
+    {
+        if (strtoull(std::string(*capabilities).c_str(), nullptr, 16) != 0)
+        {
+            return IntegrityLevel::High;
+        }
+    }
+
+    if (auto seccomp = findField("Seccomp"))
+    {
+        if (!seccomp->empty() && (*seccomp)[0] == '2')
+        {
+            return IntegrityLevel::Low;
+        }
+    }
+    return IntegrityLevel::Medium;
+}
+
+// Reads /proc through a single directory fd. Every per-process access is an
+// openat relative to that fd (or to the process' own directory fd), so the
+// "/proc" prefix is never resolved again after construction.
+class LinuxProcessSource : public ProcessSource
+{
+public:
+    LinuxProcessSource()
+    {
+        m_procFd.reset(open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+        if (!m_procFd.is_valid())
+        {
+            throw std::system_error(errno, std::generic_category(), "open /proc");
+        }
+    }
+
+    std::vector<ProcessEntry> EnumerateProcesses() override
+    {
+        std::vector<ProcessEntry> result;
+
+        // Reopen through the existing fd so that concurrent enumerations
+        // don't share a directory offset.
+        unique_fd directory(openat(m_procFd.get(), ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+        if (!directory.is_valid())
+        {
+            throw std::system_error(errno, std::generic_category(), "open /proc");
+        }
+
+        alignas(linux_dirent64) std::array<char, 32 * 1024> buffer;
+        while (true)
+        {
+            auto count = syscall(SYS_getdents64, directory.get(), buffer.data(), buffer.size());
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::system_error(errno, std::generic_category(), "getdents64 /proc");
+            }
+            if (count == 0)
+            {
+                break;
+            }
+
+            for (long offset = 0; offset < count;)
+            {
+                auto entry = reinterpret_cast<linux_dirent64*>(buffer.data() + offset);
+                offset += entry->d_reclen;
+
+                uint32_t pid = 0;
+                if (entry->d_type != DT_DIR || !TryParseProcessId(entry->d_name, pid))
+                {
+                    continue;
+                }
+
+                // A process that exited while we were enumerating is skipped
+                if (auto processEntry = QueryProcessEntry(pid))
+                {
+                    result.push_back(std::move(*processEntry));
+                }
+            }
+        }
+        return result;
+    }
+
+    // The identity and name of a single process, from "<pid>/stat" which has
+    // both the name and start time. std::nullopt if it doesn't exist.
+    std::optional<ProcessEntry> QueryProcessEntry(uint32_t pid)
+    {
+        char path[32] = {};
+        snprintf(path, sizeof(path), "%u/stat", pid);
+        char stat[1024] = {};
+        auto length = ReadFileAt(m_procFd.get(), path, stat, sizeof(stat));
+        std::string_view name;
+        uint64_t startTime = 0;
+        if (length <= 0 || !TryParseProcessStat(std::string_view(stat, static_cast<size_t>(length)), name, startTime))
+        {
+            return std::nullopt;
+        }
+        return ProcessEntry{ pid, WideStringFromUtf8(name), startTime };
+    }
+
+protected:
+    QueryResult<Process> TryEnrichProcess(ProcessEntry const& entry, ProcessFields fields) override
+    {
+        char pidString[16] = {};
+        snprintf(pidString, sizeof(pidString), "%u", entry.Pid);
+        unique_fd processFd(openat(m_procFd.get(), pidString, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+        if (!processFd.is_valid())
+        {
+            return QueryErrorFromErrno(errno);
+        }
+
+        // The start time is read again rather than taken from the entry, so a
+        // pid that was reused since the entry was made doesn't pass for the
+        // same process (see ResolveFields)
+        char stat[1024] = {};
+        auto statLength = ReadFileAt(processFd.get(), "stat", stat, sizeof(stat));
+        std::string_view name;
+        uint64_t startTime = 0;
+        if (statLength < 0)
+        {
+            return QueryErrorFromErrno(errno);
+        }
+        if (!TryParseProcessStat(std::string_view(stat, static_cast<size_t>(statLength)), name, startTime))
+        {
+            return QueryError::ProcessExited;
+        }
+
+        auto process = CreatePendingProcess(entry);
+        process.CreationTime = startTime;
+        auto& errors = process.Errors;
+
+        // Kernel threads don't have an executable and other users' processes
+        // can't be read without privileges. Either way the process shows up
+        // as inaccessible, like it does with the Windows backend.
+        if (HasAnyField(fields, ProcessFields::ExecutablePath | ProcessFields::Architecture))
+        {
+            char exePath[PATH_MAX] = {};
+            auto exePathLength = readlinkat(processFd.get(), "exe", exePath, sizeof(exePath) - 1);
+            if (exePathLength >= 0)
+            {
+                process.ExecutablePath = WideStringFromUtf8(std::string_view(exePath, static_cast<size_t>(exePathLength)));
+
+                if (HasAnyField(fields, ProcessFields::Architecture))
+                {
+                    // e_ident (16 bytes), e_type (2 bytes), e_machine (2 bytes)
+                    unsigned char header[EI_NIDENT + 4] = {};
+                    auto headerLength = ReadFileAt(processFd.get(), "exe", reinterpret_cast<char*>(header), sizeof(header));
+                    if (headerLength == sizeof(header) && memcmp(header, ELFMAG, SELFMAG) == 0)
+                    {
+                        auto machine = header[EI_DATA] == ELFDATA2MSB ?
+                            static_cast<uint16_t>((header[EI_NIDENT + 2] << 8) | header[EI_NIDENT + 3]) :
+                            static_cast<uint16_t>((header[EI_NIDENT + 3] << 8) | header[EI_NIDENT + 2]);
+                        process.ArchitectureValue = ElfMachineToMachineValue(machine);
+                    }
+                    else
+                    {
+                        errors.Architecture = headerLength < 0 ? QueryErrorFromErrno(errno) : QueryError::NotAvailable;
+                    }
+                }
+            }
+            else
+            {
+                // A missing link means there is no executable (kernel threads)
+                auto error = errno == ENOENT ? QueryError::NotAvailable : QueryErrorFromErrno(errno);
+                errors.Set(fields & (ProcessFields::ExecutablePath | ProcessFields::Architecture), error);
+            }
+        }
+
+        if (HasAnyField(fields, ProcessFields::Type))
+        {
+            process.Type = ProcessType::Legacy;
+        }
+
+        if (HasAnyField(fields, ProcessFields::IntegrityLevel))
+        {
+            char status[4096] = {};
+            auto statusLength = ReadFileAt(processFd.get(), "status", status, sizeof(status));
+            if (statusLength > 0)
+            {
+                process.IntegrityLevel = IntegrityLevelFromProcessStatus(std::string_view(status, static_cast<size_t>(statusLength)));
+                if (!process.IntegrityLevel)
+                {
+                    errors.IntegrityLevel = QueryError::NotAvailable;
+                }
+            }
+            else
+            {
+                errors.IntegrityLevel = statusLength < 0 ? QueryErrorFromErrno(errno) : QueryError::ProcessExited;
+            }
+        }
+        return process;
+    }
+
+private:
+    unique_fd m_procFd;
+};
+#endif
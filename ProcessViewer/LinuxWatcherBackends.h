@@ -0,0 +1,381 @@
+#pragma once
+#ifdef __linux__
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "LinuxProcessSource.h"
+#include "ProcessWatcherBackend.h"
+
+// Process notifications straight from the kernel through the netlink
+// process connector, as they happen. Listening needs CAP_NET_ADMIN, use
+// TryCreate to find out whether we have it.
+//
+// A fork that creates a new process reports it as started, an exec reports
+// it as started again under its new name (see ProcessWatcherBackend), and
+// the exit of a thread group leader reports the process as exited. When the
+// kernel drops notifications because they weren't read fast enough, /proc
+// is enumerated to report what was missed.
+class LinuxProcessConnectorBackend : public ProcessWatcherBackend
+{
+public:
+    // Returns nullptr if the connector isn't available, e.g. without the
+    // needed privileges
+    static std::unique_ptr<LinuxProcessConnectorBackend> TryCreate()
+    {
+        unique_fd socketFd(socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR));
+        if (!socketFd.is_valid())
+        {
+            return nullptr;
+        }
+
+        sockaddr_nl address = {};
+        address.nl_family = AF_NETLINK;
+        address.nl_groups = CN_IDX_PROC;
+        address.nl_pid = 0;
+        if (bind(socketFd.get(), reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+        {
+            return nullptr;
+        }
+
+        if (!SendListenRequest(socketFd.get(), PROC_CN_MCAST_LISTEN))
+        {
+            return nullptr;
+        }
+
+        unique_fd stopFd(eventfd(0, EFD_CLOEXEC));
+        if (!stopFd.is_valid())
+        {
+            return nullptr;
+        }
+        return std::unique_ptr<LinuxProcessConnectorBackend>(new LinuxProcessConnectorBackend(std::move(socketFd), std::move(stopFd)));
+    }
+
+    ~LinuxProcessConnectorBackend() override
+    {
+        Stop();
+    }
+
+    // Processes that were running before are only known once they exit
+    void Start(ProcessStartedCallback started, ProcessExitedCallback exited) override
+    {
+        m_processStarted = std::move(started);
+        m_processExited = std::move(exited);
+        if (auto self = m_source.QueryProcessEntry(static_cast<uint32_t>(getpid())))
+        {
+            m_listenStartTime = self->CreationTime;
+        }
+        m_thread = std::thread([this]() { Run(); });
+    }
+
+    void Stop() override
+    {
+        if (m_thread.joinable())
+        {
+            uint64_t value = 1;
+            (void)!write(m_stopFd.get(), &value, sizeof(value));
+            m_thread.join();
+            SendListenRequest(m_socket.get(), PROC_CN_MCAST_IGNORE);
+        }
+    }
+
+    // Times the kernel dropped notifications because we didn't read them fast
+    // enough. Processes that started or exited in that time were missed.
+    uint64_t GetOverrunCount() const
+    {
+        return m_overruns.load(std::memory_order_relaxed);
+    }
+
+private:
+    LinuxProcessConnectorBackend(unique_fd socketFd, unique_fd stopFd)
+        : m_socket(std::move(socketFd)), m_stopFd(std::move(stopFd))
+    {
+    }
+
+    static bool SendListenRequest(int socketFd, proc_cn_mcast_op operation)
+    {
+        alignas(nlmsghdr) char buffer[NLMSG_SPACE(sizeof(cn_msg) + sizeof(proc_cn_mcast_op))] = {};
+        auto header = reinterpret_cast<nlmsghdr*>(buffer);
+        header->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(proc_cn_mcast_op));
+        header->nlmsg_type = NLMSG_DONE;
+        header->nlmsg_pid = static_cast<uint32_t>(getpid());
+        auto message = reinterpret_cast<cn_msg*>(NLMSG_DATA(header));
+        message->id.idx = CN_IDX_PROC;
+        message->id.val = CN_VAL_PROC;
+        message->len = sizeof(proc_cn_mcast_op);
+        memcpy(message->data, &operation, sizeof(operation));
+        return send(socketFd, buffer, header->nlmsg_len, 0) == static_cast<ssize_t>(header->nlmsg_len);
+    }
+
+    void Run()
+    {
+        alignas(nlmsghdr) char buffer[16 * 1024];
+        pollfd fds[2] = { { m_socket.get(), POLLIN, 0 }, { m_stopFd.get(), POLLIN, 0 } };
+        while (true)
+        {
+            if (poll(fds, 2, -1) < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return;
+            }
+            if (fds[1].revents != 0)
+            {
+                return;
+            }
+
+            auto length = recv(m_socket.get(), buffer, sizeof(buffer), 0);
+            if (length < 0)
+            {
+                if (errno == ENOBUFS)
+                {
+                    m_overruns.fetch_add(1, std::memory_order_relaxed);
+                    Resync();
+                }
+                continue;
+            }
+
+            auto remaining = static_cast<int>(length);
+            for (auto header = reinterpret_cast<nlmsghdr*>(buffer); NLMSG_OK(header, remaining); header = NLMSG_NEXT(header, remaining))
+            {
+                if (header->nlmsg_type == NLMSG_ERROR || header->nlmsg_type == NLMSG_NOOP)
+                {
+                    continue;
+                }
+                auto message = reinterpret_cast<cn_msg*>(NLMSG_DATA(header));
+                if (message->id.idx != CN_IDX_PROC || message->id.val != CN_VAL_PROC)
+                {
+                    continue;
+                }
+                OnEvent(*reinterpret_cast<proc_event const*>(message->data));
+            }
+        }
+    }
+
+    void OnEvent(proc_event const& event)
+    {
+        switch (event.what)
+        {
+        case proc_event::PROC_EVENT_FORK:
+            // Threads share the thread group id of their process
+            if (event.event_data.fork.child_pid == event.event_data.fork.child_tgid)
+            {
+                ReportStarted(static_cast<uint32_t>(event.event_data.fork.child_tgid));
+            }
+            break;
+        case proc_event::PROC_EVENT_EXEC:
+            ReportStarted(static_cast<uint32_t>(event.event_data.exec.process_tgid));
+            break;
+        case proc_event::PROC_EVENT_EXIT:
+            if (event.event_data.exit.process_pid == event.event_data.exit.process_tgid)
+            {
+                ReportExited(static_cast<uint32_t>(event.event_data.exit.process_tgid));
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    void ReportStarted(uint32_t pid)
+    {
+        // Gone already if this fails, its exit is on the way
+        if (auto entry = m_source.QueryProcessEntry(pid))
+        {
+            m_creationTimes.insert_or_assign(pid, entry->CreationTime);
+            m_processStarted(std::move(*entry));
+        }
+    }
+
+    // The exit notification doesn't say when the process started, only
+    // processes we saw start get a full key
+    void ReportExited(uint32_t pid)
+    {
+        uint64_t creationTime = 0;
+        auto search = m_creationTimes.find(pid);
+        if (search != m_creationTimes.end())
+        {
+            creationTime = search->second;
+            m_creationTimes.erase(search);
+        }
+        m_processExited(ProcessKey::From(pid, creationTime), {});
+    }
+
+    // After notifications were dropped: processes we saw start that are
+    // gone now exited, and processes that started since we began listening
+    // that we haven't seen were missed. Also keeps m_creationTimes from
+    // holding on to pids whose exits were dropped.
+    void Resync()
+    {
+        std::unordered_map<uint32_t, uint64_t> running;
+        try
+        {
+            for (auto&& entry : m_source.EnumerateProcesses())
+            {
+                running.insert_or_assign(entry.Pid, entry.CreationTime);
+            }
+        }
+        catch (std::system_error const&)
+        {
+            return;
+        }
+
+        for (auto it = m_creationTimes.begin(); it != m_creationTimes.end();)
+        {
+            auto search = running.find(it->first);
+            if (search == running.end() || search->second != it->second)
+            {
+                m_processExited(ProcessKey::From(it->first, it->second), {});
+                it = m_creationTimes.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        for (auto&& [pid, creationTime] : running)
+        {
+            if (creationTime >= m_listenStartTime && m_creationTimes.count(pid) == 0)
+            {
+                ReportStarted(pid);
+            }
+        }
+    }
+
+private:
+    unique_fd m_socket;
+    unique_fd m_stopFd;
+    LinuxProcessSource m_source;
+    std::thread m_thread;
+    std::atomic<uint64_t> m_overruns = 0;
+    // Start time of our own process, anything that started later was seen
+    // by the connector
+    uint64_t m_listenStartTime = 0;
+    // Only used by the reading thread
+    std::unordered_map<uint32_t, uint64_t> m_creationTimes;
+    ProcessStartedCallback m_processStarted;
+    ProcessExitedCallback m_processExited;
+};
+
+// Finds process starts and exits by enumerating /proc at a fixed interval
+// and diffing against the previous snapshot. Needs no privileges, but
+// processes that live shorter than the interval are missed and each scan
+// costs a read of every <pid>/stat.
+class ProcPollingWatcherBackend : public ProcessWatcherBackend
+{
+public:
+    static constexpr std::chrono::milliseconds DefaultInterval{ 5 };
+
+    explicit ProcPollingWatcherBackend(std::chrono::milliseconds interval = DefaultInterval) : m_interval(interval)
+    {
+    }
+
+    ~ProcPollingWatcherBackend() override
+    {
+        Stop();
+    }
+
+    void Start(ProcessStartedCallback started, ProcessExitedCallback exited) override
+    {
+        m_processStarted = std::move(started);
+        m_processExited = std::move(exited);
+        // Processes that exist already aren't reported
+        for (auto&& entry : m_source.EnumerateProcesses())
+        {
+            m_known.insert_or_assign(entry.Pid, std::move(entry));
+        }
+        m_thread = std::thread([this]() { Run(); });
+    }
+
+    void Stop() override
+    {
+        if (m_thread.joinable())
+        {
+            {
+                std::scoped_lock lock(m_lock);
+                m_stopping = true;
+            }
+            m_wake.notify_all();
+            m_thread.join();
+        }
+    }
+
+private:
+    void Run()
+    {
+        std::unordered_map<uint32_t, ProcessEntry> current;
+        while (true)
+        {
+            {
+                std::unique_lock lock(m_lock);
+                if (m_wake.wait_for(lock, m_interval, [this]() { return m_stopping; }))
+                {
+                    return;
+                }
+            }
+
+            current.clear();
+            for (auto&& entry : m_source.EnumerateProcesses())
+            {
+                current.insert_or_assign(entry.Pid, std::move(entry));
+            }
+
+            for (auto&& [pid, entry] : m_known)
+            {
+                auto search = current.find(pid);
+                // A new start time means the pid was reused. A new name means
+                // the process exec'd, which is a start under the new name.
+                if (search == current.end() || search->second.CreationTime != entry.CreationTime)
+                {
+                    m_processExited(ProcessKey::From(pid, entry.CreationTime), {});
+                }
+            }
+            for (auto&& [pid, entry] : current)
+            {
+                auto search = m_known.find(pid);
+                if (search == m_known.end() ||
+                    search->second.CreationTime != entry.CreationTime ||
+                    search->second.Name != entry.Name)
+                {
+                    m_processStarted(entry);
+                }
+            }
+            m_known.swap(current);
+        }
+    }
+
+private:
+    std::chrono::milliseconds m_interval;
+    LinuxProcessSource m_source;
+    std::unordered_map<uint32_t, ProcessEntry> m_known;
+    ProcessStartedCallback m_processStarted;
+    ProcessExitedCallback m_processExited;
+
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    bool m_stopping = false;
+    std::thread m_thread;
+};
+
+// The process connector when we are allowed to use it, otherwise polling
+// /proc at the given interval
+inline std::unique_ptr<ProcessWatcherBackend> CreateLinuxWatcherBackend(std::chrono::milliseconds pollingInterval = ProcPollingWatcherBackend::DefaultInterval)
+{
+    if (auto connector = LinuxProcessConnectorBackend::TryCreate())
+    {
+        return connector;
+    }
+    return std::make_unique<ProcPollingWatcherBackend>(pollingInterval);
+}
+#endif
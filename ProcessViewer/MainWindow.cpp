@@ -1,5 +1,9 @@
 #include "pch.h"
 #include "MainWindow.h"
+#include "PeImage.h"
+#include "Win32BinaryMetadata.h"
+#include "Win32ProcessSource.h"
+#include "WmiWatcherBackend.h"
 
 namespace winrt
 {
@@ -9,16 +13,35 @@ namespace winrt
     using namespace Windows::UI::Popups;
 }
 
-namespace winmd
-{
-    using namespace winmd::reader;
-}
-
 #define ID_LISTVIEW  2000 // ?????
 
 const std::wstring MainWindow::ClassName = L"ProcessViewer.MainWindow";
 
-std::string GetStringFromPath(winrt::hstring const& path);
+std::filesystem::path GetAppDataFilePath(std::wstring_view fileName)
+{
+    wil::unique_cotaskmem_string localAppData;
+    winrt::check_hresult(SHGetKnownFolderPath(FOLDERID_LocalAppData, KF_FLAG_DEFAULT, nullptr, &localAppData));
+    auto directory = std::filesystem::path(localAppData.get()) / L"ProcessViewer";
+    std::filesystem::create_directories(directory);
+    return directory / fileName;
+}
+
+// Appends this run's startup milestones, one line per run
+void WriteStartupMilestones(StartupTimeline const& timeline, size_t processCount)
+{
+    auto path = GetAppDataFilePath(L"StartupMilestones.csv");
+    auto isNew = !std::filesystem::exists(path);
+    std::ofstream stream(path, std::ios::app);
+    if (!stream)
+    {
+        return;
+    }
+    if (isNew)
+    {
+        stream << StartupTimeline::GetCsvHeader() << '\n';
+    }
+    timeline.WriteCsvLine(stream, processCount);
+}
 
 void MainWindow::RegisterWindowClass()
 {
@@ -53,191 +76,444 @@ MainWindow::MainWindow(std::wstring const& titleString, int width, int height)
         ProcessInformation::Architecture,
         ProcessInformation::IntegrityLevel,
     };
-    m_processes = GetAllProcesses();
+    m_processSource = std::make_unique<Win32ProcessSource>();
+    // One dispatcher queue item per burst of resolved rows rather than one
+    // per row
+    m_resolvedFields = std::make_unique<ProcessEventRing>(ProcessEventRing::WakeCallback([&]()
+        {
+            m_dispatcherQueue.TryEnqueue([this]()
+                {
+                    DrainResolvedFields();
+                });
+        }));
+    m_fieldResolver = std::make_unique<ProcessFieldResolver>(*m_processSource, m_metadataCache,
+        ProcessFieldResolver::ResolvedCallback([&](Process process, ProcessFields fields)
+        {
+            m_resolvedFields->PushResolved(process, fields);
+        }));
+    std::vector<bool> cachedColumns;
+    for (auto&& column : m_columns)
+    {
+        cachedColumns.push_back(VisitColumn(column, [](auto descriptor)
+            {
+                return decltype(descriptor)::Cached;
+            }));
+    }
+    m_processes.EnableCellCache(cachedColumns);
+    // Mapped as is, entries are only read when they are looked up
+    m_binaryCache = std::make_unique<BinaryMetadataCache>(GetAppDataFilePath(L"BinaryCache.bin"));
+    // A slow binary (e.g. on a network share) only holds up its own icon
+    m_iconLoader = std::make_unique<IconLoader<wil::shared_hicon>>(
+        IconLoader<wil::shared_hicon>::LoadCallback([&](std::wstring const& exePath)
+        {
+            return LoadProcessIcon(exePath);
+        }),
+        IconLoader<wil::shared_hicon>::WakeCallback([&]()
+        {
+            m_dispatcherQueue.TryEnqueue([this]()
+                {
+                    DrainLoadedIcons();
+                });
+        }));
+
+    // History is a nice to have, run without it if the log can't be opened
+    m_eventLog = ProcessEventLogWriter::TryCreate(GetAppDataFilePath(L"ProcessEvents.log"));
 
+    // The window comes up empty and the processes stream in
     CreateMenuBar();
     CreateControls(instance);
 
     ShowWindow(m_window, SW_SHOWDEFAULT);
     UpdateWindow(m_window);
 
-    m_processWatcher = std::make_unique<ProcessWatcher>(m_dispatcherQueue, 
-        ProcessWatcher::ProcessAddedCallback([&](Process process)
-        {
-            InsertProcess(process);
-        }),
-        ProcessWatcher::ProcessRemovedCallback([&](DWORD processId)
+    // Watch before taking the snapshot so nothing falls in between, batches
+    // skip processes the other one already added
+    m_processWatcher = std::make_unique<ProcessWatcher>(m_dispatcherQueue, *m_processSource, m_metadataCache, std::make_unique<WmiWatcherBackend>(),
+        ProcessWatcher::ProcessesChangedCallback([&](ProcessEventBatch const& batch)
         {
-            RemoveProcessByProcessId(processId);
+            ApplyProcessBatch(batch);
         }));
+    StartSnapshotStream();
+
+    m_resyncTimer = m_dispatcherQueue.CreateTimer();
+    m_resyncTimer.Interval(ResyncInterval);
+    m_resyncTimer.IsRepeating(true);
+    m_resyncTimerTick = m_resyncTimer.Tick(winrt::auto_revoke, [&](auto&&, auto&&)
+        {
+            ResyncProcesses(true);
+        });
+    m_resyncTimer.Start();
 }
 
-bool MainWindow::CompareProcessId(
-    Process const& left,
-    Process const& right,
-    ColumnSorting const& sort)
+MainWindow::~MainWindow()
 {
-    if (sort == ColumnSorting::Ascending)
+    m_stopping = true;
+    if (m_snapshotThread.joinable())
     {
-        return left.Pid < right.Pid;
+        m_snapshotThread.join();
     }
-    else
+    if (m_resyncThread.joinable())
     {
-        return left.Pid > right.Pid;
+        m_resyncThread.join();
     }
 }
 
-bool MainWindow::CompareProcesses(
-    Process const& left, 
-    Process const& right,
-    ColumnSorting const& sort,
-    ProcessInformation const& column)
+// Queries the startup snapshot on a background thread and hands it to the
+// UI thread in batches. Only the fields the sort needs are queried up front,
+// the rest are resolved as rows are shown.
+void MainWindow::StartSnapshotStream()
 {
-    switch (column)
+    m_snapshotThread = std::thread([this, fields = GetSortFields()]()
+        {
+            StreamAllProcesses(*m_processSource, m_metadataCache, [this](std::vector<Process>&& batch)
+                {
+                    if (m_stopping)
+                    {
+                        return false;
+                    }
+                    m_dispatcherQueue.TryEnqueue([this, batch = std::move(batch)]()
+                        {
+                            ApplySnapshotBatch(batch);
+                        });
+                    return true;
+                }, true, fields);
+            m_dispatcherQueue.TryEnqueue([this]()
+                {
+                    m_startup.Mark(StartupMilestone::FullSnapshot);
+                    WriteStartupMilestones(m_startup, m_processes.size());
+                });
+        });
+}
+
+void MainWindow::ApplySnapshotBatch(std::vector<Process> const& batch)
+{
+    auto selectedRow = GetSelectedRow();
+    std::vector<uint32_t> removedRows;
+    auto added = PrepareNewProcesses(batch, removedRows, true);
+    // Each batch is sorted on its own and merged into the list
+    WithSortOrder([&](auto less)
+        {
+            m_processes.ApplyChanges(removedRows, added, less);
+        });
+    for (auto&& process : added)
     {
-    case ProcessInformation::Pid:
-        return CompareProcessId(left, right, sort);
-    case ProcessInformation::Name:
+        EnsureProcessIcon(process.ExecutablePath);
+    }
+    ShowProcessChanges(selectedRow);
+    if (!added.empty())
     {
-        auto value = _wcsicmp(left.Name.c_str(), right.Name.c_str());
-        if (value == 0)
-        {
-            return CompareProcessId(left, right, sort);
-        }
-        else if (sort == ColumnSorting::Ascending)
+        m_startup.Mark(StartupMilestone::FirstRow);
+    }
+}
+
+ProcessFields MainWindow::GetSortFields()
+{
+    return VisitColumn(m_columns[m_selectedColumnIndex], [](auto descriptor)
         {
-            return value < 0;
-        }
-        else
+            return decltype(descriptor)::Fields;
+        });
+}
+
+// Queues the fields on the resolver for every row that is missing them.
+// Those rows sort last until DrainResolvedFields moves them into place.
+void MainWindow::RequestPendingFields(ProcessFields fields)
+{
+    auto& table = m_processes.Table();
+    for (size_t position = 0; position < m_processes.size(); position++)
+    {
+        auto row = m_processes.RowAt(position);
+        if (HasAnyField(table.PendingFields(row), fields))
         {
-            return value > 0;
+            m_fieldResolver->Request(table.GetProcess(row), fields);
         }
     }
-    case ProcessInformation::Type:
-        if (left.Type == right.Type)
-        {
-            return CompareProcessId(left, right, sort);
-        }
-        else if (sort == ColumnSorting::Ascending)
+}
+
+// New processes are listed before the fields the sort and the filter need
+// are known, they are moved or dropped here once those fields come in
+void MainWindow::DrainResolvedFields()
+{
+    auto sortFields = GetSortFields();
+    std::vector<uint32_t> movedRows;
+    std::vector<uint32_t> filteredRows;
+    m_resolvedFields->Drain([&](ProcessEventKind, ProcessKey, ProcessView const& process, ProcessFields fields)
         {
-            if (!left.Type.has_value())
+            auto row = OnFieldsResolved(process, fields);
+            if (!row)
             {
-                return true;
+                return;
             }
-            else if (!right.Type.has_value())
+            if (!m_viewAccessibleProcess && HasAnyField(fields, ProcessFields::Architecture) &&
+                process.ArchitectureValue == IMAGE_FILE_MACHINE_UNKNOWN)
             {
-                return false;
+                filteredRows.push_back(*row);
             }
-            else
+            else if (HasAnyField(fields, sortFields))
             {
-                return *left.Type < *right.Type;
+                movedRows.push_back(*row);
             }
+        });
+    if (movedRows.empty() && filteredRows.empty())
+    {
+        return;
+    }
+
+    auto selectedRow = GetSelectedRow();
+    if (selectedRow && std::find(filteredRows.begin(), filteredRows.end(), *selectedRow) != filteredRows.end())
+    {
+        selectedRow = std::nullopt;
+    }
+    WithSortOrder([&](auto less)
+        {
+            m_processes.ApplyChanges(filteredRows, {}, less);
+            m_processes.Reposition(movedRows, less);
+        });
+    ShowProcessChanges(selectedRow);
+}
+
+// Returns the row of the process, if it is still listed. The process's
+// strings point into the ring, the row gets them straight from there.
+std::optional<uint32_t> MainWindow::OnFieldsResolved(ProcessView const& process, ProcessFields fields)
+{
+    auto row = m_processes.FindRowByKey(process.GetKey());
+    if (!row)
+    {
+        return std::nullopt;
+    }
+    m_processes.ResolveFields(*row, process, fields);
+    if (HasAnyField(fields, ProcessFields::ExecutablePath))
+    {
+        EnsureProcessIcon(m_processes.Table().ExecutablePath(*row));
+        if (m_eventLog)
+        {
+            m_eventLog->LogMetadata(m_processes.Table().GetProcess(*row));
         }
-        else
+    }
+    auto position = static_cast<int>(m_processes.PositionOf(*row));
+    ListView_RedrawItems(m_processListView, position, position);
+    return row;
+}
+
+void MainWindow::SortProcesses()
+{
+    // Rows that don't have the fields the column sorts by yet are sorted
+    // last and moved as the fields come in, rather than queried here
+    RequestPendingFields(GetSortFields());
+
+    auto descending = m_columnSort == ColumnSorting::Descending;
+    auto& table = m_processes.Table();
+    VisitColumn(m_columns[m_selectedColumnIndex], [&](auto descriptor)
         {
-            if (!left.Type.has_value())
-            {
-                return false;
-            }
-            else if (!right.Type.has_value())
+            using TColumn = decltype(descriptor);
+            if constexpr (std::is_same_v<TColumn, NameColumn>)
             {
-                return true;
+                m_nameSortKeys.Update(table.Strings());
             }
-            else
-            {
-                return *left.Type > *right.Type;
-            }
-        }
-    case ProcessInformation::Architecture:
-        if (left.ArchitectureValue == right.ArchitectureValue)
-        {
-            return CompareProcessId(left, right, sort);
-        }
-        else if (sort == ColumnSorting::Ascending)
+            m_processes.SortByKey([&table, &names = m_nameSortKeys, descending](uint32_t row)
+                {
+                    return GetRowSortKey<TColumn>(table, row, names, descending);
+                });
+        });
+}
+
+void MainWindow::ApplyProcessBatch(ProcessEventBatch const& batch)
+{
+    auto selectedRow = GetSelectedRow();
+
+    std::vector<uint32_t> removedRows;
+    removedRows.reserve(batch.Removed.size());
+    for (size_t i = 0; i < batch.Removed.size(); i++)
+    {
+        auto key = batch.Removed[i];
+        auto row = m_processes.FindRowForExit(key, batch.RemovedName(i));
+        if (m_eventLog)
         {
-            return left.ArchitectureValue < right.ArchitectureValue;
+            // Filtered out processes aren't in the model, their exit
+            // applies to whichever process the log last saw with the pid
+            m_eventLog->LogExited(key.Pid(), row ? m_processes.Table().CreationTime(*row) : 0);
         }
-        else
+        if (row)
         {
-            return left.ArchitectureValue > right.ArchitectureValue;
+            if (row == selectedRow)
+            {
+                selectedRow = std::nullopt;
+            }
+            removedRows.push_back(*row);
         }
-    case ProcessInformation::IntegrityLevel:
-        if (left.IntegrityLevel == right.IntegrityLevel)
+    }
+
+    auto added = PrepareNewProcesses(batch.Added, removedRows, false);
+    if (selectedRow && std::find(removedRows.begin(), removedRows.end(), *selectedRow) != removedRows.end())
+    {
+        selectedRow = std::nullopt;
+    }
+    WithSortOrder([&](auto less)
         {
-            return CompareProcessId(left, right, sort);
-        }
-        else if (sort == ColumnSorting::Ascending)
+            m_processes.ApplyChanges(removedRows, added, less);
+        });
+    for (auto&& process : added)
+    {
+        EnsureProcessIcon(process.ExecutablePath);
+    }
+    ShowProcessChanges(selectedRow);
+}
+
+// Picks the processes of a batch that belong in the list and logs them.
+// Processes can come in with only their identity (e.g. when the watcher was
+// too busy to enrich them) or with fields for a sort that has changed since.
+// They are listed as they are, and whatever the sort or the filter needs is
+// queued on the field resolver; DrainResolvedFields moves or drops them once
+// it is in. The callers add the processes before the resolver's results can
+// be drained, so none are missed. A watcher start for a listed process under
+// a new name means it exec'd, its row is added to removedRows and replaced.
+std::vector<Process> MainWindow::PrepareNewProcesses(std::vector<Process> const& processes, std::vector<uint32_t>& removedRows, bool alreadyRunning)
+{
+    auto requiredFields = GetSortFields() | (m_viewAccessibleProcess ? ProcessFields::None : ProcessFields::Architecture);
+    std::vector<uint32_t> sortedRemovedRows = removedRows;
+    std::sort(sortedRemovedRows.begin(), sortedRemovedRows.end());
+    std::vector<Process> added;
+    added.reserve(processes.size());
+    for (auto&& process : processes)
+    {
+        // The watcher, the startup snapshot and resyncs can all come across
+        // the same process, whichever is first adds it
+        auto existing = m_processes.FindRowByKey(process.GetKey());
+        auto replaced = false;
+        if (existing && !std::binary_search(sortedRemovedRows.begin(), sortedRemovedRows.end(), *existing))
         {
-            if (!left.IntegrityLevel.has_value())
-            {
-                return true;
-            }
-            else if (!right.IntegrityLevel.has_value())
-            {
-                return false;
-            }
-            else
+            // Snapshots can be older than what the watcher reported, only
+            // the watcher renames
+            if (alreadyRunning || m_processes.Table().Name(*existing) == process.Name)
             {
-                return *left.IntegrityLevel < *right.IntegrityLevel;
+                continue;
             }
+            removedRows.push_back(*existing);
+            replaced = true;
         }
-        else
+        m_fieldResolver->Request(process, requiredFields);
+        if (m_eventLog)
         {
-            if (!left.IntegrityLevel.has_value())
+            if (replaced)
             {
-                return false;
+                m_eventLog->LogMetadata(process);
             }
-            else if (!right.IntegrityLevel.has_value())
+            else if (alreadyRunning)
             {
-                return true;
+                m_eventLog->LogRunning(process);
             }
             else
             {
-                return *left.IntegrityLevel > *right.IntegrityLevel;
+                m_eventLog->LogStarted(process);
             }
         }
-    default:
-        std::abort();
+        if (m_viewAccessibleProcess || process.ArchitectureValue != IMAGE_FILE_MACHINE_UNKNOWN ||
+            HasAnyField(process.Pending, ProcessFields::Architecture))
+        {
+            added.push_back(process);
+        }
     }
+    return added;
 }
 
-std::vector<Process>::iterator MainWindow::GetProcessInsertIterator(Process const& process)
+// Brings the list in line with a fresh snapshot, e.g. after the filter
+// changed or to recover from missed events. The snapshot queries every
+// process, so it is taken on a background thread and only the diff is
+// worked out and applied on the UI thread. A resync that is still running
+// makes another one unnecessary, unless the filter or the sort changes
+// before its snapshot comes in, then it starts over.
+void MainWindow::ResyncProcesses(bool logChanges)
 {
-    auto sort = m_columnSort;
-    auto& column = m_columns[m_selectedColumnIndex];
-    auto newIndex = std::lower_bound(m_processes.begin(), m_processes.end(), process, [sort, column](Process const& process1, Process const& process2)
+    if (m_resyncing)
+    {
+        return;
+    }
+    m_resyncing = true;
+    if (m_resyncThread.joinable())
+    {
+        // Already done, it posted its snapshot
+        m_resyncThread.join();
+    }
+    m_resyncThread = std::thread([this, logChanges, viewAccessible = m_viewAccessibleProcess, fields = GetSortFields()]()
         {
-            return CompareProcesses(process1, process2, sort, column);
+            auto snapshot = GetAllProcesses(*m_processSource, m_metadataCache, viewAccessible, fields);
+            if (m_stopping)
+            {
+                return;
+            }
+            m_dispatcherQueue.TryEnqueue([this, snapshot = std::move(snapshot), logChanges, viewAccessible, fields]()
+                {
+                    m_resyncing = false;
+                    if (viewAccessible != m_viewAccessibleProcess || fields != GetSortFields())
+                    {
+                        // Rows the filter adds or removes aren't starts or exits
+                        ResyncProcesses(logChanges && viewAccessible == m_viewAccessibleProcess);
+                        return;
+                    }
+                    ApplyResyncSnapshot(snapshot, logChanges);
+                });
         });
-    return newIndex;
 }
 
-void MainWindow::InsertProcess(Process const& process)
+// Only what differs from the snapshot is applied
+void MainWindow::ApplyResyncSnapshot(std::vector<Process> const& snapshot, bool logChanges)
 {
-    if (m_viewAccessibleProcess || process.ArchitectureValue != IMAGE_FILE_MACHINE_UNKNOWN)
+    // Names and paths of processes that exited since the last resync
+    m_processes.CompactStrings();
+    auto diff = m_processes.Diff(snapshot);
+    if (diff.empty())
     {
-        auto newIndex = GetProcessInsertIterator(process);
-        LVITEMW item = {};
-        item.iItem = static_cast<int>(newIndex - m_processes.begin());
-        m_processes.insert(newIndex, process);
-        ListView_InsertItem(m_processListView, &item);
-        EnsureProcessIcon(process.ExecutablePath);
+        return;
     }
-}
 
-void MainWindow::RemoveProcessByProcessId(DWORD processId)
-{
-    auto it = std::find_if(m_processes.begin(), m_processes.end(), [processId](Process const& process)
+    auto selectedRow = GetSelectedRow();
+    if (selectedRow && std::find(diff.Removed.begin(), diff.Removed.end(), *selectedRow) != diff.Removed.end())
+    {
+        selectedRow = std::nullopt;
+    }
+    if (logChanges && m_eventLog)
+    {
+        for (auto row : diff.Removed)
+        {
+            m_eventLog->LogExited(m_processes.Table().Pid(row), m_processes.Table().CreationTime(row));
+        }
+        for (auto index : diff.Added)
+        {
+            m_eventLog->LogStarted(snapshot[index]);
+        }
+    }
+
+    WithSortOrder([&](auto less)
         {
-            return process.Pid == processId;
+            m_processes.ApplyDiff(diff, snapshot, less);
         });
+    for (auto index : diff.Added)
+    {
+        EnsureProcessIcon(snapshot[index].ExecutablePath);
+    }
+    for (auto [row, index] : diff.Changed)
+    {
+        EnsureProcessIcon(snapshot[index].ExecutablePath);
+    }
+    ShowProcessChanges(selectedRow);
+}
+
+// Positions shift as rows come and go, the selection is remembered by row
+std::optional<uint32_t> MainWindow::GetSelectedRow()
+{
+    auto selectedPosition = ListView_GetNextItem(m_processListView, -1, LVNI_SELECTED);
+    return selectedPosition >= 0 ? std::optional(m_processes.RowAt(static_cast<size_t>(selectedPosition))) : std::nullopt;
+}
 
-    if (it != m_processes.end())
+void MainWindow::ShowProcessChanges(std::optional<uint32_t> selectedRow)
+{
+    ListView_SetItemCountEx(m_processListView, m_processes.size(), LVSICF_NOSCROLL | LVSICF_NOINVALIDATEALL);
+    ListView_SetItemState(m_processListView, -1, 0, LVIS_SELECTED | LVIS_FOCUSED);
+    if (selectedRow)
     {
-        auto index = it - m_processes.begin();
-        m_processes.erase(it);
-        ListView_DeleteItem(m_processListView, index);
+        auto position = static_cast<int>(m_processes.PositionOf(*selectedRow));
+        ListView_SetItemState(m_processListView, position, LVIS_SELECTED | LVIS_FOCUSED, LVIS_SELECTED | LVIS_FOCUSED);
     }
+    InvalidateRect(m_processListView, nullptr, false);
 }
 
 LRESULT MainWindow::MessageHandler(UINT const message, WPARAM const wparam, LPARAM const lparam)
@@ -248,7 +524,10 @@ LRESULT MainWindow::MessageHandler(UINT const message, WPARAM const wparam, LPAR
         ResizeProcessListView();
         break;
     case WM_NOTIFY:
-        OnListViewNotify(lparam);
+        if (auto result = OnListViewNotify(lparam))
+        {
+            return *result;
+        }
         break;
     case WM_MENUCOMMAND:
     {
@@ -265,17 +544,10 @@ LRESULT MainWindow::MessageHandler(UINT const message, WPARAM const wparam, LPAR
             m_viewAccessibleProcess = !m_viewAccessibleProcess;
             auto flag = m_viewAccessibleProcess ? MF_CHECKED : MF_UNCHECKED;
             CheckMenuItem(m_viewMenu.get(), 0, flag);
-            auto sort = m_columnSort;
-            auto& column = m_columns[m_selectedColumnIndex];
-            m_processes = GetAllProcesses(m_viewAccessibleProcess); std::sort(m_processes.begin(), m_processes.end(), [sort, column](Process const& process1, Process const& process2)
-                {
-                    return CompareProcesses(process1, process2, sort, column);
-                });
-            ListView_SetItemCount(m_processListView, m_processes.size());
-            ListView_RedrawItems(m_processListView, 0, m_processes.size() - 1);
-            ListView_Scroll(m_processListView, 0, 0);
-            ListView_SetItemState(m_processListView, -1, 0, LVIS_SELECTED);
-            ListView_SetItemState(m_processListView, -1, 0, LVIS_FOCUSED);
+            // Rows that stay keep their row, so pending field queries for
+            // them are still good. A resync that is already running notices
+            // the filter changed and starts over.
+            ResyncProcesses(false);
         }
         else if (menu == m_toolsMenu.get())
         {
@@ -341,9 +613,7 @@ void MainWindow::CreateControls(HINSTANCE instance)
         std::vector<std::wstring> columnNames;
         for (auto&& column : m_columns)
         {
-            std::wstringstream stream;
-            stream << column;
-            columnNames.push_back(stream.str());
+            columnNames.emplace_back(GetColumnHeader(column));
         }
 
         listViewColumn.mask = LVCF_FMT | LVCF_WIDTH | LVCF_TEXT | LVCF_SUBITEM;
@@ -382,67 +652,95 @@ void MainWindow::ResizeProcessListView()
     }
 }
 
-void MainWindow::OnListViewNotify(LPARAM const lparam)
+std::optional<LRESULT> MainWindow::OnListViewNotify(LPARAM const lparam)
 {
     auto  lpnmh = reinterpret_cast<LPNMHDR>(lparam);
     //auto listView = winrt::check_pointer(GetDlgItem(m_window, ID_LISTVIEW));
 
     switch (lpnmh->code)
     {
+    case NM_CUSTOMDRAW:
+        if (reinterpret_cast<NMLVCUSTOMDRAW*>(lparam)->nmcd.dwDrawStage == CDDS_PREPAINT)
+        {
+            m_startup.Mark(StartupMilestone::FirstPaint);
+        }
+        break;
     case LVN_GETDISPINFOW:
     {
         auto itemDisplayInfo = reinterpret_cast<NMLVDISPINFOW*>(lparam);
         auto itemIndex = itemDisplayInfo->item.iItem;
         auto subItemIndex = itemDisplayInfo->item.iSubItem;
-        if (subItemIndex == 0)
+        auto& table = m_processes.Table();
+        auto row = m_processes.RowAt(itemIndex);
+        if (itemDisplayInfo->item.mask & LVIF_TEXT)
         {
-            if (itemDisplayInfo->item.mask & LVIF_TEXT)
-            {
-                auto& process = m_processes[itemIndex];
-                wcsncpy_s(itemDisplayInfo->item.pszText, itemDisplayInfo->item.cchTextMax, process.Name.data(), _TRUNCATE);
-            }
-            if (itemDisplayInfo->item.mask & LVIF_IMAGE)
+            CellWriter writer(itemDisplayInfo->item.pszText, static_cast<size_t>(std::max(itemDisplayInfo->item.cchTextMax, 0)));
+            auto column = static_cast<size_t>(subItemIndex);
+            m_processes.WriteCell(row, column, writer, [&](CellWriter& cellWriter)
+                {
+                    FormatCell(row, column, cellWriter);
+                });
+        }
+        if (subItemIndex == 0 && (itemDisplayInfo->item.mask & LVIF_IMAGE))
+        {
+            auto& exePath = table.ExecutablePath(row);
+            int iconIndex = 0;
+            if (!exePath.empty())
             {
-                auto& process = m_processes[itemIndex];
-                auto search = m_pathToIconIndex.find(process.ExecutablePath);
-                int iconIndex = 0;
-                if (search != m_pathToIconIndex.end())
+                if (auto slot = m_iconCache.Find(exePath))
                 {
-                    iconIndex = static_cast<int>(search->second);
+                    iconIndex = *slot;
+                }
+                else
+                {
+                    // Evicted while the row was out of sight
+                    EnsureProcessIcon(exePath);
                 }
-                itemDisplayInfo->item.iImage = iconIndex;
             }
+            itemDisplayInfo->item.iImage = iconIndex;
         }
-        else if (subItemIndex > 0)
+    }
+        break;
+    case LVN_ODCACHEHINT:
+    {
+        auto cacheHint = reinterpret_cast<NMLVCACHEHINT*>(lparam);
+        if (cacheHint->iFrom >= 0 && cacheHint->iTo >= cacheHint->iFrom)
         {
-            if (itemDisplayInfo->item.mask & LVIF_TEXT)
+            m_processes.Prefetch(static_cast<size_t>(cacheHint->iFrom), static_cast<size_t>(cacheHint->iTo), m_columns.size(),
+                [&](uint32_t row, size_t column, CellWriter& writer)
+                {
+                    FormatCell(row, column, writer);
+                });
+
+            // Start querying whatever the rows about to be shown are missing
+            auto& table = m_processes.Table();
+            auto [first, last] = m_processes.HintedRange();
+            for (auto position = first; position < last; position++)
             {
-                auto& process = m_processes[itemIndex];
-                auto& column = m_columns[subItemIndex];
-                std::wstringstream stream;
-                switch (column)
+                auto row = m_processes.RowAt(position);
+                if (table.PendingFields(row) != ProcessFields::None)
                 {
-                case ProcessInformation::Pid:
-                    stream << process.Pid;
-                    break;
-                case ProcessInformation::Name:
-                    stream << process.Name;
-                    break;
-                case ProcessInformation::Type:
-                    stream << process.Type;
-                    break;
-                case ProcessInformation::Architecture:
-                    stream << process.GetArchitecture();
-                    break;
-                case ProcessInformation::IntegrityLevel:
-                    stream << process.IntegrityLevel;
+                    m_fieldResolver->Request(table.GetProcess(row), ProcessFields::All);
                 }
-                auto string = stream.str();
-                wcsncpy_s(itemDisplayInfo->item.pszText, itemDisplayInfo->item.cchTextMax, string.data(), _TRUNCATE);
             }
         }
     }
         break;
+    case LVN_ODFINDITEMW:
+    {
+        auto findInfo = reinterpret_cast<NMLVFINDITEMW*>(lparam);
+        LRESULT result = -1;
+        if ((findInfo->lvfi.flags & (LVFI_STRING | LVFI_PARTIAL)) && findInfo->lvfi.psz != nullptr && !m_processes.empty())
+        {
+            auto startPosition = static_cast<size_t>(std::max(findInfo->iStart, 0));
+            if (auto position = m_nameIndex.Find(m_processes, m_nameSortKeys, findInfo->lvfi.psz,
+                (findInfo->lvfi.flags & LVFI_PARTIAL) != 0, startPosition, (findInfo->lvfi.flags & LVFI_WRAP) != 0))
+            {
+                result = static_cast<LRESULT>(*position);
+            }
+        }
+        return result;
+    }
     case LVN_COLUMNCLICK:
     {
         auto messageInfo = (LPNMLISTVIEW)lparam;
@@ -455,14 +753,8 @@ void MainWindow::OnListViewNotify(LPARAM const lparam)
         {
             m_columnSort = m_columnSort == ColumnSorting::Ascending ? ColumnSorting::Descending : ColumnSorting::Ascending;
         }
-        auto sort = m_columnSort;
         m_selectedColumnIndex = columnIndex;
-        auto& column = m_columns[m_selectedColumnIndex];
-
-        std::sort(m_processes.begin(), m_processes.end(), [sort, column](Process const& process1, Process const& process2)
-            {
-                return CompareProcesses(process1, process2, sort, column);
-            });
+        SortProcesses();
         ListView_RedrawItems(m_processListView, 0, m_processes.size() - 1);
         ListView_Scroll(m_processListView, 0, 0);
         ListView_SetItemState(m_processListView, -1, 0, LVIS_SELECTED);
@@ -470,54 +762,106 @@ void MainWindow::OnListViewNotify(LPARAM const lparam)
     }
         break;
     }
+    return std::nullopt;
+}
+
+void MainWindow::FormatCell(uint32_t row, size_t column, CellWriter& writer)
+{
+    auto& table = m_processes.Table();
+    VisitColumn(m_columns[column], [&](auto descriptor)
+        {
+            using TColumn = decltype(descriptor);
+            // Left blank until the field has been queried
+            if (!HasAnyField(table.PendingFields(row), TColumn::Fields))
+            {
+                TColumn::Format(writer, table, row);
+            }
+        });
 }
 
 void MainWindow::ResetProcessIconsCache()
 {
-    m_imageList.reset(winrt::check_pointer(ImageList_Create(
-        GetSystemMetrics(SM_CXICON) / 2,
-        GetSystemMetrics(SM_CYICON) / 2,
-        ILC_MASK | ILC_COLOR32, 1, 1)));
-    m_icons.clear();
-    // Create a default icon
+    auto iconWidth = GetSystemMetrics(SM_CXICON) / 2;
+    auto iconHeight = GetSystemMetrics(SM_CYICON) / 2;
+    m_imageList.reset(winrt::check_pointer(ImageList_Create(iconWidth, iconHeight, ILC_MASK | ILC_COLOR32, 1, 1)));
+    // An image list slot is mostly its 32-bit color bits
+    m_iconCache = IconCache(IconCacheBudget, static_cast<size_t>(iconWidth) * iconHeight * 4);
+    // Create a default icon, the image list keeps its own copy
     SHSTOCKICONINFO iconInfo = {};
     iconInfo.cbSize = sizeof(iconInfo);
     winrt::check_hresult(SHGetStockIconInfo(SIID_APPLICATION, SHGSI_ICON, &iconInfo));
-    wil::shared_hicon defaultIcon(winrt::check_pointer(iconInfo.hIcon));
-    m_icons.push_back(defaultIcon);
+    wil::unique_hicon defaultIcon(winrt::check_pointer(iconInfo.hIcon));
     ImageList_AddIcon(m_imageList.get(), defaultIcon.get());
-    for (auto&& process : m_processes)
+    for (size_t position = 0; position < m_processes.size(); position++)
     {
-        EnsureProcessIcon(process.ExecutablePath);
+        EnsureProcessIcon(m_processes.Table().ExecutablePath(m_processes.RowAt(position)));
     }
     ListView_SetImageList(m_processListView, m_imageList.get(), LVSIL_SMALL);
 }
 
+// Rows show the default icon until theirs has been loaded, see
+// DrainLoadedIcons
 void MainWindow::EnsureProcessIcon(std::wstring const& exePath)
 {
-    if (!exePath.empty())
+    if (!exePath.empty() && !m_iconCache.Contains(exePath))
+    {
+        m_iconLoader->Request(exePath);
+    }
+}
+
+// Runs on the icon loader's workers. Binaries that haven't changed since an
+// earlier run get their icon from the binary cache instead of being opened.
+wil::shared_hicon MainWindow::LoadProcessIcon(std::wstring const& exePath)
+{
+    auto stamp = GetBinaryFileStamp(exePath);
+    if (stamp.has_value())
     {
-        auto search = m_pathToIconIndex.find(exePath);
-        if (search == m_pathToIconIndex.end())
+        auto cached = m_binaryCache->Lookup(exePath, *stamp);
+        if (cached.has_value() && cached->Icon.has_value())
         {
-            auto instance = winrt::check_pointer(GetModuleHandleW(nullptr));
-            wil::shared_hicon exeIcon(ExtractIconW(instance, exePath.c_str(), 0));
-            if (exeIcon.is_valid())
+            if (cached->Icon->Pixels == nullptr)
             {
-                auto index = m_icons.size();
-                m_icons.push_back(exeIcon);
-                m_pathToIconIndex.insert({ exePath, index });
-                ImageList_AddIcon(m_imageList.get(), exeIcon.get());
+                return nullptr;
             }
-            else
-            {
-                auto error = GetLastError();
-                if (!(error == ERROR_RESOURCE_TYPE_NOT_FOUND || error == ERROR_RESOURCE_DATA_NOT_FOUND))
+            return CreateIconFromPixels(*cached->Icon);
+        }
+    }
+
+    wil::shared_hicon icon(ExtractIconW(GetModuleHandleW(nullptr), exePath.c_str(), 0));
+    if (stamp.has_value())
+    {
+        if (!icon.is_valid())
+        {
+            m_binaryCache->StoreIcon(exePath, *stamp, 0, 0, nullptr);
+        }
+        else if (auto pixels = GetIconPixels(icon.get()))
+        {
+            m_binaryCache->StoreIcon(exePath, *stamp, pixels->Width, pixels->Height, pixels->Pixels.data());
+        }
+    }
+    return icon;
+}
+
+void MainWindow::DrainLoadedIcons()
+{
+    size_t added = 0;
+    m_iconLoader->Drain([&](std::wstring&& exePath, wil::shared_hicon&& exeIcon)
+        {
+            // Binaries without icons keep the default one. Slots of evicted
+            // icons are overwritten, the image list only grows when there
+            // are none.
+            m_iconCache.Insert(exePath, exeIcon.is_valid(), [&](std::optional<int> freeSlot)
                 {
-                    winrt::throw_last_error();
-                }
+                    return ImageList_ReplaceIcon(m_imageList.get(), freeSlot.value_or(-1), exeIcon.get());
+                });
+            if (exeIcon.is_valid())
+            {
+                added++;
             }
-        }
+        });
+    if (added > 0)
+    {
+        InvalidateRect(m_processListView, nullptr, false);
     }
 }
 
@@ -535,36 +879,46 @@ winrt::fire_and_forget MainWindow::CheckBinaryArchitecture()
         co_await m_dispatcherQueue;
 
         auto name = file.Name();
-        auto path = GetStringFromPath(file.Path());
-        winmd::file_view view(path);
-
-        uint16_t machine = IMAGE_FILE_MACHINE_UNKNOWN;
-        try
+        auto path = std::wstring(file.Path());
+        auto stamp = GetBinaryFileStamp(path);
+        std::optional<BinaryMetadata> metadata;
+        if (stamp.has_value())
         {
-            // adapted from https://github.com/microsoft/winmd/blob/ab1436427ede293ddad944d3688e83b3fba3a173/src/impl/winmd_reader/database.h#L229
-            auto& dos = view.as<winmd::impl::image_dos_header>();
-            if (dos.e_signature != 0x5A4D) // IMAGE_DOS_SIGNATURE
+            if (auto cached = m_binaryCache->Lookup(path, *stamp))
             {
-                winmd::impl::throw_invalid("Invalid DOS signature");
+                metadata = cached->Metadata;
             }
+        }
 
-            auto& pe = view.as<winmd::impl::image_nt_headers32>(dos.e_lfanew);
-            if (pe.FileHeader.NumberOfSections == 0 || pe.FileHeader.NumberOfSections > 100)
+        if (!metadata.has_value())
+        {
+            // Only the headers are read, not the whole binary
+            std::vector<uint8_t> headers;
+            auto image = PeImage::Read(path, headers);
+            if (!image)
             {
-                winmd::impl::throw_invalid("Invalid PE section count");
+                MessageBoxA(m_window, GetPeErrorMessage(image.error()), "Process Viewer", MB_OK | MB_ICONERROR);
+                co_return;
             }
-
-            machine = pe.FileHeader.Machine;
-        }
-        catch (std::invalid_argument const& error)
-        {
-            MessageBoxA(m_window, error.what(), "Process Viewer", MB_OK | MB_ICONERROR);
-            co_return;
+            BinaryMetadata parsed;
+            parsed.Machine = image.Machine();
+            parsed.Subsystem = image.Subsystem();
+            parsed.FileVersion = GetBinaryFileVersion(path);
+            if (stamp.has_value())
+            {
+                m_binaryCache->StoreMetadata(path, *stamp, parsed);
+            }
+            metadata = parsed;
         }
-        auto architecture = MachineValueToArchitecture(machine);
+        auto architecture = MachineValueToArchitecture(metadata->Machine);
 
         std::wstringstream stream;
         stream << name.c_str() << L" targets " << architecture;
+        if (metadata->FileVersion != 0)
+        {
+            auto version = metadata->FileVersion;
+            stream << L" (version " << (version >> 48) << L'.' << ((version >> 32) & 0xFFFF) << L'.' << ((version >> 16) & 0xFFFF) << L'.' << (version & 0xFFFF) << L')';
+        }
         auto message = stream.str();
         MessageBoxW(m_window, message.c_str(), L"Process Viewer", MB_OK);
     }
@@ -586,14 +940,4 @@ winrt::fire_and_forget MainWindow::ShowAboutAsync()
 
     InitializeObjectWithWindowHandle(dialog);
     co_await dialog.ShowAsync();
-}
-
-std::string GetStringFromPath(winrt::hstring const& path)
-{
-    std::wstring input(path);
-    auto const input_length = static_cast<uint32_t>(input.length() + 1);
-    int buffer_length = WideCharToMultiByte(CP_UTF8, 0, input.data(), input_length, 0, 0, nullptr, nullptr);
-    std::string output(buffer_length, '\0');
-    winrt::check_bool(WideCharToMultiByte(CP_UTF8, 0, input.data(), input_length, output.data(), buffer_length, nullptr, nullptr) > 0);
-    return output;
 }
\ No newline at end of file
@@ -1,13 +1,25 @@
 #pragma once
 #include <robmikh.common/DesktopWindow.h>
+#include "BinaryMetadataCache.h"
 #include "Process.h"
+#include "ProcessSource.h"
+#include "ProcessListModel.h"
+#include "IconCache.h"
+#include "IconLoader.h"
+#include "ProcessColumns.h"
+#include "ProcessEventLog.h"
+#include "ProcessEventRing.h"
+#include "ProcessFieldResolver.h"
+#include "ProcessNameIndex.h"
 #include "ProcessWatcher.h"
+#include "StartupMilestones.h"
 
 struct MainWindow : robmikh::common::desktop::DesktopWindow<MainWindow>
 {
     static const std::wstring ClassName;
     static void RegisterWindowClass();
     MainWindow(std::wstring const& titleString, int width, int height);
+    ~MainWindow();
     LRESULT MessageHandler(UINT const message, WPARAM const wparam, LPARAM const lparam);
 
 private:
@@ -19,39 +31,70 @@ private:
         Descending
     };
 
-    std::vector<Process>::iterator GetProcessInsertIterator(Process const& process);
-    void InsertProcess(Process const& process);
-    void RemoveProcessByProcessId(DWORD processId);
+    ProcessFields GetSortFields();
+    void RequestPendingFields(ProcessFields fields);
+    void DrainResolvedFields();
+    std::optional<uint32_t> OnFieldsResolved(ProcessView const& process, ProcessFields fields);
+    void SortProcesses();
+    void StartSnapshotStream();
+    void ApplySnapshotBatch(std::vector<Process> const& batch);
+    void ApplyProcessBatch(ProcessEventBatch const& batch);
+    std::vector<Process> PrepareNewProcesses(std::vector<Process> const& processes, std::vector<uint32_t>& removedRows, bool alreadyRunning);
+    void ResyncProcesses(bool logChanges);
+    void ApplyResyncSnapshot(std::vector<Process> const& snapshot, bool logChanges);
+    std::optional<uint32_t> GetSelectedRow();
+    void ShowProcessChanges(std::optional<uint32_t> selectedRow);
     void CreateMenuBar();
     void CreateControls(HINSTANCE instance);
     void ResizeProcessListView();
-    void OnListViewNotify(LPARAM const lparam);
+    std::optional<LRESULT> OnListViewNotify(LPARAM const lparam);
+    void FormatCell(uint32_t row, size_t column, CellWriter& writer);
     void ResetProcessIconsCache();
     void EnsureProcessIcon(std::wstring const& exePath);
+    wil::shared_hicon LoadProcessIcon(std::wstring const& exePath);
+    void DrainLoadedIcons();
 
     winrt::fire_and_forget CheckBinaryArchitecture();
     
-    static bool CompareProcessId(
-        Process const& process1,
-        Process const& process2,
-        ColumnSorting const& sort);
-    static bool CompareProcesses(
-        Process const& process1, 
-        Process const& process2,
-        ColumnSorting const& sort,
-        ProcessInformation const& column);
-
     winrt::fire_and_forget ShowAboutAsync();
 
+    // Calls apply with the comparer the list is currently sorted by
+    template <typename TApply>
+    void WithSortOrder(TApply&& apply)
+    {
+        auto& table = m_processes.Table();
+        VisitColumn(m_columns[m_selectedColumnIndex], [&](auto descriptor)
+            {
+                using TColumn = decltype(descriptor);
+                if (m_columnSort == ColumnSorting::Ascending)
+                {
+                    apply(ColumnLess<TColumn, false>{ table });
+                }
+                else
+                {
+                    apply(ColumnLess<TColumn, true>{ table });
+                }
+            });
+    }
+
 private:
+    // Catches up on anything the watcher missed
+    static constexpr std::chrono::seconds ResyncInterval{ 30 };
+    // Roughly 4000 small icons, many more binaries than run at once
+    static constexpr size_t IconCacheBudget = 4 * 1024 * 1024;
+
+    // Started first thing, so the milestones include window creation
+    StartupTimeline m_startup;
     HWND m_processListView = nullptr;
     unique_himagelist m_imageList;
     std::vector<ProcessInformation> m_columns;
     size_t m_selectedColumnIndex = 1;
     ColumnSorting m_columnSort = ColumnSorting::Ascending;
-    std::vector<Process> m_processes;
-    std::map<std::wstring, size_t> m_pathToIconIndex;
-    std::vector<wil::shared_hicon> m_icons;
+    ProcessListModel m_processes;
+    FoldedStringRanks m_nameSortKeys;
+    ProcessNameIndex m_nameIndex;
+    // Which image list slot holds each binary's icon
+    IconCache m_iconCache;
     wil::unique_hmenu m_menuBar;
     wil::unique_hmenu m_fileMenu;
     wil::unique_hmenu m_viewMenu;
@@ -59,5 +102,23 @@ private:
     wil::unique_hmenu m_helpMenu;
     bool m_viewAccessibleProcess = true;
     winrt::Windows::System::DispatcherQueue m_dispatcherQueue{ nullptr };
+    std::unique_ptr<ProcessSource> m_processSource;
+    ProcessMetadataCache m_metadataCache;
+    // Resolved fields on their way from the resolver to the UI thread
+    std::unique_ptr<ProcessEventRing> m_resolvedFields;
+    std::unique_ptr<ProcessFieldResolver> m_fieldResolver;
+    // Icons and PE headers of binaries seen in earlier runs
+    std::unique_ptr<BinaryMetadataCache> m_binaryCache;
+    // Icons on their way to m_iconCache
+    std::unique_ptr<IconLoader<wil::shared_hicon>> m_iconLoader;
+    std::unique_ptr<ProcessEventLogWriter> m_eventLog;
     std::unique_ptr<ProcessWatcher> m_processWatcher;
+    winrt::Windows::System::DispatcherQueueTimer m_resyncTimer{ nullptr };
+    winrt::Windows::System::DispatcherQueueTimer::Tick_revoker m_resyncTimerTick;
+    // Tells the snapshot and resync threads to stop posting to the UI thread
+    std::atomic<bool> m_stopping = false;
+    std::thread m_snapshotThread;
+    std::thread m_resyncThread;
+    // UI thread only, set from starting a resync until its snapshot is applied
+    bool m_resyncing = false;
 };
\ No newline at end of file
@@ -0,0 +1,117 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <utility>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A read-only view of a whole file. The file can still be written to (and
+// appended to) while it is mapped, the view just doesn't grow; map it again
+// to see what was appended. Empty files map to an empty view.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(MappedFile&& other) noexcept
+        : m_data(std::exchange(other.m_data, nullptr)), m_size(std::exchange(other.m_size, 0))
+    {
+    }
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Unmap();
+            m_data = std::exchange(other.m_data, nullptr);
+            m_size = std::exchange(other.m_size, 0);
+        }
+        return *this;
+    }
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+    ~MappedFile() { Unmap(); }
+
+    // Returns false if the file doesn't exist or can't be mapped
+    bool Open(std::filesystem::path const& path)
+    {
+        Unmap();
+#ifdef _WIN32
+        wil::unique_hfile file(CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+        LARGE_INTEGER size = {};
+        if (!file || !GetFileSizeEx(file.get(), &size))
+        {
+            return false;
+        }
+        if (size.QuadPart == 0)
+        {
+            return true;
+        }
+        wil::unique_handle mapping(CreateFileMappingW(file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+        if (!mapping)
+        {
+            return false;
+        }
+        auto data = MapViewOfFile(mapping.get(), FILE_MAP_READ, 0, 0, 0);
+        if (data == nullptr)
+        {
+            return false;
+        }
+        m_data = static_cast<uint8_t const*>(data);
+        m_size = static_cast<size_t>(size.QuadPart);
+#else
+        auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat status = {};
+        auto result = fstat(fd, &status) == 0;
+        if (result && status.st_size > 0)
+        {
+            auto data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                m_data = static_cast<uint8_t const*>(data);
+                m_size = static_cast<size_t>(status.st_size);
+            }
+            else
+            {
+                result = false;
+            }
+        }
+        close(fd);
+        if (!result)
+        {
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    uint8_t const* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    void Unmap()
+    {
+        if (m_data != nullptr)
+        {
+#ifdef _WIN32
+            UnmapViewOfFile(m_data);
+#else
+            munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+        }
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+private:
+    uint8_t const* m_data = nullptr;
+    size_t m_size = 0;
+};
@@ -0,0 +1,99 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+inline size_t GetDefaultConcurrency()
+{
+    auto count = std::thread::hardware_concurrency();
+    return count > 0 ? static_cast<size_t>(count) : 1;
+}
+
+// Calls func(index) for every index in [0, count) on up to maxConcurrency
+// threads (the calling thread included). Indices are handed out in order
+// but may complete in any order. The first exception thrown stops the
+// remaining work and is rethrown on the calling thread.
+template <typename TFunc>
+void ParallelFor(size_t count, TFunc&& func, size_t maxConcurrency = GetDefaultConcurrency())
+{
+    auto workerCount = std::min(std::max<size_t>(maxConcurrency, 1), std::max<size_t>(count, 1));
+
+    std::atomic<size_t> nextIndex = 0;
+    std::exception_ptr firstError;
+    std::mutex errorLock;
+    auto worker = [&]()
+    {
+        try
+        {
+            size_t index = 0;
+            while ((index = nextIndex.fetch_add(1, std::memory_order_relaxed)) < count)
+            {
+                func(index);
+            }
+        }
+        catch (...)
+        {
+            // Stop handing out work and surface the first failure
+            nextIndex = count;
+            std::scoped_lock lock(errorLock);
+            if (!firstError)
+            {
+                firstError = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(workerCount - 1);
+    for (size_t i = 1; i < workerCount; i++)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto&& thread : threads)
+    {
+        thread.join();
+    }
+
+    if (firstError)
+    {
+        std::rethrow_exception(firstError);
+    }
+}
+
+// Runs func over every input on up to maxConcurrency threads (the calling
+// thread included). Results are written into the slot matching their input,
+// so the output order is always the input order regardless of scheduling.
+template <typename TInput, typename TFunc>
+auto ParallelTransform(std::vector<TInput> const& inputs, TFunc&& func, size_t maxConcurrency = GetDefaultConcurrency())
+    -> std::vector<decltype(func(inputs[0]))>
+{
+    using TOutput = decltype(func(inputs[0]));
+    std::vector<std::optional<TOutput>> slots(inputs.size());
+
+    // Items are handed out in small chunks so that a few slow processes
+    // (e.g. ones stuck in a debugger) don't leave the other workers idle.
+    const size_t chunkSize = 8;
+    const size_t chunkCount = (inputs.size() + chunkSize - 1) / chunkSize;
+    ParallelFor(chunkCount, [&](size_t chunk)
+        {
+            auto begin = chunk * chunkSize;
+            auto end = std::min(begin + chunkSize, inputs.size());
+            for (auto i = begin; i < end; i++)
+            {
+                slots[i].emplace(func(inputs[i]));
+            }
+        }, maxConcurrency);
+
+    std::vector<TOutput> result;
+    result.reserve(slots.size());
+    for (auto&& slot : slots)
+    {
+        result.push_back(std::move(*slot));
+    }
+    return result;
+}
@@ -0,0 +1,417 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// The headers of a PE (Portable Executable) file, laid out as on disk. Fields
+// are read in place, so this assumes a little-endian host. 64-bit fields are
+// split in halves, which keeps every struct 4-byte aligned.
+
+struct PeUInt64
+{
+    uint32_t Low;
+    uint32_t High;
+
+    uint64_t Value() const
+    {
+        return (static_cast<uint64_t>(High) << 32) | Low;
+    }
+};
+
+struct PeDosHeader
+{
+    uint16_t Magic;
+    uint16_t Unused[29];
+    int32_t NtHeadersOffset;
+};
+
+struct PeFileHeader
+{
+    uint16_t Machine;
+    uint16_t NumberOfSections;
+    uint32_t TimeDateStamp;
+    uint32_t PointerToSymbolTable;
+    uint32_t NumberOfSymbols;
+    uint16_t SizeOfOptionalHeader;
+    uint16_t Characteristics;
+};
+
+struct PeDataDirectory
+{
+    uint32_t VirtualAddress;
+    uint32_t Size;
+};
+
+// Up to the data directories, which follow it. PE32 and PE32+ only differ in
+// the width of the address sized fields (and PE32's BaseOfData).
+struct PeOptionalHeader32
+{
+    uint16_t Magic;
+    uint8_t MajorLinkerVersion;
+    uint8_t MinorLinkerVersion;
+    uint32_t SizeOfCode;
+    uint32_t SizeOfInitializedData;
+    uint32_t SizeOfUninitializedData;
+    uint32_t AddressOfEntryPoint;
+    uint32_t BaseOfCode;
+    uint32_t BaseOfData;
+    uint32_t ImageBase;
+    uint32_t SectionAlignment;
+    uint32_t FileAlignment;
+    uint16_t MajorOperatingSystemVersion;
+    uint16_t MinorOperatingSystemVersion;
+    uint16_t MajorImageVersion;
+    uint16_t MinorImageVersion;
+    uint16_t MajorSubsystemVersion;
+    uint16_t MinorSubsystemVersion;
+    uint32_t Win32VersionValue;
+    uint32_t SizeOfImage;
+    uint32_t SizeOfHeaders;
+    uint32_t CheckSum;
+    uint16_t Subsystem;
+    uint16_t DllCharacteristics;
+    uint32_t SizeOfStackReserve;
+    uint32_t SizeOfStackCommit;
+    uint32_t SizeOfHeapReserve;
+    uint32_t SizeOfHeapCommit;
+    uint32_t LoaderFlags;
+    uint32_t NumberOfRvaAndSizes;
+};
+
+struct PeOptionalHeader64
+{
+    uint16_t Magic;
+    uint8_t MajorLinkerVersion;
+    uint8_t MinorLinkerVersion;
+    uint32_t SizeOfCode;
+    uint32_t SizeOfInitializedData;
+    uint32_t SizeOfUninitializedData;
+    uint32_t AddressOfEntryPoint;
+    uint32_t BaseOfCode;
+    PeUInt64 ImageBase;
+    uint32_t SectionAlignment;
+    uint32_t FileAlignment;
+    uint16_t MajorOperatingSystemVersion;
+    uint16_t MinorOperatingSystemVersion;
+    uint16_t MajorImageVersion;
+    uint16_t MinorImageVersion;
+    uint16_t MajorSubsystemVersion;
+    uint16_t MinorSubsystemVersion;
+    uint32_t Win32VersionValue;
+    uint32_t SizeOfImage;
+    uint32_t SizeOfHeaders;
+    uint32_t CheckSum;
+    uint16_t Subsystem;
+    uint16_t DllCharacteristics;
+    PeUInt64 SizeOfStackReserve;
+    PeUInt64 SizeOfStackCommit;
+    PeUInt64 SizeOfHeapReserve;
+    PeUInt64 SizeOfHeapCommit;
+    uint32_t LoaderFlags;
+    uint32_t NumberOfRvaAndSizes;
+};
+
+struct PeSectionHeader
+{
+    // Not null terminated if it is 8 characters long
+    char Name[8];
+    uint32_t VirtualSize;
+    uint32_t VirtualAddress;
+    uint32_t SizeOfRawData;
+    uint32_t PointerToRawData;
+    uint32_t PointerToRelocations;
+    uint32_t PointerToLinenumbers;
+    uint16_t NumberOfRelocations;
+    uint16_t NumberOfLinenumbers;
+    uint32_t Characteristics;
+};
+
+static_assert(sizeof(PeDosHeader) == 64, "PE headers are read in place");
+static_assert(sizeof(PeFileHeader) == 20, "PE headers are read in place");
+static_assert(sizeof(PeOptionalHeader32) == 96, "PE headers are read in place");
+static_assert(sizeof(PeOptionalHeader64) == 112, "PE headers are read in place");
+static_assert(sizeof(PeSectionHeader) == 40, "PE headers are read in place");
+
+enum class PeError : uint8_t
+{
+    None,
+    // The file is shorter than its headers say, see PeImage::RequiredSize
+    Truncated,
+    InvalidDosSignature,
+    InvalidNtSignature,
+    // Headers that don't start on a 4-byte boundary. Linkers never write
+    // them, and rejecting them lets the headers be read in place.
+    MisalignedHeaders,
+    InvalidSectionCount,
+    InvalidOptionalHeader,
+    UnreadableFile,
+};
+
+inline char const* GetPeErrorMessage(PeError error)
+{
+    switch (error)
+    {
+    case PeError::None:
+        return "No error";
+    case PeError::Truncated:
+        return "Truncated PE headers";
+    case PeError::InvalidDosSignature:
+        return "Invalid DOS signature";
+    case PeError::InvalidNtSignature:
+        return "Invalid PE signature";
+    case PeError::MisalignedHeaders:
+        return "Misaligned PE headers";
+    case PeError::InvalidSectionCount:
+        return "Invalid PE section count";
+    case PeError::InvalidOptionalHeader:
+        return "Invalid PE optional header";
+    case PeError::UnreadableFile:
+        return "The file couldn't be read";
+    default:
+        return "Unknown error";
+    }
+}
+
+// Reads bytes [offset, offset + size) of a file into buffer, which ends up
+// shorter if the file is. Returns false if the file can't be read.
+inline bool ReadFileRange(std::filesystem::path const& path, uint64_t offset, size_t size, std::vector<uint8_t>& buffer)
+{
+#ifdef _WIN32
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream || !stream.seekg(static_cast<std::streamoff>(offset)))
+    {
+        return false;
+    }
+    buffer.resize(size);
+    stream.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(size));
+    if (stream.bad())
+    {
+        return false;
+    }
+    buffer.resize(static_cast<size_t>(stream.gcount()));
+#else
+    auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    buffer.resize(size);
+    size_t read = 0;
+    while (read < size)
+    {
+        auto result = pread(fd, buffer.data() + read, size - read, static_cast<off_t>(offset + read));
+        if (result <= 0)
+        {
+            break;
+        }
+        read += static_cast<size_t>(result);
+    }
+    close(fd);
+    buffer.resize(read);
+#endif
+    return true;
+}
+
+// A view of the headers at the start of a PE file. Parse checks that every
+// header it exposes lies within the bytes it was given, nothing is copied,
+// so the bytes have to outlive the view.
+class PeImage
+{
+public:
+    static constexpr uint16_t DosSignature = 0x5A4D; // MZ
+    static constexpr uint32_t NtSignature = 0x00004550; // PE\0\0
+    static constexpr uint16_t Pe32Magic = 0x10B;
+    static constexpr uint16_t Pe32PlusMagic = 0x20B;
+    static constexpr size_t MaxDataDirectories = 16;
+    // Real binaries stay far below it
+    static constexpr uint16_t MaxSections = 100;
+
+    PeImage() = default;
+
+    static PeImage Parse(uint8_t const* data, size_t size)
+    {
+        PeImage image;
+        image.m_data = data;
+        image.m_error = image.ParseHeaders(size);
+        return image;
+    }
+
+    // Reads just the headers of a PE file into buffer, which the view points
+    // into. Nearly every binary's headers fit in the first read, the rest
+    // take one more once the section count is known.
+    static PeImage Read(std::filesystem::path const& path, std::vector<uint8_t>& buffer)
+    {
+        static constexpr size_t FirstReadSize = 4096;
+        PeImage image;
+        if (!ReadFileRange(path, 0, FirstReadSize, buffer))
+        {
+            image.m_error = PeError::UnreadableFile;
+            return image;
+        }
+        image = Parse(buffer.data(), buffer.size());
+        if (image.m_error == PeError::Truncated && buffer.size() == FirstReadSize && image.m_requiredSize > FirstReadSize)
+        {
+            auto requiredSize = image.m_requiredSize;
+            if (!ReadFileRange(path, 0, requiredSize, buffer))
+            {
+                image = PeImage();
+                image.m_error = PeError::UnreadableFile;
+                return image;
+            }
+            image = Parse(buffer.data(), buffer.size());
+        }
+        return image;
+    }
+
+    PeError error() const { return m_error; }
+    explicit operator bool() const { return m_error == PeError::None; }
+
+    // How many bytes from the start of the file the headers take up, as far
+    // as parsing got. Reading this many bytes and parsing again gets past a
+    // Truncated error, unless the file really is that short.
+    size_t RequiredSize() const { return m_requiredSize; }
+
+    // Everything below requires a successful parse
+    PeDosHeader const& DosHeader() const { return At<PeDosHeader>(0); }
+    PeFileHeader const& FileHeader() const { return At<PeFileHeader>(m_ntHeadersOffset + sizeof(uint32_t)); }
+    bool IsPe32Plus() const { return m_isPe32Plus; }
+    PeOptionalHeader32 const* OptionalHeader32() const { return m_isPe32Plus ? nullptr : &At<PeOptionalHeader32>(m_optionalHeaderOffset); }
+    PeOptionalHeader64 const* OptionalHeader64() const { return m_isPe32Plus ? &At<PeOptionalHeader64>(m_optionalHeaderOffset) : nullptr; }
+
+    // IMAGE_FILE_MACHINE_*
+    uint16_t Machine() const { return FileHeader().Machine; }
+
+    // IMAGE_SUBSYSTEM_*
+    uint16_t Subsystem() const
+    {
+        return m_isPe32Plus ? OptionalHeader64()->Subsystem : OptionalHeader32()->Subsystem;
+    }
+
+    // Present in the optional header, at most MaxDataDirectories
+    size_t DataDirectoryCount() const { return m_dataDirectoryCount; }
+
+    // Returns null if the directory isn't present
+    PeDataDirectory const* DataDirectory(size_t index) const
+    {
+        if (index >= m_dataDirectoryCount)
+        {
+            return nullptr;
+        }
+        return &At<PeDataDirectory>(m_dataDirectoriesOffset + index * sizeof(PeDataDirectory));
+    }
+
+    size_t SectionCount() const { return FileHeader().NumberOfSections; }
+    PeSectionHeader const* begin() const { return &At<PeSectionHeader>(m_sectionsOffset); }
+    PeSectionHeader const* end() const { return begin() + SectionCount(); }
+
+private:
+    template <typename T>
+    T const& At(size_t offset) const
+    {
+        return *reinterpret_cast<T const*>(m_data + offset);
+    }
+
+    // Records how far the headers go, returns false if that is past size
+    bool Require(size_t end, size_t size)
+    {
+        m_requiredSize = end;
+        return end <= size;
+    }
+
+    PeError ParseHeaders(size_t size)
+    {
+        if (!Require(sizeof(PeDosHeader), size) || m_data == nullptr)
+        {
+            return PeError::Truncated;
+        }
+        if (reinterpret_cast<uintptr_t>(m_data) % alignof(uint32_t) != 0)
+        {
+            return PeError::MisalignedHeaders;
+        }
+        auto& dos = DosHeader();
+        if (dos.Magic != DosSignature)
+        {
+            return PeError::InvalidDosSignature;
+        }
+        if (dos.NtHeadersOffset < static_cast<int32_t>(sizeof(PeDosHeader)))
+        {
+            return PeError::InvalidNtSignature;
+        }
+        m_ntHeadersOffset = static_cast<size_t>(dos.NtHeadersOffset);
+        if (m_ntHeadersOffset % alignof(uint32_t) != 0)
+        {
+            return PeError::MisalignedHeaders;
+        }
+
+        m_optionalHeaderOffset = m_ntHeadersOffset + sizeof(uint32_t) + sizeof(PeFileHeader);
+        if (!Require(m_optionalHeaderOffset + sizeof(uint16_t), size))
+        {
+            return PeError::Truncated;
+        }
+        if (At<uint32_t>(m_ntHeadersOffset) != NtSignature)
+        {
+            return PeError::InvalidNtSignature;
+        }
+        auto& file = FileHeader();
+        if (file.NumberOfSections == 0 || file.NumberOfSections > MaxSections)
+        {
+            return PeError::InvalidSectionCount;
+        }
+
+        auto magic = At<uint16_t>(m_optionalHeaderOffset);
+        size_t fixedSize = 0;
+        if (magic == Pe32Magic)
+        {
+            fixedSize = sizeof(PeOptionalHeader32);
+        }
+        else if (magic == Pe32PlusMagic)
+        {
+            fixedSize = sizeof(PeOptionalHeader64);
+            m_isPe32Plus = true;
+        }
+        else
+        {
+            return PeError::InvalidOptionalHeader;
+        }
+        if (file.SizeOfOptionalHeader < fixedSize)
+        {
+            return PeError::InvalidOptionalHeader;
+        }
+        m_sectionsOffset = m_optionalHeaderOffset + file.SizeOfOptionalHeader;
+        if (m_sectionsOffset % alignof(uint32_t) != 0)
+        {
+            return PeError::MisalignedHeaders;
+        }
+        if (!Require(m_sectionsOffset + SectionCount() * sizeof(PeSectionHeader), size))
+        {
+            return PeError::Truncated;
+        }
+
+        // Directories beyond the ones the optional header has room for are
+        // ignored, like the loader does
+        auto rvaAndSizes = m_isPe32Plus ? OptionalHeader64()->NumberOfRvaAndSizes : OptionalHeader32()->NumberOfRvaAndSizes;
+        m_dataDirectoriesOffset = m_optionalHeaderOffset + fixedSize;
+        auto room = (file.SizeOfOptionalHeader - fixedSize) / sizeof(PeDataDirectory);
+        m_dataDirectoryCount = std::min({ static_cast<size_t>(rvaAndSizes), room, MaxDataDirectories });
+        return PeError::None;
+    }
+
+private:
+    uint8_t const* m_data = nullptr;
+    PeError m_error = PeError::Truncated;
+    size_t m_requiredSize = 0;
+    size_t m_ntHeadersOffset = 0;
+    size_t m_optionalHeaderOffset = 0;
+    size_t m_dataDirectoriesOffset = 0;
+    size_t m_dataDirectoryCount = 0;
+    size_t m_sectionsOffset = 0;
+    bool m_isPe32Plus = false;
+};
@@ -1,4 +1,30 @@
 #pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include "QueryResult.h"
+
+#ifndef _WIN32
+// The model stores machine types and integrity levels using their Windows
+// values, other platforms map onto these.
+#define IMAGE_FILE_MACHINE_UNKNOWN 0
+#define IMAGE_FILE_MACHINE_I386 0x014c
+#define IMAGE_FILE_MACHINE_ARMNT 0x01c4
+#define IMAGE_FILE_MACHINE_AMD64 0x8664
+#define IMAGE_FILE_MACHINE_ARM64 0xAA64
+
+#define SECURITY_MANDATORY_UNTRUSTED_RID (0x00000000L)
+#define SECURITY_MANDATORY_LOW_RID (0x00001000L)
+#define SECURITY_MANDATORY_MEDIUM_RID (0x00002000L)
+#define SECURITY_MANDATORY_MEDIUM_PLUS_RID (SECURITY_MANDATORY_MEDIUM_RID + 0x100)
+#define SECURITY_MANDATORY_HIGH_RID (0x00003000L)
+#define SECURITY_MANDATORY_SYSTEM_RID (0x00004000L)
+#define SECURITY_MANDATORY_PROTECTED_PROCESS_RID (0x00005000L)
+#endif
 
 enum class ProcessInformation
 {
@@ -9,29 +35,6 @@ enum class ProcessInformation
     IntegrityLevel,
 };
 
-inline std::wostream& operator<< (std::wostream& os, ProcessInformation const& info)
-{
-    switch (info)
-    {
-    case ProcessInformation::Pid:
-        os << L"Pid";
-        break;
-    case ProcessInformation::Name:
-        os << L"Name";
-        break;
-    case ProcessInformation::Type:
-        os << L"Type";
-        break;
-    case ProcessInformation::Architecture:
-        os << L"Architecture";
-        break;
-    case ProcessInformation::IntegrityLevel:
-        os << L"Integrity Level";
-        break;
-    }
-    return os;
-}
-
 enum class Architecture
 {
     Unknown,
@@ -58,27 +61,16 @@ inline Architecture MachineValueToArchitecture(uint16_t value)
     }
 }
 
+inline std::wstring_view GetArchitectureName(Architecture arch)
+{
+    static constexpr std::wstring_view names[] = { L"Unknown", L"x86", L"x64", L"ARM", L"ARM64" };
+    auto index = static_cast<size_t>(arch);
+    return index < std::size(names) ? names[index] : names[0];
+}
+
 inline std::wostream& operator<< (std::wostream& os, Architecture const& arch)
 {
-    switch (arch)
-    {
-    case Architecture::x86:
-        os << L"x86";
-        break;
-    case Architecture::x64:
-        os << L"x64";
-        break;
-    case Architecture::ARM:
-        os << L"ARM";
-        break;
-    case Architecture::ARM64:
-        os << L"ARM64";
-        break;
-    default:
-        os << L"Unknown";
-        break;
-    }
-    return os;
+    return os << GetArchitectureName(arch);
 }
 
 enum class ProcessType
@@ -87,18 +79,15 @@ enum class ProcessType
     AppContainer,
 };
 
+inline std::wstring_view GetProcessTypeName(ProcessType type)
+{
+    static constexpr std::wstring_view names[] = { L"Legacy", L"AppContainer" };
+    return names[static_cast<size_t>(type)];
+}
+
 inline std::wostream& operator<< (std::wostream& os, ProcessType const& type)
 {
-    switch (type)
-    {
-    case ProcessType::Legacy:
-        os << L"Legacy";
-        break;
-    case ProcessType::AppContainer:
-        os << L"AppContainer";
-        break;
-    }
-    return os;
+    return os << GetProcessTypeName(type);
 }
 
 enum class IntegrityLevel : uint32_t
@@ -112,29 +101,34 @@ enum class IntegrityLevel : uint32_t
     ProtectedProcess = SECURITY_MANDATORY_PROTECTED_PROCESS_RID
 };
 
-inline std::wostream& operator<< (std::wostream& os, IntegrityLevel const& ilevel)
+inline std::wstring_view GetIntegrityLevelName(IntegrityLevel ilevel)
 {
     switch (ilevel)
     {
     case IntegrityLevel::Untrusted:
-        return os << L"Untrusted";
+        return L"Untrusted";
     case IntegrityLevel::Low:
-        return os << L"Low";
+        return L"Low";
     case IntegrityLevel::Medium:
-        return os << L"Medium";
+        return L"Medium";
     case IntegrityLevel::MediumPlus:
-        return os << L"MediumPlus";
+        return L"MediumPlus";
     case IntegrityLevel::High:
-        return os << L"High";
+        return L"High";
     case IntegrityLevel::System:
-        return os << L"System";
+        return L"System";
     case IntegrityLevel::ProtectedProcess:
-        return os << L"ProtectedProcess";
+        return L"ProtectedProcess";
     default:
         std::abort();
     }
 }
 
+inline std::wostream& operator<< (std::wostream& os, IntegrityLevel const& ilevel)
+{
+    return os << GetIntegrityLevelName(ilevel);
+}
+
 // https://support.microsoft.com/en-us/help/243330/well-known-security-identifiers-in-windows-operating-systems
 inline std::wstring IntegrityLevelToSidString(IntegrityLevel value)
 {
@@ -171,161 +165,271 @@ inline std::wostream& operator<< (std::wostream& os, std::optional<T> const& opt
     return os;
 }
 
-struct Process
+// The fields of a Process that are queried after enumeration. Each can be
+// resolved on its own, so expensive ones are only looked up when needed.
+enum class ProcessFields : uint8_t
 {
-    DWORD Pid;
-    std::wstring Name;
-    std::wstring ExecutablePath;
-    std::optional<ProcessType> Type;
-    USHORT ArchitectureValue;
-    std::optional<IntegrityLevel> IntegrityLevel;
+    None = 0,
+    ExecutablePath = 1 << 0,
+    Type = 1 << 1,
+    Architecture = 1 << 2,
+    IntegrityLevel = 1 << 3,
+    All = ExecutablePath | Type | Architecture | IntegrityLevel,
+};
 
-    Architecture GetArchitecture()
+constexpr ProcessFields operator| (ProcessFields left, ProcessFields right)
+{
+    return static_cast<ProcessFields>(static_cast<uint8_t>(left) | static_cast<uint8_t>(right));
+}
+
+constexpr ProcessFields operator& (ProcessFields left, ProcessFields right)
+{
+    return static_cast<ProcessFields>(static_cast<uint8_t>(left) & static_cast<uint8_t>(right));
+}
+
+constexpr ProcessFields operator~ (ProcessFields value)
+{
+    return static_cast<ProcessFields>(~static_cast<uint8_t>(value)) & ProcessFields::All;
+}
+
+constexpr bool HasAnyField(ProcessFields fields, ProcessFields test)
+{
+    return (fields & test) != ProcessFields::None;
+}
+
+// Why each field of a Process that is left unknown couldn't be queried
+struct ProcessQueryErrors
+{
+    QueryError ExecutablePath = QueryError::None;
+    QueryError Type = QueryError::None;
+    QueryError Architecture = QueryError::None;
+    QueryError IntegrityLevel = QueryError::None;
+
+    void Set(ProcessFields fields, QueryError error)
     {
-        return MachineValueToArchitecture(ArchitectureValue);
+        if (HasAnyField(fields, ProcessFields::ExecutablePath))
+        {
+            ExecutablePath = error;
+        }
+        if (HasAnyField(fields, ProcessFields::Type))
+        {
+            Type = error;
+        }
+        if (HasAnyField(fields, ProcessFields::Architecture))
+        {
+            Architecture = error;
+        }
+        if (HasAnyField(fields, ProcessFields::IntegrityLevel))
+        {
+            IntegrityLevel = error;
+        }
     }
 };
 
-inline wil::unique_handle GetProcessHandleFromPid(DWORD pid)
+// Pids are reused, the creation time tells two processes with the same pid
+// apart. Creation times are opaque values that are only meaningful when
+// compared with others from the same ProcessSource, 0 means unknown.
+struct ProcessIdentity
+{
+    uint32_t Pid;
+    uint64_t CreationTime;
+};
+
+inline bool operator==(ProcessIdentity const& left, ProcessIdentity const& right)
 {
-    return wil::unique_handle(winrt::check_pointer(OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false, pid)));
+    return left.Pid == right.Pid && left.CreationTime == right.CreationTime;
 }
 
-inline wil::unique_handle GetProcessToken(wil::unique_handle const& processHandle)
+inline bool operator!=(ProcessIdentity const& left, ProcessIdentity const& right)
 {
-    wil::unique_handle processToken;
-    winrt::check_bool(OpenProcessToken(processHandle.get(), TOKEN_QUERY, processToken.put()));
-    return processToken;
+    return !(left == right);
 }
 
-template <typename T>
-inline void check_bool_with_expected_error(T result, winrt::hresult expected)
+// A process identity folded into 64 bits, cheap enough to put on every
+// event: the pid in the high half, and in the low half a generation derived
+// from the creation time. Events that carry a key can't be mistaken for
+// events about a later process that reused the pid. A generation of 0 means
+// the creation time wasn't known, such keys match any process with the pid.
+struct ProcessKey
 {
-    if (!result)
+#ifdef _WIN32
+    // Creation times are FILETIMEs, but WMI only reports them to the
+    // microsecond
+    static constexpr uint64_t CreationTimeResolution = 10;
+#else
+    static constexpr uint64_t CreationTimeResolution = 1;
+#endif
+
+    uint64_t Value = 0;
+
+    static constexpr ProcessKey From(uint32_t pid, uint64_t creationTime)
     {
-        // Get the last error
-        auto lastError = HRESULT_FROM_WIN32(GetLastError());
-        if (lastError != expected)
+        uint32_t generation = 0;
+        if (creationTime != 0)
         {
-            winrt::check_hresult(lastError);
+            auto time = creationTime / CreationTimeResolution;
+            generation = static_cast<uint32_t>(time ^ (time >> 32));
+            if (generation == 0)
+            {
+                generation = 1;
+            }
         }
+        return { (static_cast<uint64_t>(pid) << 32) | generation };
     }
-}
 
-inline std::optional<IntegrityLevel> GetIntegrityLevelFromProcessToken(wil::unique_handle const& processToken)
-{
-    // Get the size of the data we'll get back
-    DWORD informationLength = 0;
-    check_bool_with_expected_error(GetTokenInformation(processToken.get(), TokenIntegrityLevel, nullptr, 0, &informationLength), HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER));
+    constexpr uint32_t Pid() const
+    {
+        return static_cast<uint32_t>(Value >> 32);
+    }
 
-    // Allocate the memory for the integrity level data
-    wil::unique_hlocal infoData(LocalAlloc(0, informationLength));
-    auto info = (PTOKEN_MANDATORY_LABEL)infoData.get();
+    constexpr uint32_t Generation() const
+    {
+        return static_cast<uint32_t>(Value);
+    }
 
-    // Get the data for our integrity level
-    winrt::check_bool(GetTokenInformation(processToken.get(), TokenIntegrityLevel, info, informationLength, &informationLength));
+    // Same pid, and the same generation unless either isn't known
+    constexpr bool Matches(ProcessKey other) const
+    {
+        return Pid() == other.Pid() && (Generation() == 0 || other.Generation() == 0 || Generation() == other.Generation());
+    }
+};
 
-    // Get the integrity level from the info we got back
-    auto authorityCount = (DWORD)(UCHAR)*winrt::check_pointer(GetSidSubAuthorityCount(info->Label.Sid));
-    auto integrityLevel = *winrt::check_pointer(GetSidSubAuthority(info->Label.Sid, authorityCount - 1));
+// Whether an exit is for the process with the given key and name. The keys
+// decide, unless the exit came with a name: WMI keys exits by a creation
+// time converted from a CIM date, which can be off by more than the key
+// allows for, so a process with the same pid and name counts as well.
+inline bool ExitMatches(ProcessKey exitKey, std::wstring_view exitName, ProcessKey key, std::wstring_view name)
+{
+    return exitKey.Matches(key) || (exitKey.Pid() == key.Pid() && !exitName.empty() && exitName == name);
+}
 
-    switch (integrityLevel)
+// FNV-1a, for remembering which name a process had without keeping a copy
+inline uint64_t HashProcessName(std::wstring_view name)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (auto c : name)
     {
-    case SECURITY_MANDATORY_UNTRUSTED_RID:
-    case SECURITY_MANDATORY_LOW_RID:
-    case SECURITY_MANDATORY_MEDIUM_RID:
-    case SECURITY_MANDATORY_HIGH_RID:
-    case SECURITY_MANDATORY_SYSTEM_RID:
-    case SECURITY_MANDATORY_PROTECTED_PROCESS_RID:
-        return std::optional(static_cast<IntegrityLevel>(integrityLevel));
-    default:
-        return std::nullopt;
+        hash = (hash ^ static_cast<uint64_t>(c)) * 1099511628211ull;
     }
+    return hash;
+}
+
+constexpr bool operator==(ProcessKey left, ProcessKey right)
+{
+    return left.Value == right.Value;
 }
 
-inline std::wstring GetExectuablePathFromProcess(wil::unique_handle const& processHandle)
+constexpr bool operator!=(ProcessKey left, ProcessKey right)
 {
-    std::wstring exePath(MAX_PATH, L'\0');
-    DWORD length = static_cast<DWORD>(exePath.size());
-    winrt::check_bool(QueryFullProcessImageNameW(processHandle.get(), 0, exePath.data(), &length));
-    exePath.resize(length, L'\0');
-    return exePath;
+    return left.Value != right.Value;
 }
 
-inline std::optional<Process> CreateProcessFromPid(DWORD pid, std::wstring const& processName)
+struct Process
 {
-    USHORT archValue = IMAGE_FILE_MACHINE_UNKNOWN;
-    std::optional<ProcessType> processType = std::nullopt;
-    std::optional<IntegrityLevel> ilevel = std::nullopt;
-    std::wstring exeName;
-    try
+    uint32_t Pid;
+    uint64_t CreationTime;
+    std::wstring Name;
+    std::wstring ExecutablePath;
+    std::optional<ProcessType> Type;
+    uint16_t ArchitectureValue;
+    std::optional<::IntegrityLevel> IntegrityLevel;
+    ProcessQueryErrors Errors;
+    // Fields that haven't been queried yet, they are left unknown
+    ProcessFields Pending;
+
+    Architecture GetArchitecture()
+    {
+        return MachineValueToArchitecture(ArchitectureValue);
+    }
+
+    ProcessIdentity GetIdentity() const
     {
-        auto handle = GetProcessHandleFromPid(pid);
-        USHORT process = 0;
-        USHORT machine = 0;
-        winrt::check_bool(IsWow64Process2(handle.get(), &process, &machine));
-        archValue = process == IMAGE_FILE_MACHINE_UNKNOWN ? machine : process;
-
-        exeName = GetExectuablePathFromProcess(handle);
-
-        auto token = GetProcessToken(handle);
-        BOOL isAppContainer = FALSE;
-        DWORD length = 0;
-        winrt::check_bool(GetTokenInformation(token.get(), TokenIsAppContainer, &isAppContainer, sizeof(BOOL), &length));
-        WINRT_VERIFY(length == sizeof(BOOL));
-        if (isAppContainer)
+        return { Pid, CreationTime };
+    }
+
+    ProcessKey GetKey() const
+    {
+        return ProcessKey::From(Pid, CreationTime);
+    }
+
+    // Copies the given fields (and their errors) from another query of the
+    // same process and marks them as no longer pending
+    void ResolveFrom(Process const& other, ProcessFields fields)
+    {
+        if (HasAnyField(fields, ProcessFields::ExecutablePath))
         {
-            processType = std::optional(ProcessType::AppContainer);
+            ExecutablePath = other.ExecutablePath;
+            Errors.ExecutablePath = other.Errors.ExecutablePath;
         }
-        else
+        if (HasAnyField(fields, ProcessFields::Type))
         {
-            processType = std::optional(ProcessType::Legacy);
+            Type = other.Type;
+            Errors.Type = other.Errors.Type;
         }
-
-        ilevel = GetIntegrityLevelFromProcessToken(token);
-    }
-    catch (winrt::hresult_error const& error)
-    {
-        const auto code = error.code();
-        if (code == E_INVALIDARG)
+        if (HasAnyField(fields, ProcessFields::Architecture))
         {
-            return std::nullopt;
+            ArchitectureValue = other.ArchitectureValue;
+            Errors.Architecture = other.Errors.Architecture;
         }
-        if (code != E_ACCESSDENIED &&
-            code != HRESULT_FROM_WIN32(ERROR_NOACCESS))
+        if (HasAnyField(fields, ProcessFields::IntegrityLevel))
         {
-            throw;
+            IntegrityLevel = other.IntegrityLevel;
+            Errors.IntegrityLevel = other.Errors.IntegrityLevel;
         }
+        Pending = Pending & ~fields;
     }
-    return std::optional(Process{ pid, processName, exeName, processType, archValue, ilevel });
-}
+};
 
-inline std::optional<Process> CreateProcessFromProcessEntry(PROCESSENTRY32W const& entry)
+// A Process whose strings point elsewhere, e.g. into a ProcessEventSlot, so
+// it can be handed on (and interned) without allocating. Only valid while
+// what the strings point to is.
+struct ProcessView
 {
-    std::wstring processName(entry.szExeFile);
-    auto pid = entry.th32ProcessID;
-    return CreateProcessFromPid(pid, processName);
-}
+    uint32_t Pid;
+    uint64_t CreationTime;
+    std::wstring_view Name;
+    std::wstring_view ExecutablePath;
+    std::optional<ProcessType> Type;
+    uint16_t ArchitectureValue;
+    std::optional<::IntegrityLevel> IntegrityLevel;
+    ProcessQueryErrors Errors;
+    ProcessFields Pending;
 
-inline std::vector<Process> GetAllProcesses(bool keepInaccessible = true)
-{
-    std::vector<Process> result;
-    wil::unique_handle snapshot(winrt::check_pointer(CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0)));
-    PROCESSENTRY32W entry = {};
-    entry.dwSize = sizeof(entry);
+    ProcessKey GetKey() const
+    {
+        return ProcessKey::From(Pid, CreationTime);
+    }
 
-    if (Process32FirstW(snapshot.get(), &entry))
+    // Reuses the memory of process's strings
+    void AssignTo(Process& process) const
     {
-        do
-        {
-            if (auto process = CreateProcessFromProcessEntry(entry))
-            {
-                if (keepInaccessible || process->ArchitectureValue != IMAGE_FILE_MACHINE_UNKNOWN)
-                {
-                    result.push_back(*process);
-                }
-            }
-        } while (Process32NextW(snapshot.get(), &entry));
+        process.Pid = Pid;
+        process.CreationTime = CreationTime;
+        process.Name.assign(Name);
+        process.ExecutablePath.assign(ExecutablePath);
+        process.Type = Type;
+        process.ArchitectureValue = ArchitectureValue;
+        process.IntegrityLevel = IntegrityLevel;
+        process.Errors = Errors;
+        process.Pending = Pending;
     }
-    return result;
+};
+
+inline ProcessView GetProcessView(Process const& process)
+{
+    return { process.Pid, process.CreationTime, process.Name, process.ExecutablePath, process.Type, process.ArchitectureValue,
+        process.IntegrityLevel, process.Errors, process.Pending };
+}
+
+struct ProcessEntry
+{
+    uint32_t Pid;
+    std::wstring Name;
+    uint64_t CreationTime = 0;
+};
+
+// A process with only its identity and name, every other field pending
+inline Process CreatePendingProcess(ProcessEntry const& entry)
+{
+    return { entry.Pid, entry.CreationTime, entry.Name, std::wstring(), std::nullopt, IMAGE_FILE_MACHINE_UNKNOWN, std::nullopt, {}, ProcessFields::All };
 }
\ No newline at end of file
@@ -0,0 +1,662 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <optional>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "ProcessColumns.h"
+#include "ProcessEventPipeline.h"
+#include "ProcessListModel.h"
+#include "ProcessWatcherBackend.h"
+
+// Load testing for the watcher -> model path without a window or real
+// processes. A trace of process starts and exits (generated or recorded) is
+// replayed through a ProcessWatcherBackend into the same ProcessEventPipeline
+// the watcher uses, and the batches are applied to a ProcessListModel the way
+// the main window applies them. Everything here is portable so it can run
+// headless as a benchmark.
+
+enum class ChurnEventKind : uint8_t
+{
+    Started,
+    Exited,
+};
+
+struct ChurnEvent
+{
+    // Offset from the start of the trace
+    std::chrono::microseconds Time{ 0 };
+    ChurnEventKind Kind;
+    uint32_t Pid;
+    // Only set for starts
+    std::wstring Name;
+};
+
+struct ChurnGeneratorOptions
+{
+    double SpawnsPerSecond = 1000;
+    // Lifetimes are exponentially distributed around this
+    std::chrono::microseconds MeanLifetime{ 200'000 };
+    std::chrono::milliseconds Duration{ 1000 };
+    // Processes that exist from the start and live through the whole trace
+    size_t InitialProcesses = 300;
+    // Pids are handed out in increasing order and wrap around at this, so a
+    // small space reuses pids quickly. Unless GrowPidSpace is off, it is
+    // grown to four times the pids the rate keeps alive on average, so high
+    // rates don't run out.
+    uint32_t PidSpace = 32768;
+    uint32_t PidStep = 4;
+    bool GrowPidSpace = true;
+    size_t DistinctNames = 64;
+    uint32_t Seed = 1;
+};
+
+struct ChurnTraceStatistics
+{
+    // Starts in the trace, including the initial processes
+    uint64_t Starts = 0;
+    // Starts the generator dropped because every pid was taken, the trace
+    // has that much less churn than asked for
+    uint64_t DroppedStarts = 0;
+    uint32_t PidSpace = 0;
+};
+
+// Starts arrive as a Poisson process at the given rate. Pids are allocated
+// like the OS does, skipping pids that are still in use; a start is dropped
+// (and counted in statistics) if every pid is taken.
+inline std::vector<ChurnEvent> GenerateChurnTrace(ChurnGeneratorOptions const& options, ChurnTraceStatistics* statistics = nullptr)
+{
+    using namespace std::chrono;
+    std::mt19937_64 random(options.Seed);
+    std::exponential_distribution<double> interarrival(std::max(options.SpawnsPerSecond, 1e-9) / 1e6);
+    std::exponential_distribution<double> lifetime(1.0 / std::max<double>(static_cast<double>(options.MeanLifetime.count()), 1.0));
+
+    auto step = std::max<uint32_t>(options.PidStep, 1);
+    // Pids near UINT32_MAX are reserved by ProcessIdIndex
+    auto maxSlots = static_cast<double>((UINT32_MAX - 16) / step);
+    auto slots = std::max<uint32_t>(options.PidSpace / step, 1);
+    if (options.GrowPidSpace)
+    {
+        auto alive = static_cast<double>(options.InitialProcesses) +
+            std::max(options.SpawnsPerSecond, 0.0) * static_cast<double>(options.MeanLifetime.count()) / 1e6;
+        slots = std::max(slots, static_cast<uint32_t>(std::min(alive * 4, maxSlots)));
+    }
+    ChurnTraceStatistics traceStatistics;
+    traceStatistics.PidSpace = slots * step;
+    std::vector<bool> used(slots);
+    uint32_t nextSlot = 1;
+    auto allocatePid = [&]() -> std::optional<uint32_t>
+    {
+        for (uint32_t attempt = 0; attempt < slots; attempt++)
+        {
+            auto slot = nextSlot;
+            nextSlot = (nextSlot + 1) % slots;
+            if (!used[slot])
+            {
+                used[slot] = true;
+                return slot * step;
+            }
+        }
+        return std::nullopt;
+    };
+    auto nameOf = [&](size_t index)
+    {
+        return L"churn" + std::to_wstring(index % std::max<size_t>(options.DistinctNames, 1)) + L".exe";
+    };
+
+    std::vector<ChurnEvent> events;
+    size_t spawned = 0;
+    for (size_t i = 0; i < options.InitialProcesses; i++)
+    {
+        if (auto pid = allocatePid())
+        {
+            events.push_back({ microseconds(0), ChurnEventKind::Started, *pid, nameOf(spawned++) });
+            traceStatistics.Starts++;
+        }
+        else
+        {
+            traceStatistics.DroppedStarts++;
+        }
+    }
+
+    using PendingExit = std::pair<int64_t, uint32_t>;
+    std::priority_queue<PendingExit, std::vector<PendingExit>, std::greater<PendingExit>> exits;
+    auto end = duration_cast<microseconds>(options.Duration).count();
+    auto emitExitsUntil = [&](int64_t time)
+    {
+        while (!exits.empty() && exits.top().first <= time)
+        {
+            auto [exitTime, pid] = exits.top();
+            exits.pop();
+            used[pid / step] = false;
+            events.push_back({ microseconds(exitTime), ChurnEventKind::Exited, pid, {} });
+        }
+    };
+
+    double now = 0;
+    while (true)
+    {
+        now += interarrival(random);
+        auto time = static_cast<int64_t>(now);
+        if (time > end)
+        {
+            break;
+        }
+        emitExitsUntil(time);
+        if (auto pid = allocatePid())
+        {
+            events.push_back({ microseconds(time), ChurnEventKind::Started, *pid, nameOf(spawned++) });
+            exits.push({ time + static_cast<int64_t>(lifetime(random)), *pid });
+            traceStatistics.Starts++;
+        }
+        else
+        {
+            traceStatistics.DroppedStarts++;
+        }
+    }
+    emitExitsUntil(end);
+    if (statistics)
+    {
+        *statistics = traceStatistics;
+    }
+    return events;
+}
+
+// One event per line, "<microseconds> + <pid> <name>" for a start and
+// "<microseconds> - <pid>" for an exit. Lines that don't parse are skipped.
+inline void WriteChurnTrace(std::wostream& stream, std::vector<ChurnEvent> const& events)
+{
+    for (auto&& event : events)
+    {
+        stream << event.Time.count() << (event.Kind == ChurnEventKind::Started ? L" + " : L" - ") << event.Pid;
+        if (event.Kind == ChurnEventKind::Started)
+        {
+            stream << L' ' << event.Name;
+        }
+        stream << L'\n';
+    }
+}
+
+inline std::vector<ChurnEvent> ReadChurnTrace(std::wistream& stream)
+{
+    std::vector<ChurnEvent> events;
+    std::wstring line;
+    while (std::getline(stream, line))
+    {
+        std::wistringstream fields(line);
+        int64_t time = 0;
+        wchar_t kind = 0;
+        uint32_t pid = 0;
+        if (!(fields >> time >> kind >> pid) || (kind != L'+' && kind != L'-'))
+        {
+            continue;
+        }
+        ChurnEvent event = { std::chrono::microseconds(time), kind == L'+' ? ChurnEventKind::Started : ChurnEventKind::Exited, pid, {} };
+        if (event.Kind == ChurnEventKind::Started)
+        {
+            fields >> std::ws;
+            std::getline(fields, event.Name);
+        }
+        events.push_back(std::move(event));
+    }
+    return events;
+}
+
+// Answers queries for the processes a replay says are alive, taking a fixed
+// amount of time per query to stand in for the real OS calls.
+class SyntheticProcessSource : public ProcessSource
+{
+public:
+    explicit SyntheticProcessSource(std::chrono::microseconds queryLatency) : m_queryLatency(queryLatency)
+    {
+    }
+
+    void OnStarted(ProcessEntry const& entry)
+    {
+        std::scoped_lock lock(m_lock);
+        m_alive.insert_or_assign(entry.Pid, entry);
+    }
+
+    void OnExited(uint32_t pid)
+    {
+        std::scoped_lock lock(m_lock);
+        m_alive.erase(pid);
+    }
+
+    std::vector<ProcessEntry> EnumerateProcesses() override
+    {
+        std::vector<ProcessEntry> entries;
+        std::scoped_lock lock(m_lock);
+        entries.reserve(m_alive.size());
+        for (auto&& [pid, entry] : m_alive)
+        {
+            entries.push_back(entry);
+        }
+        return entries;
+    }
+
+    // Like the real sources, entries that don't say when the process started
+    // get whichever process has the pid now
+    uint64_t QueryCreationTime(ProcessEntry const& entry) override
+    {
+        if (entry.CreationTime != 0)
+        {
+            return entry.CreationTime;
+        }
+        std::scoped_lock lock(m_lock);
+        auto search = m_alive.find(entry.Pid);
+        return search != m_alive.end() ? search->second.CreationTime : 0;
+    }
+
+protected:
+    QueryResult<Process> TryEnrichProcess(ProcessEntry const& entry, ProcessFields fields) override
+    {
+        if (m_queryLatency.count() > 0)
+        {
+            std::this_thread::sleep_for(m_queryLatency);
+        }
+        {
+            std::scoped_lock lock(m_lock);
+            auto search = m_alive.find(entry.Pid);
+            if (search == m_alive.end() || search->second.CreationTime != entry.CreationTime)
+            {
+                return QueryError::ProcessExited;
+            }
+        }
+
+        auto process = CreatePendingProcess(entry);
+        if (HasAnyField(fields, ProcessFields::ExecutablePath))
+        {
+            process.ExecutablePath = L"/synthetic/" + entry.Name;
+        }
+        if (HasAnyField(fields, ProcessFields::Type))
+        {
+            process.Type = ProcessType::Legacy;
+        }
+        if (HasAnyField(fields, ProcessFields::Architecture))
+        {
+            process.ArchitectureValue = IMAGE_FILE_MACHINE_AMD64;
+        }
+        if (HasAnyField(fields, ProcessFields::IntegrityLevel))
+        {
+            process.IntegrityLevel = IntegrityLevel::Medium;
+        }
+        return process;
+    }
+
+private:
+    std::chrono::microseconds m_queryLatency;
+    std::mutex m_lock;
+    std::unordered_map<uint32_t, ProcessEntry> m_alive;
+};
+
+// Replays a trace on its own thread, keeping the source's view of what is
+// alive in step. speed scales the trace's clock (2 replays twice as fast),
+// 0 replays as fast as the pipeline takes it. A started process's creation
+// time is the microsecond (since Start, plus one so it is never 0) it was
+// handed to the pipeline, which lets the consumer measure lag.
+class ChurnReplayBackend : public ProcessWatcherBackend
+{
+public:
+    ChurnReplayBackend(std::vector<ChurnEvent> events, SyntheticProcessSource& source, double speed = 1.0)
+        : m_events(std::move(events)), m_source(&source), m_speed(speed)
+    {
+    }
+
+    ~ChurnReplayBackend() override
+    {
+        Stop();
+    }
+
+    void Start(ProcessStartedCallback started, ProcessExitedCallback exited) override
+    {
+        m_processStarted = std::move(started);
+        m_processExited = std::move(exited);
+        m_start = std::chrono::steady_clock::now();
+        m_thread = std::thread([this]() { Run(); });
+    }
+
+    void Stop() override
+    {
+        if (m_thread.joinable())
+        {
+            m_stopping = true;
+            m_thread.join();
+        }
+    }
+
+    bool IsFinished() const
+    {
+        return m_finished.load(std::memory_order_acquire);
+    }
+
+    std::chrono::steady_clock::time_point StartTime() const
+    {
+        return m_start;
+    }
+
+    // How far behind the trace's schedule the replay got, i.e. how long the
+    // pipeline kept the event thread busy
+    std::chrono::microseconds GetMaxLateness() const
+    {
+        return std::chrono::microseconds(m_maxLateness.load(std::memory_order_relaxed));
+    }
+
+private:
+    void Run()
+    {
+        using namespace std::chrono;
+        for (auto&& event : m_events)
+        {
+            if (m_stopping)
+            {
+                break;
+            }
+            if (m_speed > 0)
+            {
+                auto due = m_start + duration_cast<steady_clock::duration>(duration<double, std::micro>(static_cast<double>(event.Time.count()) / m_speed));
+                auto now = steady_clock::now();
+                if (now < due)
+                {
+                    std::this_thread::sleep_until(due);
+                }
+                else
+                {
+                    auto lateness = duration_cast<microseconds>(now - due).count();
+                    if (lateness > m_maxLateness.load(std::memory_order_relaxed))
+                    {
+                        m_maxLateness.store(lateness, std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            if (event.Kind == ChurnEventKind::Started)
+            {
+                auto elapsed = duration_cast<microseconds>(steady_clock::now() - m_start).count();
+                ProcessEntry entry = { event.Pid, event.Name, static_cast<uint64_t>(elapsed) + 1 };
+                m_creationTimes.insert_or_assign(entry.Pid, entry.CreationTime);
+                m_source->OnStarted(entry);
+                m_processStarted(std::move(entry));
+            }
+            else
+            {
+                auto search = m_creationTimes.find(event.Pid);
+                auto creationTime = search != m_creationTimes.end() ? search->second : 0;
+                if (search != m_creationTimes.end())
+                {
+                    m_creationTimes.erase(search);
+                }
+                m_source->OnExited(event.Pid);
+                m_processExited(ProcessKey::From(event.Pid, creationTime), {});
+            }
+        }
+        m_finished.store(true, std::memory_order_release);
+    }
+
+private:
+    std::vector<ChurnEvent> m_events;
+    SyntheticProcessSource* m_source = nullptr;
+    double m_speed = 1.0;
+    ProcessStartedCallback m_processStarted;
+    ProcessExitedCallback m_processExited;
+    // Of the processes started so far that are still running, so exits can
+    // name them by key
+    std::unordered_map<uint32_t, uint64_t> m_creationTimes;
+    std::chrono::steady_clock::time_point m_start;
+    std::atomic<int64_t> m_maxLateness = 0;
+    std::atomic<bool> m_stopping = false;
+    std::atomic<bool> m_finished = false;
+    std::thread m_thread;
+};
+
+struct ChurnHarnessOptions
+{
+    // See ChurnReplayBackend
+    double Speed = 1.0;
+    // Time each synthetic process query takes
+    std::chrono::microseconds QueryLatency{ 50 };
+    std::chrono::milliseconds BatchWindow{ 50 };
+    EnrichmentOverflowPolicy Policy = EnrichmentOverflowPolicy::DegradeToIdentity;
+    size_t WorkerCount = ProcessEnrichmentStage::DefaultWorkerCount;
+    size_t Capacity = ProcessEnrichmentStage::DefaultCapacity;
+    // A run keeps up if no process takes longer than this to reach the
+    // model and the replay never falls further behind than this
+    std::chrono::milliseconds LagBudget{ 250 };
+};
+
+struct ChurnReport
+{
+    uint64_t Events = 0;
+    // Starts replayed after the initial processes, per second of trace time
+    uint64_t Starts = 0;
+    double StartsPerSecond = 0;
+    uint64_t Batches = 0;
+    std::chrono::microseconds Elapsed{ 0 };
+    // Trace events per second of wall time
+    double EventsPerSecond = 0;
+    // From a start being reported to the process being in the model
+    std::chrono::microseconds AverageLag{ 0 };
+    std::chrono::microseconds MaxLag{ 0 };
+    std::chrono::microseconds MaxReplayLateness{ 0 };
+    std::chrono::microseconds MaxApplyTime{ 0 };
+    size_t PeakQueueDepth = 0;
+    size_t PeakRows = 0;
+    size_t FinalRows = 0;
+    // Of the model's table, columns and interned strings
+    size_t PeakModelMemory = 0;
+    EnrichmentStageStatistics Enrichment;
+    ProcessEventCoalescerStatistics Coalescing;
+    ProcessEventRingStatistics Ring;
+    bool KeptUp = false;
+};
+
+// Replays the trace through the pipeline and applies each batch to a model
+// sorted by pid. Blocks until every event has been replayed and applied.
+inline ChurnReport RunChurnHarness(std::vector<ChurnEvent> events, ChurnHarnessOptions const& options = {})
+{
+    using namespace std::chrono;
+    ChurnReport report;
+    report.Events = events.size();
+    microseconds traceDuration{ 0 };
+    for (auto&& event : events)
+    {
+        traceDuration = std::max(traceDuration, event.Time);
+        if (event.Kind == ChurnEventKind::Started && event.Time.count() > 0)
+        {
+            report.Starts++;
+        }
+    }
+    if (traceDuration.count() > 0)
+    {
+        report.StartsPerSecond = static_cast<double>(report.Starts) * 1e6 / static_cast<double>(traceDuration.count());
+    }
+
+    SyntheticProcessSource source(options.QueryLatency);
+    ProcessMetadataCache cache;
+    ProcessListModel model;
+
+    std::mutex lock;
+    std::condition_variable drainNeeded;
+    bool drainPending = false;
+    ProcessEventPipeline pipeline(source, cache, ProcessEventPipeline::DrainNeededCallback([&]()
+        {
+            {
+                std::scoped_lock guard(lock);
+                drainPending = true;
+            }
+            drainNeeded.notify_one();
+        }), options.Policy, options.WorkerCount, options.Capacity);
+
+    ChurnReplayBackend backend(std::move(events), source, options.Speed);
+    backend.Start(
+        ProcessWatcherBackend::ProcessStartedCallback([&](ProcessEntry entry)
+        {
+            pipeline.OnProcessStarted(std::move(entry));
+        }),
+        ProcessWatcherBackend::ProcessExitedCallback([&](ProcessKey key, std::wstring_view name)
+        {
+            pipeline.OnProcessExited(key, name);
+        }));
+
+    microseconds totalLag{ 0 };
+    uint64_t lagged = 0;
+    auto apply = [&](ProcessEventBatch const& batch)
+    {
+        auto applyStart = steady_clock::now();
+        std::vector<uint32_t> removedRows;
+        removedRows.reserve(batch.Removed.size());
+        for (size_t i = 0; i < batch.Removed.size(); i++)
+        {
+            if (auto row = model.FindRowForExit(batch.Removed[i], batch.RemovedName(i)))
+            {
+                removedRows.push_back(*row);
+            }
+        }
+        model.ApplyChanges(removedRows, batch.Added, ColumnLess<PidColumn, false>{ model.Table() });
+        auto applied = steady_clock::now();
+
+        auto sinceStart = duration_cast<microseconds>(applied - backend.StartTime());
+        for (auto&& process : batch.Added)
+        {
+            auto lag = sinceStart - microseconds(process.CreationTime - 1);
+            totalLag += lag;
+            lagged++;
+            report.MaxLag = std::max(report.MaxLag, lag);
+        }
+        report.Batches++;
+        report.MaxApplyTime = std::max(report.MaxApplyTime, duration_cast<microseconds>(applied - applyStart));
+        report.PeakRows = std::max(report.PeakRows, model.size());
+        report.PeakModelMemory = std::max(report.PeakModelMemory, model.Table().GetMemoryUsage());
+    };
+
+    // Stands in for the watcher's dispatcher queue: drain whenever woken,
+    // and once the first event of a batch is in, let the window pass and
+    // take whatever has accumulated
+    auto isIdle = [&]()
+    {
+        auto statistics = pipeline.GetEnrichmentStatistics();
+        return backend.IsFinished() && statistics.QueueDepth == 0 &&
+            statistics.Submitted == statistics.Enriched + statistics.Degraded + statistics.Dropped;
+    };
+    std::optional<steady_clock::time_point> flushTime;
+    while (true)
+    {
+        {
+            std::unique_lock guard(lock);
+            drainNeeded.wait_until(guard, flushTime.value_or(steady_clock::now() + options.BatchWindow), [&]() { return drainPending; });
+            drainPending = false;
+        }
+        if (pipeline.Drain())
+        {
+            flushTime = steady_clock::now() + options.BatchWindow;
+        }
+        if (flushTime && steady_clock::now() >= *flushTime)
+        {
+            flushTime.reset();
+            auto batch = pipeline.TakeBatch();
+            if (!batch.empty())
+            {
+                apply(batch);
+            }
+            pipeline.Recycle(std::move(batch));
+        }
+        else if (!flushTime && isIdle())
+        {
+            // Anything delivered since the last drain
+            if (auto last = pipeline.TakeBatch(); !last.empty())
+            {
+                apply(last);
+            }
+            break;
+        }
+    }
+    backend.Stop();
+
+    report.Elapsed = duration_cast<microseconds>(steady_clock::now() - backend.StartTime());
+    report.EventsPerSecond = report.Elapsed.count() > 0 ? static_cast<double>(report.Events) * 1e6 / static_cast<double>(report.Elapsed.count()) : 0;
+    if (lagged > 0)
+    {
+        report.AverageLag = totalLag / lagged;
+    }
+    report.MaxReplayLateness = backend.GetMaxLateness();
+    report.FinalRows = model.size();
+    report.Enrichment = pipeline.GetEnrichmentStatistics();
+    report.PeakQueueDepth = report.Enrichment.PeakQueueDepth;
+    report.Coalescing = pipeline.GetStatistics();
+    report.Ring = pipeline.GetRingStatistics();
+    report.KeptUp = report.MaxLag <= options.LagBudget && report.MaxReplayLateness <= options.LagBudget;
+    return report;
+}
+
+struct SustainedRateResult
+{
+    // Measured from the starts the best run replayed, not the rate asked for
+    double SpawnsPerSecond = 0;
+    // The search ran into its cap without falling behind, so the real
+    // sustained rate is at least the cap
+    bool ReachedCap = false;
+    // The run at that rate
+    ChurnReport Report;
+    ChurnTraceStatistics Trace;
+};
+
+// Finds the highest spawn rate that keeps up, by doubling the generator's
+// rate until a run falls behind and then bisecting between the last rate
+// that kept up and the first that didn't. A run whose trace had to drop
+// starts counts as falling behind, as it didn't see the rate it was given.
+// Returns a rate of 0 if even the starting rate falls behind.
+inline SustainedRateResult FindMaxSustainedRate(ChurnGeneratorOptions generator, ChurnHarnessOptions const& options = {},
+    double maxSpawnsPerSecond = 1'000'000, size_t refinements = 4)
+{
+    SustainedRateResult best;
+    auto low = 0.0;
+    auto high = 0.0;
+    auto tryRate = [&](double rate)
+    {
+        generator.SpawnsPerSecond = rate;
+        ChurnTraceStatistics trace;
+        auto report = RunChurnHarness(GenerateChurnTrace(generator, &trace), options);
+        if (!report.KeptUp || trace.DroppedStarts > 0)
+        {
+            high = rate;
+            return false;
+        }
+        low = rate;
+        best = { report.StartsPerSecond, false, std::move(report), trace };
+        return true;
+    };
+
+    for (auto rate = std::min(std::max(generator.SpawnsPerSecond, 1.0), maxSpawnsPerSecond);; rate = std::min(rate * 2, maxSpawnsPerSecond))
+    {
+        if (!tryRate(rate))
+        {
+            break;
+        }
+        if (rate >= maxSpawnsPerSecond)
+        {
+            best.ReachedCap = true;
+            return best;
+        }
+    }
+    if (low == 0)
+    {
+        return best;
+    }
+
+    for (size_t i = 0; i < refinements; i++)
+    {
+        tryRate((low + high) / 2);
+    }
+    return best;
+}
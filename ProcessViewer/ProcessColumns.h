@@ -0,0 +1,236 @@
+#pragma once
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include "CellText.h"
+#include "ProcessTable.h"
+#include "SortKeys.h"
+
+// Each column of the process list is described by a type with:
+//   Id       - the ProcessInformation value naming the column
+//   Header   - the column header text
+//   Fields   - the lazily queried fields the column shows and sorts by
+//   Cached   - whether its formatted text is kept in the cell cache
+//   SortKey  - the row's value as an unsigned integer whose order is the
+//              column's sort order (unknown values first, rows still
+//              waiting for Fields go after all of them)
+//   Compare  - three way comparison of two rows by the column value
+//   Format   - writes the row's display text into a CellWriter
+// Everything that depends on the column is written against these members,
+// so adding a column only needs a new descriptor in ProcessColumns.
+
+inline int CompareSortKeys(uint32_t left, uint32_t right)
+{
+    return left < right ? -1 : (left > right ? 1 : 0);
+}
+
+struct PidColumn
+{
+    static constexpr ProcessInformation Id = ProcessInformation::Pid;
+    static constexpr std::wstring_view Header = L"Pid";
+    static constexpr ProcessFields Fields = ProcessFields::None;
+    static constexpr bool Cached = true;
+
+    static uint32_t SortKey(ProcessTable const&, uint32_t, FoldedStringRanks const&)
+    {
+        // The pid is the tie-breaker in every sort key already
+        return 0;
+    }
+
+    static int Compare(ProcessTable const&, uint32_t, uint32_t)
+    {
+        return 0;
+    }
+
+    static void Format(CellWriter& writer, ProcessTable const& table, uint32_t row)
+    {
+        writer.AppendUnsigned(table.Pid(row));
+    }
+};
+
+struct NameColumn
+{
+    static constexpr ProcessInformation Id = ProcessInformation::Name;
+    static constexpr std::wstring_view Header = L"Name";
+    static constexpr ProcessFields Fields = ProcessFields::None;
+    // The text is the name in the table's string pool, so caching it in the
+    // cell cache would only be a second copy
+    static constexpr bool Cached = false;
+
+    static uint32_t SortKey(ProcessTable const& table, uint32_t row, FoldedStringRanks const& names)
+    {
+        return names.GetRank(table.NameId(row));
+    }
+
+    static int Compare(ProcessTable const& table, uint32_t left, uint32_t right)
+    {
+        return CompareIgnoreCase(table.Name(left), table.Name(right));
+    }
+
+    static void Format(CellWriter& writer, ProcessTable const& table, uint32_t row)
+    {
+        writer.Append(table.Name(row));
+    }
+};
+
+struct TypeColumn
+{
+    static constexpr ProcessInformation Id = ProcessInformation::Type;
+    static constexpr std::wstring_view Header = L"Type";
+    static constexpr ProcessFields Fields = ProcessFields::Type;
+    static constexpr bool Cached = true;
+
+    static uint32_t SortKey(ProcessTable const& table, uint32_t row, FoldedStringRanks const&)
+    {
+        return GetValue(table, row);
+    }
+
+    static int Compare(ProcessTable const& table, uint32_t left, uint32_t right)
+    {
+        return CompareSortKeys(GetValue(table, left), GetValue(table, right));
+    }
+
+    static void Format(CellWriter& writer, ProcessTable const& table, uint32_t row)
+    {
+        writer.Append(table.Type(row));
+    }
+
+private:
+    static uint32_t GetValue(ProcessTable const& table, uint32_t row)
+    {
+        auto type = table.Type(row);
+        return type.has_value() ? static_cast<uint32_t>(*type) + 1 : 0;
+    }
+};
+
+struct ArchitectureColumn
+{
+    static constexpr ProcessInformation Id = ProcessInformation::Architecture;
+    static constexpr std::wstring_view Header = L"Architecture";
+    static constexpr ProcessFields Fields = ProcessFields::Architecture;
+    static constexpr bool Cached = true;
+
+    static uint32_t SortKey(ProcessTable const& table, uint32_t row, FoldedStringRanks const&)
+    {
+        return table.ArchitectureValue(row);
+    }
+
+    static int Compare(ProcessTable const& table, uint32_t left, uint32_t right)
+    {
+        return CompareSortKeys(table.ArchitectureValue(left), table.ArchitectureValue(right));
+    }
+
+    static void Format(CellWriter& writer, ProcessTable const& table, uint32_t row)
+    {
+        writer.Append(table.GetArchitecture(row));
+    }
+};
+
+struct IntegrityLevelColumn
+{
+    static constexpr ProcessInformation Id = ProcessInformation::IntegrityLevel;
+    static constexpr std::wstring_view Header = L"Integrity Level";
+    static constexpr ProcessFields Fields = ProcessFields::IntegrityLevel;
+    static constexpr bool Cached = true;
+
+    static uint32_t SortKey(ProcessTable const& table, uint32_t row, FoldedStringRanks const&)
+    {
+        return GetValue(table, row);
+    }
+
+    static int Compare(ProcessTable const& table, uint32_t left, uint32_t right)
+    {
+        return CompareSortKeys(GetValue(table, left), GetValue(table, right));
+    }
+
+    static void Format(CellWriter& writer, ProcessTable const& table, uint32_t row)
+    {
+        writer.Append(table.IntegrityLevel(row));
+    }
+
+private:
+    static uint32_t GetValue(ProcessTable const& table, uint32_t row)
+    {
+        auto ilevel = table.IntegrityLevel(row);
+        return ilevel.has_value() ? static_cast<uint32_t>(*ilevel) + 1 : 0;
+    }
+};
+
+using ProcessColumns = std::tuple<
+    NameColumn,
+    PidColumn,
+    TypeColumn,
+    ArchitectureColumn,
+    IntegrityLevelColumn>;
+
+// Calls func with the descriptor (a default constructed instance, use
+// decltype to get at the type) of the given column. This is the only
+// runtime dispatch on the column, anything called from func is
+// specialized for the column.
+template <typename TFunc, size_t Index = 0>
+inline decltype(auto) VisitColumn(ProcessInformation column, TFunc&& func)
+{
+    using TColumn = std::tuple_element_t<Index, ProcessColumns>;
+    if constexpr (Index + 1 == std::tuple_size_v<ProcessColumns>)
+    {
+        // Every ProcessInformation value has a descriptor
+        return func(TColumn{});
+    }
+    else
+    {
+        if (column == TColumn::Id)
+        {
+            return func(TColumn{});
+        }
+        return VisitColumn<TFunc, Index + 1>(column, std::forward<TFunc>(func));
+    }
+}
+
+inline std::wstring_view GetColumnHeader(ProcessInformation column)
+{
+    return VisitColumn(column, [](auto descriptor)
+        {
+            return decltype(descriptor)::Header;
+        });
+}
+
+inline bool IsSortValuePending(ProcessTable const& table, uint32_t row, ProcessFields fields)
+{
+    return fields != ProcessFields::None && HasAnyField(table.PendingFields(row), fields);
+}
+
+// Orders rows by a column and then by pid, with the direction fixed at
+// compile time so the comparison inlines into the sort. Rows whose value
+// hasn't been queried yet go last in either direction, and are moved into
+// place once it comes in.
+template <typename TColumn, bool Descending>
+struct ColumnLess
+{
+    ProcessTable const& Table;
+
+    bool operator()(uint32_t left, uint32_t right) const
+    {
+        auto leftPending = IsSortValuePending(Table, left, TColumn::Fields);
+        auto rightPending = IsSortValuePending(Table, right, TColumn::Fields);
+        if (leftPending != rightPending)
+        {
+            return rightPending;
+        }
+        auto value = leftPending ? 0 : TColumn::Compare(Table, left, right);
+        if (value == 0)
+        {
+            value = CompareSortKeys(Table.Pid(left), Table.Pid(right));
+        }
+        return Descending ? value > 0 : value < 0;
+    }
+};
+
+template <typename TColumn>
+inline uint64_t GetRowSortKey(ProcessTable const& table, uint32_t row, FoldedStringRanks const& names, bool descending)
+{
+    if (IsSortValuePending(table, row, TColumn::Fields))
+    {
+        return MakePendingSortKey(table.Pid(row), descending);
+    }
+    return MakeSortKey(TColumn::SortKey(table, row, names), table.Pid(row), descending);
+}
@@ -0,0 +1,259 @@
+#pragma once
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "BoundedWorkerPool.h"
+#include "ProcessIdIndex.h"
+#include "ProcessSource.h"
+
+enum class EnrichmentOverflowPolicy
+{
+    // The event source waits until there is room in the queue
+    Wait,
+    // The process is delivered right away with just its identity and name,
+    // every other field is left pending to be resolved later
+    DegradeToIdentity,
+};
+
+struct EnrichmentStageStatistics
+{
+    uint64_t Submitted = 0;
+    uint64_t Enriched = 0;
+    // Delivered identity-only because the queue was full
+    uint64_t Degraded = 0;
+    // Exited before (or while) they were enriched
+    uint64_t Dropped = 0;
+    // Exits of an earlier process with a pid that was already reused by the
+    // time they arrived, which left the new process alone
+    uint64_t StaleExits = 0;
+    size_t QueueDepth = 0;
+    size_t PeakQueueDepth = 0;
+    // From the event being submitted to its enriched process being delivered
+    std::chrono::microseconds AverageLatency{ 0 };
+    std::chrono::microseconds MaxLatency{ 0 };
+};
+
+// Enriches newly started processes on a bounded worker pool so that the
+// thread delivering process events (e.g. the WMI sink) never waits on slow
+// token or image path queries. Exits are reported with Cancel, which makes
+// sure a process that exits before it is delivered is never delivered at
+// all. Only the process the exit names is cancelled (see ExitMatches): when
+// the pid has been reused since, the exit is ignored, and when the
+// submission's creation time isn't known yet the decision waits until it has
+// been queried.
+//
+// The callback is called from a worker thread (or the submitting thread for
+// degraded processes) and must be quick, exits wait for it.
+class ProcessEnrichmentStage
+{
+public:
+    using EnrichedCallback = std::function<void(Process)>;
+
+    static constexpr size_t DefaultWorkerCount = 2;
+    static constexpr size_t DefaultCapacity = 1024;
+
+    ProcessEnrichmentStage(ProcessSource& source, ProcessMetadataCache& cache, EnrichedCallback enriched,
+        EnrichmentOverflowPolicy policy = EnrichmentOverflowPolicy::DegradeToIdentity,
+        size_t workerCount = DefaultWorkerCount, size_t capacity = DefaultCapacity)
+        : m_source(&source), m_cache(&cache), m_enriched(std::move(enriched)), m_policy(policy),
+        m_pool(workerCount, capacity, [this](Item& item) { Enrich(item); })
+    {
+        // Every queued or running submission is pending, so this many slots
+        // only run out when producers race
+        m_pendingSlots.reserve(m_pool.Capacity() + workerCount + 1);
+        m_freePendingSlots.reserve(m_pendingSlots.capacity());
+    }
+
+    void Submit(ProcessEntry entry)
+    {
+        uint64_t sequence = 0;
+        {
+            std::scoped_lock lock(m_deliveryLock);
+            sequence = ++m_submitted;
+            SetPending(entry.Pid, Pending{ sequence, entry.CreationTime, HashProcessName(entry.Name), false, {} });
+        }
+        Item item = { entry, sequence, std::chrono::steady_clock::now() };
+        auto policy = m_policy == EnrichmentOverflowPolicy::Wait ? OverflowPolicy::Block : OverflowPolicy::Reject;
+        if (!m_pool.Submit(std::move(item), policy))
+        {
+            std::scoped_lock lock(m_deliveryLock);
+            if (auto pending = TakePending(entry.Pid, sequence))
+            {
+                // Without a query there is no creation time to check an exit
+                // against, so any exit for the pid counts
+                if (pending->Exited)
+                {
+                    m_dropped++;
+                    return;
+                }
+                m_degraded++;
+                m_enriched(CreatePendingProcess(entry));
+            }
+        }
+    }
+
+    // Called when a process exits, with the name the exit came with if any.
+    // If it hasn't been delivered yet it never will be.
+    void Cancel(ProcessKey key, std::wstring_view name = {})
+    {
+        std::scoped_lock lock(m_deliveryLock);
+        auto slot = m_pendingIndex.Find(key.Pid());
+        if (!slot)
+        {
+            return;
+        }
+        auto& pending = m_pendingSlots[*slot];
+        auto sameName = !name.empty() && HashProcessName(name) == pending.NameHash;
+        if (!sameName && !ProcessKey::From(key.Pid(), pending.CreationTime).Matches(key))
+        {
+            m_staleExits++;
+            return;
+        }
+        if (!sameName && pending.CreationTime == 0 && key.Generation() != 0)
+        {
+            // Can't tell yet, Enrich decides once it knows the creation time
+            pending.Exited = true;
+            pending.ExitKey = key;
+            return;
+        }
+        m_dropped++;
+        m_pool.RemoveIf([sequence = pending.Sequence](Item const& item) { return item.Sequence == sequence; });
+        ErasePending(key.Pid(), *slot);
+    }
+
+    EnrichmentStageStatistics GetStatistics()
+    {
+        EnrichmentStageStatistics statistics;
+        statistics.QueueDepth = m_pool.QueueDepth();
+        statistics.PeakQueueDepth = m_pool.PeakQueueDepth();
+        std::scoped_lock lock(m_deliveryLock);
+        statistics.Submitted = m_submitted;
+        statistics.Enriched = m_enrichedCount;
+        statistics.Degraded = m_degraded;
+        statistics.Dropped = m_dropped;
+        statistics.StaleExits = m_staleExits;
+        statistics.MaxLatency = m_maxLatency;
+        if (m_enrichedCount > 0)
+        {
+            statistics.AverageLatency = m_totalLatency / m_enrichedCount;
+        }
+        return statistics;
+    }
+
+private:
+    struct Item
+    {
+        ProcessEntry Entry;
+        uint64_t Sequence;
+        std::chrono::steady_clock::time_point Submitted;
+    };
+
+    struct Pending
+    {
+        uint64_t Sequence;
+        // 0 if the event didn't come with one
+        uint64_t CreationTime;
+        // Of the name it was submitted with, see HashProcessName
+        uint64_t NameHash;
+        // An exit arrived that may or may not be for this process
+        bool Exited = false;
+        ProcessKey ExitKey;
+    };
+
+    // Replaces the pid's earlier submission, if any
+    void SetPending(uint32_t pid, Pending pending)
+    {
+        if (auto slot = m_pendingIndex.Find(pid))
+        {
+            m_pendingSlots[*slot] = pending;
+            return;
+        }
+        uint32_t slot = 0;
+        if (!m_freePendingSlots.empty())
+        {
+            slot = m_freePendingSlots.back();
+            m_freePendingSlots.pop_back();
+            m_pendingSlots[slot] = pending;
+        }
+        else
+        {
+            slot = static_cast<uint32_t>(m_pendingSlots.size());
+            m_pendingSlots.push_back(pending);
+        }
+        m_pendingIndex.Insert(pid, slot);
+    }
+
+    void ErasePending(uint32_t pid, uint32_t slot)
+    {
+        m_pendingIndex.Erase(pid, slot);
+        m_freePendingSlots.push_back(slot);
+    }
+
+    // Pids can be reused, so a submission only counts as pending if it is
+    // still the latest one for its pid
+    std::optional<Pending> TakePending(uint32_t pid, uint64_t sequence)
+    {
+        auto slot = m_pendingIndex.Find(pid);
+        if (!slot || m_pendingSlots[*slot].Sequence != sequence)
+        {
+            return std::nullopt;
+        }
+        auto pending = m_pendingSlots[*slot];
+        ErasePending(pid, *slot);
+        return pending;
+    }
+
+    void Enrich(Item& item)
+    {
+        auto process = EnrichProcess(*m_source, *m_cache, item.Entry);
+
+        std::scoped_lock lock(m_deliveryLock);
+        auto pending = TakePending(item.Entry.Pid, item.Sequence);
+        if (!pending)
+        {
+            // Exited while we were querying it
+            return;
+        }
+        if (!process.has_value() || (pending->Exited && pending->ExitKey.Matches(process->GetKey())))
+        {
+            m_dropped++;
+            return;
+        }
+        if (pending->Exited)
+        {
+            m_staleExits++;
+        }
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - item.Submitted);
+        m_enrichedCount++;
+        m_totalLatency += latency;
+        m_maxLatency = std::max(m_maxLatency, latency);
+        m_enriched(std::move(*process));
+    }
+
+private:
+    ProcessSource* m_source = nullptr;
+    ProcessMetadataCache* m_cache = nullptr;
+    EnrichedCallback m_enriched;
+    EnrichmentOverflowPolicy m_policy;
+
+    // Guards delivery so that an exit can't slip in between a process being
+    // enriched and it being handed to the callback
+    std::mutex m_deliveryLock;
+    // Pid -> slot of the submission that hasn't been delivered or cancelled
+    // yet. The slots are reused, so tracking them doesn't allocate with
+    // steady churn (the entries and processes passing through still do).
+    ProcessIdIndex m_pendingIndex;
+    std::vector<Pending> m_pendingSlots;
+    std::vector<uint32_t> m_freePendingSlots;
+    uint64_t m_submitted = 0;
+    uint64_t m_enrichedCount = 0;
+    uint64_t m_degraded = 0;
+    uint64_t m_dropped = 0;
+    uint64_t m_staleExits = 0;
+    std::chrono::microseconds m_totalLatency{ 0 };
+    std::chrono::microseconds m_maxLatency{ 0 };
+
+    // Last, so the workers are stopped before anything they use goes away
+    BoundedWorkerPool<Item> m_pool;
+};
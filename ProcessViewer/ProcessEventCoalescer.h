@@ -0,0 +1,161 @@
+#pragma once
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "Process.h"
+#include "ProcessIdIndex.h"
+
+// Process changes to apply to the list in one go. Removals are applied
+// before additions, so a pid that exits and is reused within the same batch
+// ends up as the new process. A removal only applies to the process its key
+// (or name) matches, see ProcessListModel::FindRowForExit.
+struct ProcessEventBatch
+{
+    std::vector<ProcessKey> Removed;
+    // The names removals came with, back to back, and where each one ends
+    std::wstring RemovedNames;
+    std::vector<uint32_t> RemovedNameEnds;
+    std::vector<Process> Added;
+
+    bool empty() const
+    {
+        return Removed.empty() && Added.empty();
+    }
+
+    // Empty if the exit didn't come with a name
+    std::wstring_view RemovedName(size_t index) const
+    {
+        auto begin = index == 0 ? 0 : RemovedNameEnds[index - 1];
+        return std::wstring_view(RemovedNames).substr(begin, RemovedNameEnds[index] - begin);
+    }
+};
+
+struct ProcessEventCoalescerStatistics
+{
+    uint64_t Created = 0;
+    uint64_t Removed = 0;
+    // Processes that were created and exited within the same batch
+    uint64_t Cancelled = 0;
+    uint64_t Batches = 0;
+};
+
+// Collects process creation and exit events between flushes so that bursts
+// (e.g. a build spawning thousands of short lived compilers) reach the UI as
+// a few batches instead of one message per event. A process that is created
+// and exits before the batch is taken never shows up at all. Events can be
+// added from any thread.
+//
+// Batches handed back with Recycle are reused, along with the strings of
+// their processes, so once the buffers have grown to the size of a burst
+// adding events only allocates for a name or path longer than the string
+// it lands in has held before.
+class ProcessEventCoalescer
+{
+public:
+    // Both return true if this is the first event since the last TakeBatch,
+    // which is when the caller should schedule a flush.
+    bool AddCreated(ProcessView const& process)
+    {
+        std::scoped_lock lock(m_lock);
+        auto wasEmpty = m_batch.empty();
+        m_statistics.Created++;
+        if (auto index = m_addedIndex.Find(process.Pid))
+        {
+            process.AssignTo(m_batch.Added[*index]);
+        }
+        else
+        {
+            m_addedIndex.Insert(process.Pid, static_cast<uint32_t>(m_batch.Added.size()));
+            if (m_spareProcesses.empty())
+            {
+                m_batch.Added.emplace_back();
+            }
+            else
+            {
+                m_batch.Added.push_back(std::move(m_spareProcesses.back()));
+                m_spareProcesses.pop_back();
+            }
+            process.AssignTo(m_batch.Added.back());
+        }
+        return wasEmpty;
+    }
+
+    bool AddRemoved(ProcessKey key, std::wstring_view name = {})
+    {
+        std::scoped_lock lock(m_lock);
+        auto wasEmpty = m_batch.empty();
+        m_statistics.Removed++;
+        auto index = m_addedIndex.Find(key.Pid());
+        if (index && ExitMatches(key, name, m_batch.Added[*index].GetKey(), m_batch.Added[*index].Name))
+        {
+            // The list never saw this process, drop the pair
+            m_addedIndex.Erase(key.Pid(), *index);
+            std::swap(m_batch.Added[*index], m_batch.Added.back());
+            if (*index + 1 != m_batch.Added.size())
+            {
+                m_addedIndex.Insert(m_batch.Added[*index].Pid, *index);
+            }
+            m_spareProcesses.push_back(std::move(m_batch.Added.back()));
+            m_batch.Added.pop_back();
+            m_statistics.Cancelled++;
+        }
+        else
+        {
+            m_batch.Removed.push_back(key);
+            m_batch.RemovedNames.append(name);
+            m_batch.RemovedNameEnds.push_back(static_cast<uint32_t>(m_batch.RemovedNames.size()));
+        }
+        return wasEmpty;
+    }
+
+    ProcessEventBatch TakeBatch()
+    {
+        std::scoped_lock lock(m_lock);
+        ProcessEventBatch batch;
+        std::swap(batch, m_batch);
+        std::swap(m_batch, m_recycled);
+        m_addedIndex.clear();
+        if (!batch.empty())
+        {
+            m_statistics.Batches++;
+        }
+        return batch;
+    }
+
+    // Hands a batch from TakeBatch back once it has been applied
+    void Recycle(ProcessEventBatch&& batch)
+    {
+        std::scoped_lock lock(m_lock);
+        for (auto&& process : batch.Added)
+        {
+            m_spareProcesses.push_back(std::move(process));
+        }
+        batch.Added.clear();
+        batch.Removed.clear();
+        batch.RemovedNames.clear();
+        batch.RemovedNameEnds.clear();
+        if (batch.Added.capacity() + batch.Removed.capacity() > m_recycled.Added.capacity() + m_recycled.Removed.capacity())
+        {
+            m_recycled = std::move(batch);
+        }
+    }
+
+    ProcessEventCoalescerStatistics GetStatistics()
+    {
+        std::scoped_lock lock(m_lock);
+        return m_statistics;
+    }
+
+private:
+    std::mutex m_lock;
+    ProcessEventBatch m_batch;
+    // Emptied, becomes m_batch when it is taken
+    ProcessEventBatch m_recycled;
+    // Processes of recycled or cancelled batches, their strings are reused
+    std::vector<Process> m_spareProcesses;
+    // Pid -> index in m_batch.Added
+    ProcessIdIndex m_addedIndex;
+    ProcessEventCoalescerStatistics m_statistics;
+};
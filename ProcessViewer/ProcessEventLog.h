@@ -0,0 +1,610 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "MappedFile.h"
+#include "Process.h"
+
+// An append-only log of process lifecycle events, kept in two files: the log
+// itself, a header followed by fixed-size records, and "<log>.strings", a
+// header followed by every name and path the records refer to, each stored
+// once. Records refer to strings by their index in that file. Strings are
+// always written before the records that use them, so a reader that maps the
+// log before the string table can resolve every record it sees. A crash can
+// leave a partial record or string at the end, which readers ignore and the
+// writer cuts off when it reopens the log.
+//
+// Strings are stored as wchar_t, so logs are only readable on the platform
+// that wrote them.
+
+enum class ProcessLogEventKind : uint8_t
+{
+    // Seen starting while we watched
+    Started,
+    // Already running when we started watching
+    Running,
+    Exited,
+    // Fields of a process that were queried after it was logged
+    Metadata,
+    // Marks the start of a session. Processes that hadn't exited by then
+    // may have exited at any point while nobody was watching.
+    LogOpened,
+};
+
+struct ProcessLogRecord
+{
+    static constexpr uint32_t NoString = UINT32_MAX;
+
+    // Microseconds since the Unix epoch. Never decreases through a log.
+    uint64_t Timestamp;
+    uint64_t CreationTime;
+    uint32_t Pid;
+    uint32_t NameId;
+    uint32_t ExecutablePathId;
+    uint16_t ArchitectureValue;
+    // The mandatory label RID, UINT16_MAX if unknown
+    uint16_t IntegrityLevelValue;
+    ProcessLogEventKind Kind;
+    // ProcessType + 1, 0 if unknown
+    uint8_t TypeValue;
+    uint8_t Reserved[6];
+
+    std::optional<ProcessType> GetType() const
+    {
+        return TypeValue != 0 ? std::optional(static_cast<ProcessType>(TypeValue - 1)) : std::nullopt;
+    }
+
+    std::optional<::IntegrityLevel> GetIntegrityLevel() const
+    {
+        return IntegrityLevelValue != UINT16_MAX ? std::optional(static_cast<::IntegrityLevel>(IntegrityLevelValue)) : std::nullopt;
+    }
+};
+static_assert(sizeof(ProcessLogRecord) == 40, "Records are written as is");
+
+struct ProcessLogFileHeader
+{
+    char Magic[8];
+    uint32_t Version;
+    // sizeof(ProcessLogRecord) for the log, sizeof(wchar_t) for the strings
+    uint32_t ElementSize;
+};
+
+namespace ProcessLogFormat
+{
+    constexpr char LogMagic[8] = { 'P', 'V', 'E', 'V', 'L', 'O', 'G', 0 };
+    constexpr char StringsMagic[8] = { 'P', 'V', 'S', 'T', 'R', 'S', 0, 0 };
+    constexpr uint32_t Version = 1;
+
+    inline std::filesystem::path GetStringsPath(std::filesystem::path const& logPath)
+    {
+        auto path = logPath;
+        path += L".strings";
+        return path;
+    }
+
+    inline ProcessLogFileHeader MakeHeader(char const (&magic)[8], uint32_t elementSize)
+    {
+        ProcessLogFileHeader header = {};
+        memcpy(header.Magic, magic, sizeof(header.Magic));
+        header.Version = Version;
+        header.ElementSize = elementSize;
+        return header;
+    }
+
+    inline bool IsValidHeader(uint8_t const* data, size_t size, char const (&magic)[8], uint32_t elementSize)
+    {
+        ProcessLogFileHeader header = {};
+        if (size < sizeof(header))
+        {
+            return false;
+        }
+        memcpy(&header, data, sizeof(header));
+        return memcmp(header.Magic, magic, sizeof(header.Magic)) == 0 && header.Version == Version && header.ElementSize == elementSize;
+    }
+
+    // Each string is a uint32_t length followed by that many wchar_ts, padded
+    // to a multiple of 4 bytes. Calls visit(offset of the characters, length)
+    // for every complete string and returns the offset just past the last.
+    template <typename TVisit>
+    inline size_t ParseStrings(uint8_t const* data, size_t size, TVisit&& visit)
+    {
+        size_t offset = sizeof(ProcessLogFileHeader);
+        while (offset + sizeof(uint32_t) <= size)
+        {
+            uint32_t length = 0;
+            memcpy(&length, data + offset, sizeof(length));
+            auto bytes = (sizeof(uint32_t) + length * sizeof(wchar_t) + 3) & ~size_t(3);
+            if (bytes > size - offset)
+            {
+                break;
+            }
+            visit(offset + sizeof(uint32_t), length);
+            offset += bytes;
+        }
+        return offset;
+    }
+
+    inline uint64_t GetTimestamp()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+}
+
+// Appends events to a log from a thread of its own. Logging only copies the
+// event into a queue, so it never waits on the disk; if the writer falls so
+// far behind that the queue is full, events are dropped and counted.
+class ProcessEventLogWriter
+{
+public:
+    static constexpr size_t DefaultCapacity = 64 * 1024;
+
+    // Opens the log for appending, creating it if it doesn't exist. Returns
+    // nullptr if it can't be opened or isn't a log.
+    static std::unique_ptr<ProcessEventLogWriter> TryCreate(std::filesystem::path const& path, size_t capacity = DefaultCapacity)
+    {
+        auto writer = std::unique_ptr<ProcessEventLogWriter>(new ProcessEventLogWriter(capacity));
+        if (!writer->OpenStrings(ProcessLogFormat::GetStringsPath(path)) || !writer->OpenLog(path))
+        {
+            return nullptr;
+        }
+        writer->Log(ProcessLogEventKind::LogOpened, nullptr, 0, 0);
+        writer->m_thread = std::thread([writer = writer.get()]() { writer->Run(); });
+        return writer;
+    }
+
+    ~ProcessEventLogWriter()
+    {
+        if (m_thread.joinable())
+        {
+            {
+                std::scoped_lock lock(m_lock);
+                m_stopping = true;
+            }
+            m_wake.notify_all();
+            m_thread.join();
+        }
+    }
+
+    ProcessEventLogWriter(ProcessEventLogWriter const&) = delete;
+    ProcessEventLogWriter& operator=(ProcessEventLogWriter const&) = delete;
+
+    void LogStarted(Process const& process)
+    {
+        Log(ProcessLogEventKind::Started, &process, process.Pid, process.CreationTime);
+    }
+
+    void LogRunning(Process const& process)
+    {
+        Log(ProcessLogEventKind::Running, &process, process.Pid, process.CreationTime);
+    }
+
+    // The creation time can be 0 if it isn't known, the exit then applies to
+    // whichever process last had the pid
+    void LogExited(uint32_t pid, uint64_t creationTime)
+    {
+        Log(ProcessLogEventKind::Exited, nullptr, pid, creationTime);
+    }
+
+    void LogMetadata(Process const& process)
+    {
+        Log(ProcessLogEventKind::Metadata, &process, process.Pid, process.CreationTime);
+    }
+
+    // Waits until everything logged so far is written
+    void Flush()
+    {
+        std::unique_lock lock(m_lock);
+        auto target = m_logged;
+        m_wake.notify_all();
+        m_flushed.wait(lock, [&]() { return m_written >= target; });
+    }
+
+    uint64_t GetDroppedCount()
+    {
+        std::scoped_lock lock(m_lock);
+        return m_dropped;
+    }
+
+private:
+    struct Entry
+    {
+        ProcessLogRecord Record;
+        std::wstring Name;
+        std::wstring ExecutablePath;
+        bool HasExecutablePath;
+    };
+
+    explicit ProcessEventLogWriter(size_t capacity) : m_capacity(std::max<size_t>(capacity, 1))
+    {
+    }
+
+    bool OpenStrings(std::filesystem::path const& path)
+    {
+        size_t validSize = 0;
+        {
+            // Shorter than a header means we crashed while creating it, the
+            // file is started over
+            MappedFile file;
+            if (file.Open(path) && file.size() >= sizeof(ProcessLogFileHeader))
+            {
+                if (!ProcessLogFormat::IsValidHeader(file.data(), file.size(), ProcessLogFormat::StringsMagic, sizeof(wchar_t)))
+                {
+                    return false;
+                }
+                validSize = ProcessLogFormat::ParseStrings(file.data(), file.size(), [&](size_t offset, uint32_t length)
+                    {
+                        std::wstring value(length, L'\0');
+                        memcpy(value.data(), file.data() + offset, length * sizeof(wchar_t));
+                        m_stringIds.emplace(std::move(value), static_cast<uint32_t>(m_stringIds.size()));
+                    });
+            }
+        }
+        return OpenForAppend(m_strings, path, validSize, ProcessLogFormat::MakeHeader(ProcessLogFormat::StringsMagic, sizeof(wchar_t)));
+    }
+
+    bool OpenLog(std::filesystem::path const& path)
+    {
+        size_t validSize = 0;
+        {
+            // Started over if shorter than a header, like the strings
+            MappedFile file;
+            if (file.Open(path) && file.size() >= sizeof(ProcessLogFileHeader))
+            {
+                if (!ProcessLogFormat::IsValidHeader(file.data(), file.size(), ProcessLogFormat::LogMagic, sizeof(ProcessLogRecord)))
+                {
+                    return false;
+                }
+                auto records = (file.size() - sizeof(ProcessLogFileHeader)) / sizeof(ProcessLogRecord);
+                validSize = sizeof(ProcessLogFileHeader) + records * sizeof(ProcessLogRecord);
+                if (records > 0)
+                {
+                    ProcessLogRecord last = {};
+                    memcpy(&last, file.data() + validSize - sizeof(last), sizeof(last));
+                    m_lastTimestamp = last.Timestamp;
+                }
+            }
+        }
+        return OpenForAppend(m_log, path, validSize, ProcessLogFormat::MakeHeader(ProcessLogFormat::LogMagic, sizeof(ProcessLogRecord)));
+    }
+
+    // Cuts off anything past validSize (left by a crash). A validSize of 0
+    // (a new file, or one too short to have a header) starts the file over
+    // with just the header.
+    static bool OpenForAppend(std::ofstream& stream, std::filesystem::path const& path, size_t validSize, ProcessLogFileHeader const& header)
+    {
+        std::error_code error;
+        if (validSize > 0 && std::filesystem::file_size(path, error) != validSize)
+        {
+            std::filesystem::resize_file(path, validSize, error);
+            if (error)
+            {
+                return false;
+            }
+        }
+        stream.open(path, std::ios::binary | std::ios::app);
+        if (!stream)
+        {
+            return false;
+        }
+        if (validSize == 0)
+        {
+            std::filesystem::resize_file(path, 0, error);
+            stream.write(reinterpret_cast<char const*>(&header), sizeof(header));
+            stream.flush();
+        }
+        return static_cast<bool>(stream);
+    }
+
+    void Log(ProcessLogEventKind kind, Process const* process, uint32_t pid, uint64_t creationTime)
+    {
+        Entry entry = {};
+        entry.Record.Kind = kind;
+        entry.Record.Pid = pid;
+        entry.Record.CreationTime = creationTime;
+        entry.Record.NameId = ProcessLogRecord::NoString;
+        entry.Record.ExecutablePathId = ProcessLogRecord::NoString;
+        entry.Record.IntegrityLevelValue = UINT16_MAX;
+        if (process != nullptr)
+        {
+            entry.Name = process->Name;
+            entry.HasExecutablePath = !HasAnyField(process->Pending, ProcessFields::ExecutablePath);
+            if (entry.HasExecutablePath)
+            {
+                entry.ExecutablePath = process->ExecutablePath;
+            }
+            entry.Record.ArchitectureValue = process->ArchitectureValue;
+            if (process->Type.has_value())
+            {
+                entry.Record.TypeValue = static_cast<uint8_t>(static_cast<uint8_t>(*process->Type) + 1);
+            }
+            if (process->IntegrityLevel.has_value())
+            {
+                entry.Record.IntegrityLevelValue = static_cast<uint16_t>(*process->IntegrityLevel);
+            }
+        }
+
+        {
+            std::scoped_lock lock(m_lock);
+            if (m_queue.size() >= m_capacity)
+            {
+                m_dropped++;
+                return;
+            }
+            // Stamped under the lock so the log stays in timestamp order
+            m_lastTimestamp = std::max(m_lastTimestamp, ProcessLogFormat::GetTimestamp());
+            entry.Record.Timestamp = m_lastTimestamp;
+            m_queue.push_back(std::move(entry));
+            m_logged++;
+        }
+        m_wake.notify_one();
+    }
+
+    uint32_t Intern(std::wstring const& value)
+    {
+        auto [it, inserted] = m_stringIds.try_emplace(value, static_cast<uint32_t>(m_stringIds.size()));
+        if (inserted)
+        {
+            auto length = static_cast<uint32_t>(value.size());
+            m_strings.write(reinterpret_cast<char const*>(&length), sizeof(length));
+            m_strings.write(reinterpret_cast<char const*>(value.data()), value.size() * sizeof(wchar_t));
+            static constexpr char padding[4] = {};
+            auto bytes = sizeof(length) + value.size() * sizeof(wchar_t);
+            m_strings.write(padding, ((bytes + 3) & ~size_t(3)) - bytes);
+        }
+        return it->second;
+    }
+
+    void Run()
+    {
+        std::vector<Entry> entries;
+        std::vector<ProcessLogRecord> records;
+        while (true)
+        {
+            {
+                std::unique_lock lock(m_lock);
+                m_wake.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+                if (m_queue.empty())
+                {
+                    return;
+                }
+                entries.swap(m_queue);
+            }
+
+            records.clear();
+            for (auto&& entry : entries)
+            {
+                if (entry.Record.Kind != ProcessLogEventKind::Exited && entry.Record.Kind != ProcessLogEventKind::LogOpened)
+                {
+                    entry.Record.NameId = Intern(entry.Name);
+                    if (entry.HasExecutablePath)
+                    {
+                        entry.Record.ExecutablePathId = Intern(entry.ExecutablePath);
+                    }
+                }
+                records.push_back(entry.Record);
+            }
+            // The strings have to be on disk before anything refers to them
+            m_strings.flush();
+            m_log.write(reinterpret_cast<char const*>(records.data()), records.size() * sizeof(ProcessLogRecord));
+            m_log.flush();
+
+            {
+                std::scoped_lock lock(m_lock);
+                m_written += entries.size();
+            }
+            m_flushed.notify_all();
+            entries.clear();
+        }
+    }
+
+private:
+    size_t m_capacity = 0;
+    // Only used by the writer thread once it runs
+    std::ofstream m_log;
+    std::ofstream m_strings;
+    std::unordered_map<std::wstring, uint32_t> m_stringIds;
+
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::condition_variable m_flushed;
+    std::vector<Entry> m_queue;
+    uint64_t m_lastTimestamp = 0;
+    uint64_t m_logged = 0;
+    uint64_t m_written = 0;
+    uint64_t m_dropped = 0;
+    bool m_stopping = false;
+    std::thread m_thread;
+};
+
+// One process as far as a log knows it. Names and paths are string ids, see
+// ProcessEventLogReader::GetString.
+struct ProcessLifetime
+{
+    uint32_t Pid;
+    uint64_t CreationTime;
+    uint32_t NameId;
+    uint32_t ExecutablePathId;
+    // When it was seen starting, 0 if it was already running when first seen
+    uint64_t Started;
+    uint64_t FirstSeen;
+    // 0 if it hadn't exited by the end of the range (or the log doesn't say)
+    uint64_t Exited;
+};
+
+// Reads a log in place through memory mapped views, records are never copied
+// out of the file. Sees the log as it was when it was opened.
+class ProcessEventLogReader
+{
+public:
+    // Returns std::nullopt if either file is missing or isn't part of a log
+    static std::optional<ProcessEventLogReader> Open(std::filesystem::path const& path)
+    {
+        ProcessEventLogReader reader;
+        // The log first, every string it refers to is in the string table by
+        // the time the table is mapped
+        if (!reader.m_log.Open(path) ||
+            !ProcessLogFormat::IsValidHeader(reader.m_log.data(), reader.m_log.size(), ProcessLogFormat::LogMagic, sizeof(ProcessLogRecord)) ||
+            !reader.m_strings.Open(ProcessLogFormat::GetStringsPath(path)) ||
+            !ProcessLogFormat::IsValidHeader(reader.m_strings.data(), reader.m_strings.size(), ProcessLogFormat::StringsMagic, sizeof(wchar_t)))
+        {
+            return std::nullopt;
+        }
+        ProcessLogFormat::ParseStrings(reader.m_strings.data(), reader.m_strings.size(), [&](size_t offset, uint32_t length)
+            {
+                reader.m_stringOffsets.push_back({ offset, length });
+            });
+        return reader;
+    }
+
+    size_t size() const
+    {
+        return (m_log.size() - sizeof(ProcessLogFileHeader)) / sizeof(ProcessLogRecord);
+    }
+
+    ProcessLogRecord const* begin() const
+    {
+        return reinterpret_cast<ProcessLogRecord const*>(m_log.data() + sizeof(ProcessLogFileHeader));
+    }
+
+    ProcessLogRecord const* end() const
+    {
+        return begin() + size();
+    }
+
+    // Empty for ProcessLogRecord::NoString
+    std::wstring_view GetString(uint32_t id) const
+    {
+        if (id >= m_stringOffsets.size())
+        {
+            return {};
+        }
+        auto [offset, length] = m_stringOffsets[id];
+        return { reinterpret_cast<wchar_t const*>(m_strings.data() + offset), length };
+    }
+
+    // The first record at or after the timestamp
+    ProcessLogRecord const* LowerBound(uint64_t timestamp) const
+    {
+        return std::lower_bound(begin(), end(), timestamp, [](ProcessLogRecord const& record, uint64_t value)
+            {
+                return record.Timestamp < value;
+            });
+    }
+
+    // The first record after the timestamp
+    ProcessLogRecord const* UpperBound(uint64_t timestamp) const
+    {
+        return std::upper_bound(begin(), end(), timestamp, [](uint64_t value, ProcessLogRecord const& record)
+            {
+                return value < record.Timestamp;
+            });
+    }
+
+    // Every process that was (or may have been) running at some point
+    // between the two timestamps, inclusive, in the order they were first
+    // seen. A single pass over the records up to the end of the range.
+    std::vector<ProcessLifetime> FindProcessesRunningBetween(uint64_t from, uint64_t to) const
+    {
+        std::vector<ProcessLifetime> lifetimes;
+        std::vector<bool> removed;
+        // Pid -> index of the process that has it, only one process can
+        // have a pid at a time
+        std::unordered_map<uint32_t, size_t> alive;
+        auto remove = [&](std::unordered_map<uint32_t, size_t>::iterator it, bool ended)
+        {
+            removed[it->second] = ended;
+            alive.erase(it);
+        };
+
+        uint64_t previous = 0;
+        auto last = UpperBound(to);
+        for (auto record = begin(); record != last; ++record)
+        {
+            switch (record->Kind)
+            {
+            case ProcessLogEventKind::LogOpened:
+                // Nobody watched since the previous record, so what was still
+                // running then only counts if that was inside the range
+                if (previous < from)
+                {
+                    for (auto it = alive.begin(); it != alive.end();)
+                    {
+                        removed[it->second] = true;
+                        it = alive.erase(it);
+                    }
+                }
+                break;
+            case ProcessLogEventKind::Exited:
+            {
+                auto search = alive.find(record->Pid);
+                if (search == alive.end())
+                {
+                    break;
+                }
+                auto& lifetime = lifetimes[search->second];
+                if (record->CreationTime != 0 && lifetime.CreationTime != 0 && record->CreationTime != lifetime.CreationTime)
+                {
+                    break;
+                }
+                lifetime.Exited = record->Timestamp;
+                remove(search, record->Timestamp < from);
+            }
+                break;
+            default:
+            {
+                auto search = alive.find(record->Pid);
+                if (search != alive.end() && lifetimes[search->second].CreationTime != record->CreationTime)
+                {
+                    // Its exit went missing, but the pid was reused so it
+                    // must be gone
+                    lifetimes[search->second].Exited = record->Timestamp;
+                    remove(search, record->Timestamp < from);
+                    search = alive.end();
+                }
+                if (search == alive.end())
+                {
+                    search = alive.emplace(record->Pid, lifetimes.size()).first;
+                    lifetimes.push_back({ record->Pid, record->CreationTime, record->NameId, ProcessLogRecord::NoString,
+                        record->Kind == ProcessLogEventKind::Started ? record->Timestamp : 0, record->Timestamp, 0 });
+                    removed.push_back(false);
+                }
+                if (record->ExecutablePathId != ProcessLogRecord::NoString)
+                {
+                    lifetimes[search->second].ExecutablePathId = record->ExecutablePathId;
+                }
+            }
+                break;
+            }
+            previous = record->Timestamp;
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < lifetimes.size(); i++)
+        {
+            if (!removed[i])
+            {
+                lifetimes[kept++] = lifetimes[i];
+            }
+        }
+        lifetimes.resize(kept);
+        return lifetimes;
+    }
+
+private:
+    ProcessEventLogReader() = default;
+
+private:
+    MappedFile m_log;
+    MappedFile m_strings;
+    std::vector<std::pair<size_t, uint32_t>> m_stringOffsets;
+};
@@ -0,0 +1,111 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include "ProcessEnrichmentStage.h"
+#include "ProcessEventCoalescer.h"
+#include "ProcessEventRing.h"
+
+// The part of watching processes that doesn't depend on where events come
+// from or which thread consumes them: starts are enriched on a worker pool,
+// exits cancel anything not delivered yet, and both cross over to the
+// consumer through a ProcessEventRing, where they are coalesced into
+// batches. drainNeeded is called (from whichever thread added it) when
+// events are waiting in the ring; the consumer should call Drain soon after,
+// rather than leaving them in the ring for a whole batching window where a
+// burst would spill into its overflow list. Drain returns true when it
+// started a new batch, which the consumer takes with TakeBatch after its
+// batching window and hands back with Recycle once applied. All three are
+// called from the same thread.
+//
+// Only the hand-off through the ring is free of allocations. Every start
+// still allocates: the entry and the enriched process own their strings,
+// and the metadata cache adds a node for each new process.
+class ProcessEventPipeline
+{
+public:
+    using DrainNeededCallback = std::function<void()>;
+
+    ProcessEventPipeline(ProcessSource& source, ProcessMetadataCache& cache, DrainNeededCallback drainNeeded,
+        EnrichmentOverflowPolicy policy = EnrichmentOverflowPolicy::DegradeToIdentity,
+        size_t workerCount = ProcessEnrichmentStage::DefaultWorkerCount, size_t capacity = ProcessEnrichmentStage::DefaultCapacity)
+        : m_cache(&cache), m_ring(std::move(drainNeeded))
+    {
+        m_enrichment = std::make_unique<ProcessEnrichmentStage>(source, cache, ProcessEnrichmentStage::EnrichedCallback([this](Process process)
+            {
+                m_ring.PushCreated(process);
+            }), policy, workerCount, capacity);
+    }
+
+    ProcessEventPipeline(ProcessEventPipeline const&) = delete;
+    ProcessEventPipeline& operator=(ProcessEventPipeline const&) = delete;
+
+    void OnProcessStarted(ProcessEntry entry)
+    {
+        m_enrichment->Submit(std::move(entry));
+    }
+
+    // name is empty unless the backend's key may be off, see ExitMatches
+    void OnProcessExited(ProcessKey key, std::wstring_view name = {})
+    {
+        m_enrichment->Cancel(key, name);
+        m_cache->Evict(key);
+        m_ring.PushExited(key, name);
+    }
+
+    bool Drain()
+    {
+        auto count = m_ring.Drain([this](ProcessEventKind kind, ProcessKey key, ProcessView const& process, ProcessFields)
+            {
+                if (kind == ProcessEventKind::Exited)
+                {
+                    m_events.AddRemoved(key, process.Name);
+                }
+                else
+                {
+                    m_events.AddCreated(process);
+                }
+            });
+        if (count == 0 || m_batchStarted)
+        {
+            return false;
+        }
+        m_batchStarted = true;
+        return true;
+    }
+
+    ProcessEventBatch TakeBatch()
+    {
+        Drain();
+        m_batchStarted = false;
+        return m_events.TakeBatch();
+    }
+
+    void Recycle(ProcessEventBatch&& batch)
+    {
+        m_events.Recycle(std::move(batch));
+    }
+
+    ProcessEventCoalescerStatistics GetStatistics()
+    {
+        return m_events.GetStatistics();
+    }
+
+    EnrichmentStageStatistics GetEnrichmentStatistics()
+    {
+        return m_enrichment->GetStatistics();
+    }
+
+    ProcessEventRingStatistics GetRingStatistics() const
+    {
+        return m_ring.GetStatistics();
+    }
+
+private:
+    ProcessMetadataCache* m_cache = nullptr;
+    ProcessEventRing m_ring;
+    // Only used by the consumer
+    ProcessEventCoalescer m_events;
+    bool m_batchStarted = false;
+    // Delivers into m_ring, so it has to go away first
+    std::unique_ptr<ProcessEnrichmentStage> m_enrichment;
+};
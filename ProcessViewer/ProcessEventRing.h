@@ -0,0 +1,281 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "EventRing.h"
+#include "Process.h"
+
+enum class ProcessEventKind : uint8_t
+{
+    Created,
+    Exited,
+    // Pending fields of a process were queried, ProcessEventSlot::Fields says
+    // which
+    FieldsResolved,
+};
+
+// A process event in a fixed amount of memory, so it can sit in a
+// preallocated ring slot. The name and executable path share one inline
+// buffer; events whose strings don't fit take the (allocating) overflow path
+// instead, see ProcessEventRing.
+struct ProcessEventSlot
+{
+    static constexpr size_t TextCapacity = 320;
+
+    // Which process the event is for, exits don't carry anything else but
+    // the name they came with
+    ProcessKey Key;
+    uint64_t CreationTime;
+    uint32_t Pid;
+    uint32_t IntegrityLevelValue;
+    uint16_t ArchitectureValue;
+    uint16_t NameLength;
+    uint16_t ExecutablePathLength;
+    ProcessEventKind Kind;
+    ProcessFields Fields;
+    ProcessFields Pending;
+    // ProcessType + 1, 0 if unknown
+    uint8_t TypeValue;
+    bool HasIntegrityLevel;
+    ProcessQueryErrors Errors;
+    wchar_t Text[TextCapacity];
+
+    static bool Fits(Process const& process)
+    {
+        return process.Name.size() + process.ExecutablePath.size() <= TextCapacity;
+    }
+
+    // The process has to fit
+    void Store(ProcessEventKind kind, Process const& process, ProcessFields fields)
+    {
+        Kind = kind;
+        Fields = fields;
+        Key = process.GetKey();
+        Pid = process.Pid;
+        CreationTime = process.CreationTime;
+        ArchitectureValue = process.ArchitectureValue;
+        TypeValue = process.Type.has_value() ? static_cast<uint8_t>(static_cast<uint8_t>(*process.Type) + 1) : 0;
+        HasIntegrityLevel = process.IntegrityLevel.has_value();
+        IntegrityLevelValue = HasIntegrityLevel ? static_cast<uint32_t>(*process.IntegrityLevel) : 0;
+        Errors = process.Errors;
+        Pending = process.Pending;
+        NameLength = static_cast<uint16_t>(process.Name.size());
+        ExecutablePathLength = static_cast<uint16_t>(process.ExecutablePath.size());
+        std::copy(process.Name.begin(), process.Name.end(), Text);
+        std::copy(process.ExecutablePath.begin(), process.ExecutablePath.end(), Text + NameLength);
+    }
+
+    // The name has to fit
+    void StoreExited(ProcessKey key, std::wstring_view name)
+    {
+        Kind = ProcessEventKind::Exited;
+        Fields = ProcessFields::None;
+        Key = key;
+        Pid = key.Pid();
+        CreationTime = 0;
+        NameLength = static_cast<uint16_t>(name.size());
+        ExecutablePathLength = 0;
+        std::copy(name.begin(), name.end(), Text);
+    }
+
+    // Points into Text, so it is only valid until the slot is reused
+    ProcessView View() const
+    {
+        ProcessView process = {};
+        process.Pid = Pid;
+        process.CreationTime = CreationTime;
+        process.Name = std::wstring_view(Text, NameLength);
+        process.ExecutablePath = std::wstring_view(Text + NameLength, ExecutablePathLength);
+        if (TypeValue != 0)
+        {
+            process.Type = static_cast<ProcessType>(TypeValue - 1);
+        }
+        process.ArchitectureValue = ArchitectureValue;
+        if (HasIntegrityLevel)
+        {
+            process.IntegrityLevel = static_cast<::IntegrityLevel>(IntegrityLevelValue);
+        }
+        process.Errors = Errors;
+        process.Pending = Pending;
+        return process;
+    }
+};
+
+struct ProcessEventRingStatistics
+{
+    uint64_t Pushed = 0;
+    // Events that went through the overflow list, because the ring was full
+    // (or was full recently, see ProcessEventRing) or they didn't fit a slot
+    uint64_t Overflowed = 0;
+    uint64_t Oversized = 0;
+    uint64_t Drained = 0;
+    uint64_t Wakeups = 0;
+    size_t Capacity = 0;
+};
+
+// Hands process events from any number of threads to one consumer thread.
+// Events go into a lock-free ring of preallocated slots, so steady state
+// pushes neither lock nor allocate. wake is called (on the pushing thread)
+// for the first event after the consumer last started draining; the consumer
+// is expected to call Drain soon after, typically on its own thread.
+//
+// Nothing is ever dropped. When the ring is full, events go to a locked
+// overflow list instead, and keep going there until the consumer drains it,
+// so that events from one producer are always seen in the order they were
+// pushed.
+class ProcessEventRing
+{
+public:
+    static constexpr size_t DefaultCapacity = 1024;
+
+    using WakeCallback = std::function<void()>;
+
+    explicit ProcessEventRing(WakeCallback wake, size_t capacity = DefaultCapacity)
+        : m_wake(std::move(wake)), m_ring(capacity)
+    {
+    }
+
+    void PushCreated(Process const& process)
+    {
+        Push(ProcessEventKind::Created, process, ProcessFields::None);
+    }
+
+    void PushResolved(Process const& process, ProcessFields fields)
+    {
+        Push(ProcessEventKind::FieldsResolved, process, fields);
+    }
+
+    void PushExited(ProcessKey key, std::wstring_view name = {})
+    {
+        m_pushed.fetch_add(1, std::memory_order_relaxed);
+        if (name.size() > ProcessEventSlot::TextCapacity)
+        {
+            m_oversized.fetch_add(1, std::memory_order_relaxed);
+            Overflow({ ProcessEventKind::Exited, ProcessFields::None, key, CreatePendingProcess({ key.Pid(), std::wstring(name) }) });
+        }
+        else if (m_overflowing.load(std::memory_order_seq_cst) ||
+            !m_ring.TryPush([key, name](ProcessEventSlot& slot) { slot.StoreExited(key, name); }))
+        {
+            Overflow({ ProcessEventKind::Exited, ProcessFields::None, key, CreatePendingProcess({ key.Pid(), std::wstring(name) }) });
+        }
+        Signal();
+    }
+
+    // Consumer only. Calls consume(ProcessEventKind, ProcessKey, ProcessView
+    // const&, ProcessFields) for every event pushed so far, in order. The
+    // view's strings point into the ring, they have to be copied (or
+    // interned) before consume returns. Exits only come with the key and
+    // the name PushExited was given.
+    // Returns how many there were.
+    template <typename TConsume>
+    size_t Drain(TConsume&& consume)
+    {
+        // Anything pushed after this point signals again
+        m_signalled.store(false, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        auto consumeSlot = [&consume](ProcessEventSlot const& slot)
+        {
+            consume(slot.Kind, slot.Key, slot.View(), slot.Fields);
+        };
+        auto count = m_ring.Drain(consumeSlot);
+        if (m_overflowing.load(std::memory_order_seq_cst))
+        {
+            size_t claimed = 0;
+            {
+                std::scoped_lock lock(m_overflowLock);
+                m_overflowDrain.swap(m_overflow);
+                m_overflowing.store(false, std::memory_order_seq_cst);
+                claimed = m_ring.ClaimedPosition();
+            }
+            // A producer's overflowed events come after everything it put in
+            // the ring, which may include slots still being written
+            count += m_ring.DrainThrough(claimed, consumeSlot);
+            for (auto&& event : m_overflowDrain)
+            {
+                consume(event.Kind, event.Key, GetProcessView(event.Process), event.Fields);
+            }
+            count += m_overflowDrain.size();
+            m_overflowDrain.clear();
+        }
+        m_drained.fetch_add(count, std::memory_order_relaxed);
+        return count;
+    }
+
+    ProcessEventRingStatistics GetStatistics() const
+    {
+        ProcessEventRingStatistics statistics;
+        statistics.Pushed = m_pushed.load(std::memory_order_relaxed);
+        statistics.Overflowed = m_overflowed.load(std::memory_order_relaxed);
+        statistics.Oversized = m_oversized.load(std::memory_order_relaxed);
+        statistics.Drained = m_drained.load(std::memory_order_relaxed);
+        statistics.Wakeups = m_wakeups.load(std::memory_order_relaxed);
+        statistics.Capacity = m_ring.Capacity();
+        return statistics;
+    }
+
+private:
+    struct OverflowEvent
+    {
+        ProcessEventKind Kind;
+        ProcessFields Fields;
+        ProcessKey Key;
+        ::Process Process;
+    };
+
+    void Push(ProcessEventKind kind, Process const& process, ProcessFields fields)
+    {
+        m_pushed.fetch_add(1, std::memory_order_relaxed);
+        if (!ProcessEventSlot::Fits(process))
+        {
+            m_oversized.fetch_add(1, std::memory_order_relaxed);
+            Overflow({ kind, fields, process.GetKey(), process });
+        }
+        else if (m_overflowing.load(std::memory_order_seq_cst) ||
+            !m_ring.TryPush([&](ProcessEventSlot& slot) { slot.Store(kind, process, fields); }))
+        {
+            Overflow({ kind, fields, process.GetKey(), process });
+        }
+        Signal();
+    }
+
+    void Overflow(OverflowEvent event)
+    {
+        m_overflowed.fetch_add(1, std::memory_order_relaxed);
+        std::scoped_lock lock(m_overflowLock);
+        m_overflowing.store(true, std::memory_order_seq_cst);
+        m_overflow.push_back(std::move(event));
+    }
+
+    void Signal()
+    {
+        // Pairs with the fence in Drain: either the consumer sees this event
+        // or we see that it needs waking
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!m_signalled.load(std::memory_order_relaxed) && !m_signalled.exchange(true, std::memory_order_acq_rel))
+        {
+            m_wakeups.fetch_add(1, std::memory_order_relaxed);
+            m_wake();
+        }
+    }
+
+private:
+    WakeCallback m_wake;
+    EventRing<ProcessEventSlot> m_ring;
+    std::atomic<bool> m_signalled = false;
+
+    std::atomic<bool> m_overflowing = false;
+    std::mutex m_overflowLock;
+    std::vector<OverflowEvent> m_overflow;
+    // Consumer only, swapped with m_overflow so both keep their capacity
+    std::vector<OverflowEvent> m_overflowDrain;
+
+    std::atomic<uint64_t> m_pushed = 0;
+    std::atomic<uint64_t> m_overflowed = 0;
+    std::atomic<uint64_t> m_oversized = 0;
+    std::atomic<uint64_t> m_drained = 0;
+    std::atomic<uint64_t> m_wakeups = 0;
+};
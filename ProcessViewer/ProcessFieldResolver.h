@@ -0,0 +1,122 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "ProcessSource.h"
+
+// Resolves pending fields of processes in the background, e.g. for rows
+// that are about to be shown. Requests for a process that is already queued
+// are merged. The most recent requests are served first, since they are
+// the rows the user is looking at now. The callback is called on a worker
+// thread with the process (with the requested fields resolved) and the
+// fields that were resolved.
+class ProcessFieldResolver
+{
+public:
+    using ResolvedCallback = std::function<void(Process, ProcessFields)>;
+
+    ProcessFieldResolver(ProcessSource& source, ProcessMetadataCache& cache, ResolvedCallback resolved, size_t workerCount = 2)
+        : m_source(&source), m_cache(&cache), m_resolved(std::move(resolved))
+    {
+        for (size_t i = 0; i < std::max<size_t>(workerCount, 1); i++)
+        {
+            m_workers.emplace_back([this]() { Run(); });
+        }
+    }
+
+    ~ProcessFieldResolver()
+    {
+        {
+            std::scoped_lock lock(m_lock);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        for (auto&& worker : m_workers)
+        {
+            worker.join();
+        }
+    }
+
+    ProcessFieldResolver(ProcessFieldResolver const&) = delete;
+    ProcessFieldResolver& operator=(ProcessFieldResolver const&) = delete;
+
+    void Request(Process process, ProcessFields fields)
+    {
+        fields = fields & process.Pending;
+        if (fields == ProcessFields::None)
+        {
+            return;
+        }
+        {
+            std::scoped_lock lock(m_lock);
+            auto key = std::make_pair(process.Pid, process.CreationTime);
+            if (m_queued.count(key) > 0)
+            {
+                // Already queued, make sure it asks for everything
+                for (auto&& request : m_requests)
+                {
+                    if (request.first.Pid == process.Pid && request.first.CreationTime == process.CreationTime)
+                    {
+                        request.second = request.second | fields;
+                        break;
+                    }
+                }
+                return;
+            }
+            m_queued.insert(key);
+            m_requests.emplace_back(std::move(process), fields);
+        }
+        m_wake.notify_one();
+    }
+
+    // Drops requests that haven't started yet, e.g. after a refresh
+    void CancelPending()
+    {
+        std::scoped_lock lock(m_lock);
+        m_requests.clear();
+        m_queued.clear();
+    }
+
+private:
+    void Run()
+    {
+        while (true)
+        {
+            std::pair<Process, ProcessFields> request;
+            {
+                std::unique_lock lock(m_lock);
+                m_wake.wait(lock, [this]() { return m_stopping || !m_requests.empty(); });
+                if (m_stopping)
+                {
+                    return;
+                }
+                request = std::move(m_requests.back());
+                m_requests.pop_back();
+                m_queued.erase(std::make_pair(request.first.Pid, request.first.CreationTime));
+            }
+
+            auto& [process, fields] = request;
+            // Fields of processes that exited are marked failed, which is
+            // still worth reporting so they stop showing as pending
+            ResolveFields(*m_source, *m_cache, process, fields);
+            m_resolved(std::move(process), fields);
+        }
+    }
+
+private:
+    ProcessSource* m_source = nullptr;
+    ProcessMetadataCache* m_cache = nullptr;
+    ResolvedCallback m_resolved;
+
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::vector<std::pair<Process, ProcessFields>> m_requests;
+    std::set<std::pair<uint32_t, uint64_t>> m_queued;
+    bool m_stopping = false;
+    std::vector<std::thread> m_workers;
+};
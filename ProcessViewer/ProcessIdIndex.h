@@ -0,0 +1,194 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// Maps pids to rows with open addressing: one flat array of (pid, row)
+// pairs probed linearly, so a lookup usually touches a single cache line.
+// Erasing leaves a tombstone rather than shifting entries back, which keeps
+// erase O(1); tombstones are reused by later inserts and swept out in bulk
+// by Compact once they make up too much of the table. Rehashing at the same
+// capacity (to sweep tombstones) reuses the previous table's memory, so an
+// index with steady churn stops allocating.
+class ProcessIdIndex
+{
+public:
+    ProcessIdIndex()
+    {
+        Rehash(MinimumCapacity);
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    // Keeps the capacity, Compact gives it back
+    void clear()
+    {
+        std::fill(m_entries.begin(), m_entries.end(), Entry{ Empty, 0 });
+        m_size = 0;
+        m_tombstones = 0;
+    }
+
+    // Replaces the row if the pid is already in the index
+    void Insert(uint32_t pid, uint32_t row)
+    {
+        if ((m_size + m_tombstones + 1) * 4 > m_entries.size() * 3)
+        {
+            Rehash(CapacityFor(m_size + 1));
+        }
+
+        size_t reusable = SIZE_MAX;
+        for (auto index = Home(pid);; index = (index + 1) & m_mask)
+        {
+            auto& entry = m_entries[index];
+            if (entry.Pid == pid)
+            {
+                entry.Row = row;
+                return;
+            }
+            if (entry.Pid == Tombstone && reusable == SIZE_MAX)
+            {
+                reusable = index;
+            }
+            else if (entry.Pid == Empty)
+            {
+                if (reusable != SIZE_MAX)
+                {
+                    m_tombstones--;
+                    index = reusable;
+                }
+                m_entries[index] = { pid, row };
+                m_size++;
+                return;
+            }
+        }
+    }
+
+    std::optional<uint32_t> Find(uint32_t pid) const
+    {
+        auto index = Lookup(pid);
+        return index != SIZE_MAX ? std::optional(m_entries[index].Row) : std::nullopt;
+    }
+
+    // Only erases the pid if it maps to the given row, a reused pid may
+    // already belong to a newer row
+    bool Erase(uint32_t pid, uint32_t row)
+    {
+        auto index = Lookup(pid);
+        if (index == SIZE_MAX || m_entries[index].Row != row)
+        {
+            return false;
+        }
+        m_entries[index].Pid = Tombstone;
+        m_size--;
+        m_tombstones++;
+        return true;
+    }
+
+    // Sweeps out tombstones (and shrinks after mass removals) if they have
+    // piled up. Meant to be called once per batch of changes.
+    void Compact()
+    {
+        auto capacity = CapacityFor(m_size);
+        if (m_tombstones * 4 > m_entries.size() || capacity * 4 <= m_entries.size())
+        {
+            Rehash(capacity);
+        }
+    }
+
+    size_t GetMemoryUsage() const
+    {
+        return (m_entries.capacity() + m_previous.capacity()) * sizeof(Entry);
+    }
+
+private:
+    static constexpr size_t MinimumCapacity = 16;
+    // Pids are 32-bit but neither Windows nor Linux hands these out
+    static constexpr uint32_t Empty = UINT32_MAX;
+    static constexpr uint32_t Tombstone = UINT32_MAX - 1;
+
+    struct Entry
+    {
+        uint32_t Pid;
+        uint32_t Row;
+    };
+
+    // At most half full right after a rehash
+    static size_t CapacityFor(size_t count)
+    {
+        size_t capacity = MinimumCapacity;
+        while (capacity < count * 2)
+        {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    // Fibonacci hashing: the top bits of the product depend on every bit of
+    // the pid, which matters since Windows pids are multiples of 4
+    size_t Home(uint32_t pid) const
+    {
+        return static_cast<size_t>((pid * 0x9E3779B1u) >> m_shift);
+    }
+
+    size_t Lookup(uint32_t pid) const
+    {
+        for (auto index = Home(pid);; index = (index + 1) & m_mask)
+        {
+            auto key = m_entries[index].Pid;
+            if (key == pid)
+            {
+                return index;
+            }
+            if (key == Empty)
+            {
+                return SIZE_MAX;
+            }
+        }
+    }
+
+    void Rehash(size_t capacity)
+    {
+        if (m_previous.capacity() != capacity)
+        {
+            // Growing or shrinking, don't hold on to the old size
+            m_previous = std::vector<Entry>();
+        }
+        m_previous.assign(capacity, Entry{ Empty, 0 });
+        m_previous.swap(m_entries);
+        auto& entries = m_previous;
+        m_mask = capacity - 1;
+        m_shift = 32;
+        for (auto remaining = capacity; remaining > 1; remaining /= 2)
+        {
+            m_shift--;
+        }
+        m_size = 0;
+        m_tombstones = 0;
+        for (auto&& entry : entries)
+        {
+            if (entry.Pid != Empty && entry.Pid != Tombstone)
+            {
+                auto index = Home(entry.Pid);
+                while (m_entries[index].Pid != Empty)
+                {
+                    index = (index + 1) & m_mask;
+                }
+                m_entries[index] = entry;
+                m_size++;
+            }
+        }
+    }
+
+private:
+    std::vector<Entry> m_entries;
+    // The table before the last rehash, kept for the next one
+    std::vector<Entry> m_previous;
+    size_t m_mask = 0;
+    uint32_t m_shift = 32;
+    size_t m_size = 0;
+    size_t m_tombstones = 0;
+};
@@ -0,0 +1,422 @@
+#pragma once
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+#include <utility>
+#include "CellText.h"
+#include "ProcessIdIndex.h"
+#include "ProcessSnapshotDiff.h"
+#include "ProcessTable.h"
+#include "RadixSort.h"
+
+// The rows shown by the list view. Processes are stored in a ProcessTable
+// and never move once added; the display order is a permutation of row
+// indices (position -> row) with a reverse map (row -> position). Sorting
+// only shuffles 32-bit indices, and inserting or removing a process
+// splices the permutation instead of shifting process data around. Rows of
+// removed processes are reused by later inserts.
+class ProcessListModel
+{
+public:
+    static constexpr uint32_t InvalidPosition = UINT32_MAX;
+
+    // Number of visible processes
+    size_t size() const
+    {
+        return m_order.size();
+    }
+
+    bool empty() const
+    {
+        return m_order.empty();
+    }
+
+    ProcessTable const& Table() const
+    {
+        return m_table;
+    }
+
+    uint32_t RowAt(size_t position) const
+    {
+        return m_order[position];
+    }
+
+    uint32_t PositionOf(uint32_t row) const
+    {
+        return m_positions[row];
+    }
+
+    // Changes whenever a row is assigned a different process or removed, but
+    // not when the order changes. Lets derived data keyed by row (e.g. the
+    // name index) know when it is stale.
+    uint64_t RowsVersion() const
+    {
+        return m_rowsVersion;
+    }
+
+    // The positions the list view has said it is about to show (from
+    // LVN_ODCACHEHINT), clamped to the current size. Empty when there is no
+    // hint or it is out of range.
+    std::pair<size_t, size_t> HintedRange() const
+    {
+        return { std::min(m_hintFirst, m_order.size()), std::min(m_hintLast, m_order.size()) };
+    }
+
+    // Records the hinted positions [first, last] and pre-formats their cells
+    // into the cell cache with format(row, column, CellWriter&), so painting
+    // them afterwards is a copy.
+    template <typename TFormat>
+    void Prefetch(size_t first, size_t last, size_t columnCount, TFormat&& format)
+    {
+        m_hintFirst = first;
+        m_hintLast = last + 1;
+        auto [begin, end] = HintedRange();
+        wchar_t scratch[FormattedCellCache::CellCapacity];
+        for (auto position = begin; position < end; position++)
+        {
+            auto row = m_order[position];
+            for (size_t column = 0; column < columnCount; column++)
+            {
+                if (!m_cells.IsCached(column))
+                {
+                    continue;
+                }
+                CellWriter writer(scratch, std::size(scratch));
+                m_cells.Write(row, column, writer, [&](CellWriter& cellWriter)
+                    {
+                        format(row, column, cellWriter);
+                    });
+            }
+        }
+    }
+
+    // Keeps formatted text for the columns whose entry is true, see
+    // WriteCell.
+    void EnableCellCache(std::vector<bool> const& cachedColumns)
+    {
+        m_cells = FormattedCellCache(cachedColumns);
+        m_cells.Resize(m_table.size());
+    }
+
+    // Writes a cell's text using the cell cache when it is enabled.
+    // format(CellWriter&) is only called when the cell isn't cached.
+    template <typename TFormat>
+    void WriteCell(uint32_t row, size_t column, CellWriter& writer, TFormat&& format)
+    {
+        m_cells.Write(row, column, writer, std::forward<TFormat>(format));
+    }
+
+    void Assign(std::vector<Process> const& processes)
+    {
+        m_table.Assign(processes);
+        m_rowsVersion++;
+        m_cells.Resize(processes.size());
+        m_cells.Clear();
+        m_freeRows.clear();
+        m_order.resize(processes.size());
+        std::iota(m_order.begin(), m_order.end(), 0);
+        m_positions = m_order;
+        m_pids.clear();
+        for (uint32_t row = 0; row < m_table.size(); row++)
+        {
+            m_pids.Insert(m_table.Pid(row), row);
+        }
+    }
+
+    // Lets go of names and paths that only removed rows used. Only rows in the
+    // order count, free rows get theirs back from Set when they are reused.
+    void CompactStrings()
+    {
+        if (m_table.CompactStrings([this](uint32_t row) { return m_positions[row] != InvalidPosition; }))
+        {
+            m_rowsVersion++;
+        }
+    }
+
+    // Sorts the permutation with a comparer that takes two rows
+    template <typename TLess>
+    void Sort(TLess&& less)
+    {
+        std::sort(m_order.begin(), m_order.end(), [&less](uint32_t left, uint32_t right)
+            {
+                return less(left, right);
+            });
+        UpdatePositions(0);
+    }
+
+    // Sorts the permutation by an integer key computed once per row (see
+    // MakeSortKey), using a radix sort instead of comparisons.
+    template <typename TGetKey>
+    void SortByKey(TGetKey&& getKey, size_t maxConcurrency = GetDefaultConcurrency())
+    {
+        std::vector<uint64_t> keys(m_order.size());
+        auto buildKeys = [&](size_t begin, size_t end)
+        {
+            for (auto position = begin; position < end; position++)
+            {
+                keys[position] = getKey(m_order[position]);
+            }
+        };
+        if (keys.size() >= ParallelRadixSortThreshold)
+        {
+            const size_t chunkSize = ParallelRadixSortThreshold / 4;
+            ParallelFor((keys.size() + chunkSize - 1) / chunkSize, [&](size_t chunk)
+                {
+                    buildKeys(chunk * chunkSize, std::min(keys.size(), (chunk + 1) * chunkSize));
+                }, maxConcurrency);
+        }
+        else
+        {
+            buildKeys(0, keys.size());
+        }
+        RadixSortByKey(keys, m_order, maxConcurrency);
+        UpdatePositions(0);
+    }
+
+    // Adds a process to a list that is sorted by the given comparer and
+    // returns the position it was inserted at.
+    template <typename TLess>
+    size_t Insert(Process const& process, TLess&& less)
+    {
+        auto row = AllocateRow(process);
+        auto position = static_cast<size_t>(std::lower_bound(m_order.begin(), m_order.end(), row, [&less](uint32_t left, uint32_t right)
+            {
+                return less(left, right);
+            }) - m_order.begin());
+        m_order.insert(m_order.begin() + position, row);
+        UpdatePositions(position);
+        return position;
+    }
+
+    // Removes the process in the given row and returns the position it was
+    // shown at.
+    size_t Remove(uint32_t row)
+    {
+        auto position = static_cast<size_t>(m_positions[row]);
+        m_order.erase(m_order.begin() + position);
+        m_positions[row] = InvalidPosition;
+        m_pids.Erase(m_table.Pid(row), row);
+        m_freeRows.push_back(row);
+        m_rowsVersion++;
+        UpdatePositions(position);
+        return position;
+    }
+
+    // Removes and adds many processes at once, keeping the list sorted by
+    // the given comparer. The new rows are sorted on their own and merged in,
+    // so a batch costs one pass over the list rather than one per process.
+    template <typename TLess>
+    void ApplyChanges(std::vector<uint32_t> const& removedRows, std::vector<Process> const& added, TLess&& less)
+    {
+        FreeRows(removedRows);
+        if (!removedRows.empty())
+        {
+            RemoveUnpositionedRows();
+        }
+
+        std::vector<uint32_t> addedRows;
+        addedRows.reserve(added.size());
+        for (auto&& process : added)
+        {
+            addedRows.push_back(AllocateRow(process));
+        }
+        MergeRows(addedRows, less);
+    }
+
+    // Moves rows whose sort values changed (e.g. once their pending fields
+    // came in) to where the comparer puts them now. The other rows are still
+    // in order, so the moved ones are merged back in like new rows.
+    template <typename TLess>
+    void Reposition(std::vector<uint32_t> const& rows, TLess&& less)
+    {
+        std::vector<uint32_t> movedRows;
+        movedRows.reserve(rows.size());
+        for (auto row : rows)
+        {
+            // Skips removed rows and ones listed twice
+            if (m_positions[row] != InvalidPosition)
+            {
+                m_positions[row] = InvalidPosition;
+                movedRows.push_back(row);
+            }
+        }
+        if (!movedRows.empty())
+        {
+            RemoveUnpositionedRows();
+            MergeRows(movedRows, less);
+        }
+    }
+
+    // Compares the rows with a full snapshot of the processes that should be
+    // shown. Removed holds rows, Added and the second half of Changed hold
+    // indices into the snapshot.
+    ProcessSnapshotDiff Diff(std::vector<Process> const& snapshot) const
+    {
+        std::vector<uint32_t> rows = m_order;
+        SortIndicesByPid(rows, [this](uint32_t row) { return m_table.Pid(row); });
+        return DiffSortedSnapshots(
+            rows, [this](uint32_t row) { return m_table.Identity(row); },
+            GetIndicesByPid(snapshot), [&snapshot](uint32_t index) { return snapshot[index].GetIdentity(); },
+            [&](uint32_t row, uint32_t index) { return m_table.Differs(row, snapshot[index]); });
+    }
+
+    // Applies the result of Diff, keeping the list sorted by the given
+    // comparer. Only the rows that changed are touched; everything else
+    // keeps its row, and with it its cached cells and the selection.
+    template <typename TLess>
+    void ApplyDiff(ProcessSnapshotDiff const& diff, std::vector<Process> const& snapshot, TLess&& less)
+    {
+        FreeRows(diff.Removed);
+
+        // Changed rows may have to move, they are merged back in with the
+        // added ones
+        std::vector<uint32_t> mergedRows;
+        mergedRows.reserve(diff.Changed.size() + diff.Added.size());
+        for (auto [row, index] : diff.Changed)
+        {
+            m_table.Update(row, snapshot[index]);
+            m_cells.Invalidate(row);
+            m_positions[row] = InvalidPosition;
+            mergedRows.push_back(row);
+        }
+        if (!diff.Changed.empty())
+        {
+            m_rowsVersion++;
+        }
+        if (!diff.Removed.empty() || !diff.Changed.empty())
+        {
+            RemoveUnpositionedRows();
+        }
+
+        for (auto index : diff.Added)
+        {
+            mergedRows.push_back(AllocateRow(snapshot[index]));
+        }
+        MergeRows(mergedRows, less);
+    }
+
+    // Fills in pending fields of a row, e.g. once a lazy query completes.
+    // Only fields that are still pending are changed.
+    template <typename TProcess>
+    void ResolveFields(uint32_t row, TProcess const& process, ProcessFields fields)
+    {
+        fields = fields & m_table.PendingFields(row);
+        if (fields != ProcessFields::None)
+        {
+            m_table.ResolveFields(row, process, fields);
+            m_cells.Invalidate(row);
+        }
+    }
+
+    std::optional<uint32_t> FindRowByPid(uint32_t pid) const
+    {
+        return m_pids.Find(pid);
+    }
+
+    // Like FindRowByPid, but only finds the row if it is still the process
+    // the key names rather than a later one that reused the pid
+    std::optional<uint32_t> FindRowByKey(ProcessKey key) const
+    {
+        auto row = m_pids.Find(key.Pid());
+        if (row && !key.Matches(m_table.Key(*row)))
+        {
+            return std::nullopt;
+        }
+        return row;
+    }
+
+    // The row an exit applies to, see ExitMatches
+    std::optional<uint32_t> FindRowForExit(ProcessKey key, std::wstring_view name) const
+    {
+        auto row = m_pids.Find(key.Pid());
+        if (row && !ExitMatches(key, name, m_table.Key(*row), m_table.Name(*row)))
+        {
+            return std::nullopt;
+        }
+        return row;
+    }
+
+private:
+    uint32_t AllocateRow(Process const& process)
+    {
+        m_rowsVersion++;
+        if (!m_freeRows.empty())
+        {
+            auto row = m_freeRows.back();
+            m_freeRows.pop_back();
+            m_table.Set(row, process);
+            m_cells.Invalidate(row);
+            m_pids.Insert(process.Pid, row);
+            return row;
+        }
+        auto row = static_cast<uint32_t>(m_table.Append(process));
+        m_positions.push_back(InvalidPosition);
+        m_cells.Invalidate(row);
+        m_pids.Insert(process.Pid, row);
+        return row;
+    }
+
+    void FreeRows(std::vector<uint32_t> const& rows)
+    {
+        for (auto row : rows)
+        {
+            if (m_positions[row] != InvalidPosition)
+            {
+                m_positions[row] = InvalidPosition;
+                m_pids.Erase(m_table.Pid(row), row);
+                m_freeRows.push_back(row);
+                m_rowsVersion++;
+            }
+        }
+    }
+
+    // Drops rows marked with InvalidPosition from the order
+    void RemoveUnpositionedRows()
+    {
+        m_order.erase(std::remove_if(m_order.begin(), m_order.end(), [this](uint32_t row)
+            {
+                return m_positions[row] == InvalidPosition;
+            }), m_order.end());
+    }
+
+    // Sorts rows that aren't in the order yet on their own and merges them
+    // in, one pass over the list however many there are
+    template <typename TLess>
+    void MergeRows(std::vector<uint32_t>& rows, TLess&& less)
+    {
+        std::stable_sort(rows.begin(), rows.end(), [&less](uint32_t left, uint32_t right)
+            {
+                return less(left, right);
+            });
+
+        std::vector<uint32_t> order;
+        order.reserve(m_order.size() + rows.size());
+        std::merge(m_order.begin(), m_order.end(), rows.begin(), rows.end(), std::back_inserter(order), [&less](uint32_t left, uint32_t right)
+            {
+                return less(left, right);
+            });
+        m_order = std::move(order);
+        UpdatePositions(0);
+        m_pids.Compact();
+    }
+
+    void UpdatePositions(size_t first)
+    {
+        for (auto position = first; position < m_order.size(); position++)
+        {
+            m_positions[m_order[position]] = static_cast<uint32_t>(position);
+        }
+    }
+
+private:
+    ProcessTable m_table;
+    std::vector<uint32_t> m_order;
+    std::vector<uint32_t> m_positions;
+    std::vector<uint32_t> m_freeRows;
+    // Pid -> row of every visible process
+    ProcessIdIndex m_pids;
+    FormattedCellCache m_cells;
+    uint64_t m_rowsVersion = 0;
+    size_t m_hintFirst = 0;
+    size_t m_hintLast = 0;
+};
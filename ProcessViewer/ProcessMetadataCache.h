@@ -0,0 +1,102 @@
+#pragma once
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "Process.h"
+
+struct ProcessMetadataCacheStatistics
+{
+    uint64_t Hits = 0;
+    uint64_t Misses = 0;
+    uint64_t Evictions = 0;
+    size_t Entries = 0;
+};
+
+// Remembers enriched processes so that refreshes only query the processes
+// that are new since the last time we looked. Only one process can own a
+// pid at a time, so entries are stored by pid and validated against the
+// creation time and name to make sure the pid hasn't been reused. Processes
+// without a creation time aren't cached: the name alone can't tell a reused
+// pid apart. Safe to use from multiple threads.
+class ProcessMetadataCache
+{
+public:
+    std::optional<Process> Lookup(ProcessEntry const& entry)
+    {
+        std::scoped_lock lock(m_lock);
+        auto search = entry.CreationTime != 0 ? m_entries.find(entry.Pid) : m_entries.end();
+        if (search != m_entries.end())
+        {
+            auto& process = search->second;
+            if (process.CreationTime == entry.CreationTime && process.Name == entry.Name)
+            {
+                m_statistics.Hits++;
+                return process;
+            }
+        }
+        m_statistics.Misses++;
+        return std::nullopt;
+    }
+
+    void Insert(Process const& process)
+    {
+        if (process.CreationTime == 0)
+        {
+            return;
+        }
+        std::scoped_lock lock(m_lock);
+        m_entries.insert_or_assign(process.Pid, process);
+    }
+
+    // Called when a process exits. Entries for a later process that reused
+    // the pid are kept.
+    void Evict(ProcessKey key)
+    {
+        std::scoped_lock lock(m_lock);
+        auto search = m_entries.find(key.Pid());
+        if (search != m_entries.end() && key.Matches(search->second.GetKey()))
+        {
+            m_entries.erase(search);
+            m_statistics.Evictions++;
+        }
+    }
+
+    // Drops every entry that isn't part of the given snapshot
+    void EvictAllExcept(std::vector<ProcessEntry> const& entries)
+    {
+        std::unordered_set<uint32_t> alive;
+        alive.reserve(entries.size());
+        for (auto&& entry : entries)
+        {
+            alive.insert(entry.Pid);
+        }
+
+        std::scoped_lock lock(m_lock);
+        for (auto it = m_entries.begin(); it != m_entries.end();)
+        {
+            if (alive.find(it->first) == alive.end())
+            {
+                it = m_entries.erase(it);
+                m_statistics.Evictions++;
+            }
+            else
+            {
+                it++;
+            }
+        }
+    }
+
+    ProcessMetadataCacheStatistics GetStatistics() const
+    {
+        std::scoped_lock lock(m_lock);
+        auto statistics = m_statistics;
+        statistics.Entries = m_entries.size();
+        return statistics;
+    }
+
+private:
+    mutable std::mutex m_lock;
+    std::unordered_map<uint32_t, Process> m_entries;
+    ProcessMetadataCacheStatistics m_statistics;
+};
@@ -0,0 +1,97 @@
+#pragma once
+#include <algorithm>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include "ProcessListModel.h"
+#include "SortKeys.h"
+
+// Answers "which row is the next one whose name starts with ..." (the list
+// view's LVN_ODFINDITEM, used for type-to-select) without scanning every
+// row. The rows are kept ordered by the rank of their case folded name, so
+// the rows matching a prefix are a contiguous range found by binary search.
+// The index is rebuilt lazily after rows change, re-sorting the list doesn't
+// affect it.
+class ProcessNameIndex
+{
+public:
+    // Finds the matching row shown at the first position at or after
+    // startPosition, wrapping around to the top if wrap is set. With
+    // partial, names only need to start with text, otherwise they need to
+    // match it entirely (ignoring case). Returns the position.
+    std::optional<size_t> Find(ProcessListModel const& model, FoldedStringRanks& names, std::wstring_view text,
+        bool partial, size_t startPosition, bool wrap)
+    {
+        EnsureCurrent(model, names);
+        auto& table = model.Table();
+        auto folded = FoldCase(text);
+        auto getFolded = [&](uint32_t row) -> std::wstring const&
+        {
+            return names.GetFolded(table.NameId(row));
+        };
+
+        auto first = std::lower_bound(m_rows.begin(), m_rows.end(), folded, [&](uint32_t row, std::wstring const& value)
+            {
+                return getFolded(row) < value;
+            });
+
+        std::optional<size_t> nextPosition;
+        std::optional<size_t> firstPosition;
+        for (auto it = first; it != m_rows.end(); it++)
+        {
+            auto& name = getFolded(*it);
+            auto matches = partial ?
+                name.compare(0, folded.size(), folded) == 0 :
+                name == folded;
+            if (!matches)
+            {
+                break;
+            }
+            auto position = static_cast<size_t>(model.PositionOf(*it));
+            if (position == ProcessListModel::InvalidPosition)
+            {
+                continue;
+            }
+            if (position >= startPosition && (!nextPosition || position < *nextPosition))
+            {
+                nextPosition = position;
+            }
+            if (!firstPosition || position < *firstPosition)
+            {
+                firstPosition = position;
+            }
+        }
+
+        if (nextPosition)
+        {
+            return nextPosition;
+        }
+        return wrap ? firstPosition : std::nullopt;
+    }
+
+private:
+    void EnsureCurrent(ProcessListModel const& model, FoldedStringRanks& names)
+    {
+        auto& table = model.Table();
+        names.Update(table.Strings());
+        if (m_version && *m_version == model.RowsVersion())
+        {
+            return;
+        }
+
+        // Sort by (rank, row) with the same radix sort the list uses
+        std::vector<uint64_t> keys(table.size());
+        m_rows.resize(table.size());
+        for (uint32_t row = 0; row < table.size(); row++)
+        {
+            keys[row] = MakeSortKey(names.GetRank(table.NameId(row)), row, false);
+            m_rows[row] = row;
+        }
+        RadixSortByKey(keys, m_rows);
+        m_version = model.RowsVersion();
+    }
+
+private:
+    std::vector<uint32_t> m_rows;
+    std::optional<uint64_t> m_version;
+};
@@ -0,0 +1,122 @@
+#pragma once
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "Process.h"
+#include "RadixSort.h"
+
+// What changed between two snapshots of the running processes, as indices
+// into them. Processes are matched by identity, so a pid that was reused in
+// between shows up as one removal and one addition.
+struct ProcessSnapshotDiff
+{
+    // Into the old snapshot
+    std::vector<uint32_t> Removed;
+    // Into the new snapshot
+    std::vector<uint32_t> Added;
+    // The same process with different fields, (old, new)
+    std::vector<std::pair<uint32_t, uint32_t>> Changed;
+
+    bool empty() const
+    {
+        return Removed.empty() && Added.empty() && Changed.empty();
+    }
+};
+
+// Whether the newer query of a process knows something the older one
+// doesn't or disagrees with it. Fields the newer one left pending aren't
+// compared, they are kept as they were.
+inline bool ProcessDiffers(Process const& before, Process const& after)
+{
+    auto known = ~after.Pending;
+    if (before.Name != after.Name || HasAnyField(before.Pending, known))
+    {
+        return true;
+    }
+    return
+        (HasAnyField(known, ProcessFields::ExecutablePath) &&
+            (before.ExecutablePath != after.ExecutablePath || before.Errors.ExecutablePath != after.Errors.ExecutablePath)) ||
+        (HasAnyField(known, ProcessFields::Type) &&
+            (before.Type != after.Type || before.Errors.Type != after.Errors.Type)) ||
+        (HasAnyField(known, ProcessFields::Architecture) &&
+            (before.ArchitectureValue != after.ArchitectureValue || before.Errors.Architecture != after.Errors.Architecture)) ||
+        (HasAnyField(known, ProcessFields::IntegrityLevel) &&
+            (before.IntegrityLevel != after.IntegrityLevel || before.Errors.IntegrityLevel != after.Errors.IntegrityLevel));
+}
+
+// Sorts indices by the pid getPid(index) returns, with a radix sort so it
+// stays linear in the number of processes.
+template <typename TGetPid>
+void SortIndicesByPid(std::vector<uint32_t>& indices, TGetPid&& getPid)
+{
+    std::vector<uint64_t> keys;
+    keys.reserve(indices.size());
+    for (auto index : indices)
+    {
+        keys.push_back(getPid(index));
+    }
+    RadixSortByKey(keys, indices);
+}
+
+// Walks two snapshots in pid order (see SortIndicesByPid) side by side, so
+// the diff costs one pass over both. Each snapshot has at most one process
+// per pid. getBefore/getAfter return the ProcessIdentity at an index and
+// differs(before, after) says whether the same process changed.
+template <typename TGetBefore, typename TGetAfter, typename TDiffers>
+ProcessSnapshotDiff DiffSortedSnapshots(std::vector<uint32_t> const& before, TGetBefore&& getBefore,
+    std::vector<uint32_t> const& after, TGetAfter&& getAfter, TDiffers&& differs)
+{
+    ProcessSnapshotDiff diff;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < before.size() && j < after.size())
+    {
+        ProcessIdentity left = getBefore(before[i]);
+        ProcessIdentity right = getAfter(after[j]);
+        if (left.Pid < right.Pid)
+        {
+            diff.Removed.push_back(before[i++]);
+        }
+        else if (right.Pid < left.Pid)
+        {
+            diff.Added.push_back(after[j++]);
+        }
+        else
+        {
+            if (left.CreationTime != right.CreationTime)
+            {
+                diff.Removed.push_back(before[i]);
+                diff.Added.push_back(after[j]);
+            }
+            else if (differs(before[i], after[j]))
+            {
+                diff.Changed.emplace_back(before[i], after[j]);
+            }
+            i++;
+            j++;
+        }
+    }
+    diff.Removed.insert(diff.Removed.end(), before.begin() + i, before.end());
+    diff.Added.insert(diff.Added.end(), after.begin() + j, after.end());
+    return diff;
+}
+
+inline std::vector<uint32_t> GetIndicesByPid(std::vector<Process> const& processes)
+{
+    std::vector<uint32_t> indices(processes.size());
+    for (uint32_t i = 0; i < indices.size(); i++)
+    {
+        indices[i] = i;
+    }
+    SortIndicesByPid(indices, [&processes](uint32_t index) { return processes[index].Pid; });
+    return indices;
+}
+
+// Neither snapshot has to be sorted
+inline ProcessSnapshotDiff DiffProcessSnapshots(std::vector<Process> const& before, std::vector<Process> const& after)
+{
+    return DiffSortedSnapshots(
+        GetIndicesByPid(before), [&before](uint32_t index) { return before[index].GetIdentity(); },
+        GetIndicesByPid(after), [&after](uint32_t index) { return after[index].GetIdentity(); },
+        [&](uint32_t left, uint32_t right) { return ProcessDiffers(before[left], after[right]); });
+}
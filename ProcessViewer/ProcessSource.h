@@ -0,0 +1,228 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "Process.h"
+#include "ProcessMetadataCache.h"
+#include "ParallelTransform.h"
+
+struct EnrichmentStatistics
+{
+    uint64_t Processes = 0;
+    // Number of processes that hit each failure class at least once
+    uint64_t AccessDenied = 0;
+    uint64_t ProcessExited = 0;
+    uint64_t NotAvailable = 0;
+    uint64_t Unexpected = 0;
+};
+
+// Where process information comes from. Enumeration only needs to produce
+// the cheap identity of each process, everything else is filled in by
+// EnrichProcess, which may be called from several threads at once. Fields
+// can be queried separately, so ones that aren't needed yet are skipped.
+class ProcessSource
+{
+public:
+    virtual ~ProcessSource() = default;
+
+    virtual std::vector<ProcessEntry> EnumerateProcesses() = 0;
+
+    // Sources that can't fill ProcessEntry::CreationTime cheaply during
+    // enumeration look it up here. Returns 0 if it can't be queried.
+    virtual uint64_t QueryCreationTime(ProcessEntry const& entry)
+    {
+        return entry.CreationTime;
+    }
+
+    // Returns std::nullopt if the process no longer exists. Processes that
+    // exist but can't be queried are returned with their unknown fields left
+    // empty (IMAGE_FILE_MACHINE_UNKNOWN, std::nullopt, etc) and the reason
+    // recorded in Process::Errors. Fields that weren't asked for are left
+    // unknown and marked as pending.
+    std::optional<Process> EnrichProcess(ProcessEntry const& entry, ProcessFields fields = ProcessFields::All)
+    {
+        auto result = TryEnrichProcess(entry, fields);
+        m_counters[0].fetch_add(1, std::memory_order_relaxed);
+        if (!result)
+        {
+            RecordError(result.error());
+            return std::nullopt;
+        }
+
+        std::array<bool, QueryErrorCount> seen = {};
+        auto& errors = result->Errors;
+        for (auto error : { errors.ExecutablePath, errors.Type, errors.Architecture, errors.IntegrityLevel })
+        {
+            auto index = static_cast<size_t>(error);
+            if (error != QueryError::None && !seen[index])
+            {
+                seen[index] = true;
+                RecordError(error);
+            }
+        }
+        result->Pending = ~fields;
+        return std::move(result).to_optional();
+    }
+
+    EnrichmentStatistics GetEnrichmentStatistics() const
+    {
+        auto load = [this](size_t index) { return m_counters[index].load(std::memory_order_relaxed); };
+        EnrichmentStatistics statistics;
+        statistics.Processes = load(0);
+        statistics.AccessDenied = load(static_cast<size_t>(QueryError::AccessDenied));
+        statistics.ProcessExited = load(static_cast<size_t>(QueryError::ProcessExited));
+        statistics.NotAvailable = load(static_cast<size_t>(QueryError::NotAvailable));
+        statistics.Unexpected = load(static_cast<size_t>(QueryError::Unexpected));
+        return statistics;
+    }
+
+protected:
+    // Only needs to query the given fields
+    virtual QueryResult<Process> TryEnrichProcess(ProcessEntry const& entry, ProcessFields fields) = 0;
+
+private:
+    void RecordError(QueryError error)
+    {
+        m_counters[static_cast<size_t>(error)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Indexed by QueryError, QueryError::None counts every enrichment
+    std::array<std::atomic<uint64_t>, QueryErrorCount> m_counters = {};
+};
+
+inline std::vector<Process> CollectProcesses(std::vector<std::optional<Process>>&& processes, bool keepInaccessible)
+{
+    std::vector<Process> result;
+    result.reserve(processes.size());
+    for (auto&& process : processes)
+    {
+        if (process.has_value())
+        {
+            if (keepInaccessible || process->ArchitectureValue != IMAGE_FILE_MACHINE_UNKNOWN)
+            {
+                result.push_back(std::move(*process));
+            }
+        }
+    }
+    return result;
+}
+
+// Enumeration itself is cheap, the per-process queries are not. Enumerate
+// first and then fan the enrichment out across a worker pool. The result
+// keeps the enumeration order.
+inline std::vector<Process> GetAllProcesses(ProcessSource& source, bool keepInaccessible = true, size_t maxConcurrency = GetDefaultConcurrency())
+{
+    auto entries = source.EnumerateProcesses();
+    auto processes = ParallelTransform(entries, [&source](ProcessEntry const& entry)
+        {
+            return source.EnrichProcess(entry);
+        }, maxConcurrency);
+    return CollectProcesses(std::move(processes), keepInaccessible);
+}
+
+// Queries the fields of a process that are still pending and updates the
+// cache. Returns false if the process has exited (or its pid was reused), in
+// which case the fields are marked as failed so they aren't queried again.
+inline bool ResolveFields(ProcessSource& source, ProcessMetadataCache& cache, Process& process, ProcessFields fields)
+{
+    fields = fields & process.Pending;
+    if (fields == ProcessFields::None)
+    {
+        return true;
+    }
+    auto resolved = source.EnrichProcess({ process.Pid, process.Name, process.CreationTime }, fields);
+    if (!resolved.has_value() ||
+        (process.CreationTime != 0 && resolved->CreationTime != 0 && resolved->CreationTime != process.CreationTime))
+    {
+        auto exited = process;
+        exited.Errors.Set(fields, QueryError::ProcessExited);
+        process.ResolveFrom(exited, fields);
+        return false;
+    }
+    process.ResolveFrom(*resolved, fields);
+    cache.Insert(process);
+    return true;
+}
+
+// Only queries the fields the cache doesn't already have for the process.
+// Other fields are left pending.
+inline std::optional<Process> EnrichProcess(ProcessSource& source, ProcessMetadataCache& cache, ProcessEntry entry, ProcessFields fields = ProcessFields::All)
+{
+    entry.CreationTime = source.QueryCreationTime(entry);
+    auto cached = cache.Lookup(entry);
+    auto process = cached.has_value() ? std::move(*cached) : CreatePendingProcess(entry);
+    if (HasAnyField(process.Pending, fields))
+    {
+        if (!ResolveFields(source, cache, process, fields))
+        {
+            return std::nullopt;
+        }
+    }
+    else if (!cached.has_value())
+    {
+        cache.Insert(process);
+    }
+    return process;
+}
+
+// Same as above, but processes the cache already knows about are reused
+// instead of being queried again. Processes that are gone are evicted. Only
+// the given fields are queried up front (plus the architecture when
+// inaccessible processes are filtered out), the rest can be resolved later.
+inline std::vector<Process> GetAllProcesses(ProcessSource& source, ProcessMetadataCache& cache, bool keepInaccessible = true,
+    ProcessFields fields = ProcessFields::All, size_t maxConcurrency = GetDefaultConcurrency())
+{
+    if (!keepInaccessible)
+    {
+        fields = fields | ProcessFields::Architecture;
+    }
+    auto entries = source.EnumerateProcesses();
+    auto processes = ParallelTransform(entries, [&source, &cache, fields](ProcessEntry const& entry)
+        {
+            return EnrichProcess(source, cache, entry, fields);
+        }, maxConcurrency);
+    cache.EvictAllExcept(entries);
+    return CollectProcesses(std::move(processes), keepInaccessible);
+}
+
+// Same as above, but the processes are handed to batchReady
+// (std::vector<Process>&&) as they are queried rather than all at the end, so
+// the first ones can be shown long before the last ones are done. Batches
+// start at firstBatchSize and double up to maxBatchSize: the first rows come
+// quickly, and a consumer that merges each batch into a sorted list only
+// does a handful of merges. batchReady is called on the calling thread and
+// can return false to stop early. Returns the number of processes
+// delivered.
+template <typename TBatchReady>
+size_t StreamAllProcesses(ProcessSource& source, ProcessMetadataCache& cache, TBatchReady&& batchReady, bool keepInaccessible = true,
+    ProcessFields fields = ProcessFields::All, size_t firstBatchSize = 32, size_t maxBatchSize = 1024, size_t maxConcurrency = GetDefaultConcurrency())
+{
+    if (!keepInaccessible)
+    {
+        fields = fields | ProcessFields::Architecture;
+    }
+    auto entries = source.EnumerateProcesses();
+    cache.EvictAllExcept(entries);
+
+    size_t delivered = 0;
+    auto batchSize = std::max<size_t>(firstBatchSize, 1);
+    std::vector<ProcessEntry> batchEntries;
+    for (size_t begin = 0; begin < entries.size(); begin += batchEntries.size())
+    {
+        auto end = std::min(entries.size(), begin + batchSize);
+        batchEntries.assign(entries.begin() + begin, entries.begin() + end);
+        auto processes = ParallelTransform(batchEntries, [&source, &cache, fields](ProcessEntry const& entry)
+            {
+                return EnrichProcess(source, cache, entry, fields);
+            }, maxConcurrency);
+        auto batch = CollectProcesses(std::move(processes), keepInaccessible);
+        delivered += batch.size();
+        if (!batchReady(std::move(batch)))
+        {
+            break;
+        }
+        batchSize = std::min(batchSize * 2, std::max(maxBatchSize, firstBatchSize));
+    }
+    return delivered;
+}
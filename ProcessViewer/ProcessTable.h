@@ -0,0 +1,301 @@
+#pragma once
+#include <algorithm>
+#include <optional>
+#include <vector>
+#include "Process.h"
+#include "StringPool.h"
+
+// Column oriented storage for processes. The fixed width fields are kept in
+// their own packed arrays and the names and paths are interned, so scanning
+// a column (e.g. looking up a pid or sorting) only touches the bytes it
+// needs. Use GetProcess to get a row back as a Process.
+class ProcessTable
+{
+public:
+    size_t size() const
+    {
+        return m_pids.size();
+    }
+
+    bool empty() const
+    {
+        return m_pids.empty();
+    }
+
+    void clear()
+    {
+        ForEachColumn([](auto& column) { column.clear(); });
+    }
+
+    void reserve(size_t capacity)
+    {
+        ForEachColumn([capacity](auto& column) { column.reserve(capacity); });
+    }
+
+    size_t Append(Process const& process)
+    {
+        m_pids.push_back(process.Pid);
+        m_creationTimes.push_back(process.CreationTime);
+        m_nameIds.push_back(m_strings.Intern(process.Name));
+        m_pathIds.push_back(m_strings.Intern(process.ExecutablePath));
+        m_architectureValues.push_back(process.ArchitectureValue);
+        m_types.push_back(PackType(process.Type));
+        m_integrityLevels.push_back(PackIntegrityLevel(process.IntegrityLevel));
+        m_errors.push_back(PackErrors(process.Errors));
+        m_pending.push_back(process.Pending);
+        return m_pids.size() - 1;
+    }
+
+    // Starts the string pool over too, so strings only the old rows used go
+    void Assign(std::vector<Process> const& processes)
+    {
+        clear();
+        m_strings.clear();
+        reserve(processes.size());
+        for (auto&& process : processes)
+        {
+            Append(process);
+        }
+    }
+
+    // Overwrites an existing row, e.g. one that was freed and is being reused
+    void Set(size_t row, Process const& process)
+    {
+        m_pids[row] = process.Pid;
+        m_creationTimes[row] = process.CreationTime;
+        m_nameIds[row] = m_strings.Intern(process.Name);
+        m_pathIds[row] = m_strings.Intern(process.ExecutablePath);
+        m_architectureValues[row] = process.ArchitectureValue;
+        m_types[row] = PackType(process.Type);
+        m_integrityLevels[row] = PackIntegrityLevel(process.IntegrityLevel);
+        m_errors[row] = PackErrors(process.Errors);
+        m_pending[row] = process.Pending;
+    }
+
+    // Fills in fields of a row that were pending from a later query of the
+    // same process, a Process or a ProcessView
+    template <typename TProcess>
+    void ResolveFields(size_t row, TProcess const& process, ProcessFields fields)
+    {
+        auto errors = Errors(row);
+        if (HasAnyField(fields, ProcessFields::ExecutablePath))
+        {
+            m_pathIds[row] = m_strings.Intern(process.ExecutablePath);
+            errors.ExecutablePath = process.Errors.ExecutablePath;
+        }
+        if (HasAnyField(fields, ProcessFields::Type))
+        {
+            m_types[row] = PackType(process.Type);
+            errors.Type = process.Errors.Type;
+        }
+        if (HasAnyField(fields, ProcessFields::Architecture))
+        {
+            m_architectureValues[row] = process.ArchitectureValue;
+            errors.Architecture = process.Errors.Architecture;
+        }
+        if (HasAnyField(fields, ProcessFields::IntegrityLevel))
+        {
+            m_integrityLevels[row] = PackIntegrityLevel(process.IntegrityLevel);
+            errors.IntegrityLevel = process.Errors.IntegrityLevel;
+        }
+        m_errors[row] = PackErrors(errors);
+        m_pending[row] = m_pending[row] & ~fields;
+    }
+
+    // Brings a row up to date with a newer query of the same process. Fields
+    // the query left pending keep their current values.
+    void Update(size_t row, Process const& process)
+    {
+        m_nameIds[row] = m_strings.Intern(process.Name);
+        ResolveFields(row, process, ~process.Pending);
+    }
+
+    // Same as ProcessDiffers, for a row and a newer query of its process
+    bool Differs(size_t row, Process const& process) const
+    {
+        auto known = ~process.Pending;
+        if (Name(row) != process.Name || HasAnyField(PendingFields(row), known))
+        {
+            return true;
+        }
+        auto errors = Errors(row);
+        return
+            (HasAnyField(known, ProcessFields::ExecutablePath) &&
+                (ExecutablePath(row) != process.ExecutablePath || errors.ExecutablePath != process.Errors.ExecutablePath)) ||
+            (HasAnyField(known, ProcessFields::Type) &&
+                (Type(row) != process.Type || errors.Type != process.Errors.Type)) ||
+            (HasAnyField(known, ProcessFields::Architecture) &&
+                (ArchitectureValue(row) != process.ArchitectureValue || errors.Architecture != process.Errors.Architecture)) ||
+            (HasAnyField(known, ProcessFields::IntegrityLevel) &&
+                (IntegrityLevel(row) != process.IntegrityLevel || errors.IntegrityLevel != process.Errors.IntegrityLevel));
+    }
+
+    Process GetProcess(size_t row) const
+    {
+        return
+        {
+            Pid(row),
+            CreationTime(row),
+            Name(row),
+            ExecutablePath(row),
+            Type(row),
+            ArchitectureValue(row),
+            IntegrityLevel(row),
+            Errors(row),
+            PendingFields(row),
+        };
+    }
+
+    uint32_t Pid(size_t row) const { return m_pids[row]; }
+    uint64_t CreationTime(size_t row) const { return m_creationTimes[row]; }
+    ProcessKey Key(size_t row) const { return ProcessKey::From(m_pids[row], m_creationTimes[row]); }
+    ProcessIdentity Identity(size_t row) const { return { m_pids[row], m_creationTimes[row] }; }
+    uint32_t NameId(size_t row) const { return m_nameIds[row]; }
+    uint32_t ExecutablePathId(size_t row) const { return m_pathIds[row]; }
+    std::wstring const& Name(size_t row) const { return m_strings.Get(m_nameIds[row]); }
+    std::wstring const& ExecutablePath(size_t row) const { return m_strings.Get(m_pathIds[row]); }
+    uint16_t ArchitectureValue(size_t row) const { return m_architectureValues[row]; }
+    Architecture GetArchitecture(size_t row) const { return MachineValueToArchitecture(m_architectureValues[row]); }
+
+    std::optional<ProcessType> Type(size_t row) const
+    {
+        auto value = m_types[row];
+        return value == UnknownType ? std::nullopt : std::optional(static_cast<ProcessType>(value - 1));
+    }
+
+    std::optional<::IntegrityLevel> IntegrityLevel(size_t row) const
+    {
+        auto value = m_integrityLevels[row];
+        return value == UnknownIntegrityLevel ? std::nullopt : std::optional(static_cast<::IntegrityLevel>(value));
+    }
+
+    ProcessFields PendingFields(size_t row) const { return m_pending[row]; }
+
+    ProcessQueryErrors Errors(size_t row) const
+    {
+        auto packed = m_errors[row];
+        ProcessQueryErrors errors;
+        errors.ExecutablePath = static_cast<QueryError>(packed & 0xF);
+        errors.Type = static_cast<QueryError>((packed >> 4) & 0xF);
+        errors.Architecture = static_cast<QueryError>((packed >> 8) & 0xF);
+        errors.IntegrityLevel = static_cast<QueryError>((packed >> 12) & 0xF);
+        return errors;
+    }
+
+    StringPool const& Strings() const
+    {
+        return m_strings;
+    }
+
+    // Drops strings that no row inUse(row) returns true for refers to, once
+    // they make up a third of the pool. Other rows are left with empty
+    // strings, they are expected to be overwritten with Set. Returns true if
+    // the pool was compacted, which renumbers the ids.
+    template <typename TInUse>
+    bool CompactStrings(TInUse&& inUse)
+    {
+        std::vector<bool> referenced(m_strings.size());
+        referenced[StringPool::EmptyId] = true;
+        size_t referencedCount = 1;
+        auto mark = [&](uint32_t id)
+        {
+            if (!referenced[id])
+            {
+                referenced[id] = true;
+                referencedCount++;
+            }
+        };
+        for (uint32_t row = 0; row < size(); row++)
+        {
+            if (inUse(row))
+            {
+                mark(m_nameIds[row]);
+                mark(m_pathIds[row]);
+            }
+        }
+        if ((m_strings.size() - referencedCount) * 3 < m_strings.size())
+        {
+            return false;
+        }
+
+        auto remap = m_strings.Compact([&referenced](uint32_t id) { return referenced[id]; });
+        for (size_t row = 0; row < size(); row++)
+        {
+            m_nameIds[row] = remap[m_nameIds[row]];
+            m_pathIds[row] = remap[m_pathIds[row]];
+        }
+        return true;
+    }
+
+    // Approximate number of bytes used by the rows and the string pool
+    size_t GetMemoryUsage() const
+    {
+        size_t bytes = 0;
+        ForEachColumn([&bytes](auto const& column) { bytes += column.capacity() * sizeof(column[0]); });
+        return bytes + m_strings.GetMemoryUsage();
+    }
+
+private:
+    static constexpr uint8_t UnknownType = 0;
+    static constexpr uint16_t UnknownIntegrityLevel = 0xFFFF;
+
+    static uint8_t PackType(std::optional<ProcessType> type)
+    {
+        return type.has_value() ? static_cast<uint8_t>(static_cast<uint8_t>(*type) + 1) : UnknownType;
+    }
+
+    static uint16_t PackIntegrityLevel(std::optional<::IntegrityLevel> ilevel)
+    {
+        // Every known integrity level RID fits in 16 bits
+        return ilevel.has_value() ? static_cast<uint16_t>(*ilevel) : UnknownIntegrityLevel;
+    }
+
+    static uint16_t PackErrors(ProcessQueryErrors const& errors)
+    {
+        return static_cast<uint16_t>(
+            static_cast<uint16_t>(errors.ExecutablePath) |
+            (static_cast<uint16_t>(errors.Type) << 4) |
+            (static_cast<uint16_t>(errors.Architecture) << 8) |
+            (static_cast<uint16_t>(errors.IntegrityLevel) << 12));
+    }
+
+    template <typename TFunc>
+    void ForEachColumn(TFunc&& func)
+    {
+        func(m_pids);
+        func(m_creationTimes);
+        func(m_nameIds);
+        func(m_pathIds);
+        func(m_architectureValues);
+        func(m_types);
+        func(m_integrityLevels);
+        func(m_errors);
+        func(m_pending);
+    }
+
+    template <typename TFunc>
+    void ForEachColumn(TFunc&& func) const
+    {
+        func(m_pids);
+        func(m_creationTimes);
+        func(m_nameIds);
+        func(m_pathIds);
+        func(m_architectureValues);
+        func(m_types);
+        func(m_integrityLevels);
+        func(m_errors);
+        func(m_pending);
+    }
+
+private:
+    StringPool m_strings;
+    std::vector<uint32_t> m_pids;
+    std::vector<uint64_t> m_creationTimes;
+    std::vector<uint32_t> m_nameIds;
+    std::vector<uint32_t> m_pathIds;
+    std::vector<uint16_t> m_architectureValues;
+    std::vector<uint8_t> m_types;
+    std::vector<uint16_t> m_integrityLevels;
+    std::vector<uint16_t> m_errors;
+    std::vector<ProcessFields> m_pending;
+};
@@ -6,74 +6,69 @@ namespace winrt
     using namespace Windows::System;
 }
 
-ProcessWatcher::ProcessWatcher(winrt::DispatcherQueue const& dispatcherQueue, ProcessAddedCallback processAdded, ProcessRemovedCallback processRemoved)
+ProcessWatcher::ProcessWatcher(winrt::DispatcherQueue const& dispatcherQueue, ProcessSource& source, ProcessMetadataCache& cache,
+    std::unique_ptr<ProcessWatcherBackend> backend, ProcessesChangedCallback processesChanged, std::chrono::milliseconds batchWindow)
 {
     m_dispatcherQueue = dispatcherQueue;
-    m_processAdded = processAdded;
-    m_processRemoved = processRemoved;
+    m_processesChanged = processesChanged;
 
-    auto locator = winrt::create_instance<IWbemLocator>(CLSID_WbemLocator);
-    winrt::check_hresult(locator->ConnectServer(BSTR(L"ROOT\\CIMV2"), nullptr, nullptr, 0, 0, 0, 0, m_services.put()));
+    // Must be created on the dispatcher queue's thread, which is where the
+    // batches are delivered
+    m_flushTimer = m_dispatcherQueue.CreateTimer();
+    m_flushTimer.Interval(batchWindow);
+    m_flushTimer.IsRepeating(false);
+    m_flushTimerTick = m_flushTimer.Tick(winrt::auto_revoke, [&](auto&&, auto&&)
+        {
+            Flush();
+        });
 
-    winrt::check_hresult(CoSetProxyBlanket(
-        m_services.get(),
-        RPC_C_AUTHN_WINNT,
-        RPC_C_AUTHZ_NONE,
-        nullptr,
-        RPC_C_AUTHN_LEVEL_CALL,
-        RPC_C_IMP_LEVEL_IMPERSONATE,
-        nullptr,
-        EOAC_NONE));
+    m_pipeline = std::make_shared<ProcessEventPipeline>(source, cache, ProcessEventPipeline::DrainNeededCallback([&]()
+        {
+            ScheduleDrain();
+        }));
 
-    m_unsecuredApartment = winrt::create_instance<IUnsecuredApartment>(CLSID_UnsecuredApartment, CLSCTX_LOCAL_SERVER);
-    m_sink = winrt::make_self<EventSink>(EventSink::EventSinkCallback([&](winrt::array_view<IWbemClassObject*> const& objs)
+    m_backend = std::move(backend);
+    m_backend->Start(
+        ProcessWatcherBackend::ProcessStartedCallback([&](ProcessEntry entry)
         {
-            for (auto& objRaw : objs)
-            {
-                winrt::com_ptr<IWbemClassObject> obj;
-                obj.copy_from(objRaw);
-                auto targetInstance = GetProperty<winrt::com_ptr<IUnknown>>(obj, L"TargetInstance");
-                auto win32Process = targetInstance.as<IWbemClassObject>();
-                
-                auto classNameBstr = GetProperty<wil::unique_bstr>(obj, L"__CLASS");
-                auto className = std::wstring(classNameBstr.get(), SysStringLen(classNameBstr.get()));
-                if (className == L"__InstanceCreationEvent")
-                {
-                    auto name = GetProperty<wil::unique_bstr>(win32Process, L"Name");
-                    auto processId = GetProperty<uint32_t>(win32Process, L"ProcessId");
-                    if (auto processOpt = CreateProcessFromPid(processId, std::wstring(name.get(), SysStringLen(name.get()))))
-                    {
-                        auto process = *processOpt;
-                        auto processAdded = m_processAdded;
-                        m_dispatcherQueue.TryEnqueue([process, processAdded]()
-                            {
-                                processAdded(process);
-                            });
-                    }
-                }
-                else if (className == L"__InstanceDeletionEvent")
-                {
-                    auto processId = GetProperty<uint32_t>(win32Process, L"ProcessId");
-                    auto processRemoved = m_processRemoved;
-                    m_dispatcherQueue.TryEnqueue([processId, processRemoved]()
-                        {
-                            processRemoved(processId);
-                        });
-                }
-            }
+            m_pipeline->OnProcessStarted(std::move(entry));
+        }),
+        ProcessWatcherBackend::ProcessExitedCallback([&](ProcessKey key, std::wstring_view name)
+        {
+            m_pipeline->OnProcessExited(key, name);
         }));
-    winrt::com_ptr<IUnknown> stubUnknown;
-    winrt::check_hresult(m_unsecuredApartment->CreateObjectStub(m_sink.get(), stubUnknown.put()));
-    m_sinkStub = stubUnknown.as<IWbemObjectSink>();
-    winrt::check_hresult(m_services->ExecNotificationQueryAsync(
-        BSTR(L"WQL"),
-        BSTR(L"SELECT * FROM __InstanceOperationEvent WITHIN 1 WHERE TargetInstance ISA 'Win32_Process'"),
-        WBEM_FLAG_SEND_STATUS,
-        nullptr,
-        m_sinkStub.get()));
 }
 
 ProcessWatcher::~ProcessWatcher()
 {
-    winrt::check_hresult(m_services->CancelAsyncCall(m_sinkStub.get()));
+    m_backend->Stop();
+    m_pipeline.reset();
+    m_flushTimerTick.revoke();
+    m_flushTimer.Stop();
+}
+
+void ProcessWatcher::ScheduleDrain()
+{
+    // Called from the backend's (or an enrichment worker's) thread, the ring
+    // is drained on the dispatcher queue's thread. The pipeline and the timer
+    // are captured rather than this so nothing dangles if the watcher goes
+    // away first.
+    m_dispatcherQueue.TryEnqueue([pipeline = std::weak_ptr(m_pipeline), timer = m_flushTimer]()
+        {
+            auto current = pipeline.lock();
+            if (current && current->Drain())
+            {
+                timer.Start();
+            }
+        });
+}
+
+void ProcessWatcher::Flush()
+{
+    auto batch = m_pipeline->TakeBatch();
+    if (!batch.empty())
+    {
+        m_processesChanged(batch);
+    }
+    m_pipeline->Recycle(std::move(batch));
 }
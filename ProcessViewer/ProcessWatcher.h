@@ -1,22 +1,49 @@
 #pragma once
-#include "Process.h"
+#include "ProcessEventPipeline.h"
+#include "ProcessSource.h"
+#include "ProcessWatcherBackend.h"
 
+// Watches for processes starting and exiting using the given backend. Events
+// go through a ProcessEventPipeline, which is drained on the dispatcher
+// queue's thread whenever events arrive, and the batches are delivered there
+// after a short window.
 class ProcessWatcher
 {
 public:
-    using ProcessAddedCallback = std::function<void(Process)>;
-    using ProcessRemovedCallback = std::function<void(DWORD)>;
+    using ProcessesChangedCallback = std::function<void(ProcessEventBatch const&)>;
 
-    ProcessWatcher(winrt::Windows::System::DispatcherQueue const& dispatcherQueue, ProcessAddedCallback processAdded, ProcessRemovedCallback processRemoved);
+    static constexpr std::chrono::milliseconds DefaultBatchWindow{ 50 };
+
+    ProcessWatcher(winrt::Windows::System::DispatcherQueue const& dispatcherQueue, ProcessSource& source, ProcessMetadataCache& cache,
+        std::unique_ptr<ProcessWatcherBackend> backend, ProcessesChangedCallback processesChanged, std::chrono::milliseconds batchWindow = DefaultBatchWindow);
     ~ProcessWatcher();
 
+    ProcessEventCoalescerStatistics GetStatistics()
+    {
+        return m_pipeline->GetStatistics();
+    }
+
+    EnrichmentStageStatistics GetEnrichmentStatistics()
+    {
+        return m_pipeline->GetEnrichmentStatistics();
+    }
+
+    ProcessEventRingStatistics GetRingStatistics()
+    {
+        return m_pipeline->GetRingStatistics();
+    }
+
 private:
-    winrt::com_ptr<IWbemServices> m_services;
-    winrt::com_ptr<IUnsecuredApartment> m_unsecuredApartment;
-    winrt::com_ptr<EventSink> m_sink;
-    winrt::com_ptr<IWbemObjectSink> m_sinkStub;
+    void ScheduleDrain();
+    void Flush();
 
-    ProcessAddedCallback m_processAdded;
-    ProcessRemovedCallback m_processRemoved;
+private:
+    ProcessesChangedCallback m_processesChanged;
     winrt::Windows::System::DispatcherQueue m_dispatcherQueue{ nullptr };
+    winrt::Windows::System::DispatcherQueueTimer m_flushTimer{ nullptr };
+    winrt::Windows::System::DispatcherQueueTimer::Tick_revoker m_flushTimerTick;
+    // Shared so queued drains can tell whether it is still around
+    std::shared_ptr<ProcessEventPipeline> m_pipeline;
+    // Delivers into m_pipeline, so it has to go away first
+    std::unique_ptr<ProcessWatcherBackend> m_backend;
 };
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include "Process.h"
+
+// Where process start and exit notifications come from. A backend delivers
+// them on a thread of its own between Start and Stop, in the order they
+// happened. Starts only need the cheap identity of the process, enrichment
+// happens further down the pipeline (see ProcessWatcher). Exits name the
+// process by its key, with a generation of 0 if the backend doesn't know
+// when the process started. Backends whose creation times are only
+// approximate name it by its name as well (see ExitMatches), the others
+// leave the name empty. A process that replaces its image (exec on
+// Linux) stays the same process: it is reported as started again under its
+// new name, with the same key and no exit.
+class ProcessWatcherBackend
+{
+public:
+    using ProcessStartedCallback = std::function<void(ProcessEntry)>;
+    using ProcessExitedCallback = std::function<void(ProcessKey, std::wstring_view)>;
+
+    virtual ~ProcessWatcherBackend() = default;
+
+    // Called once. Throws if the backend can't watch processes.
+    virtual void Start(ProcessStartedCallback started, ProcessExitedCallback exited) = 0;
+
+    // No callbacks are running or will run once this returns
+    virtual void Stop() = 0;
+};
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <optional>
+#include <utility>
+
+// Why a piece of process information couldn't be queried. These are
+// expected outcomes (most processes on a locked down machine can't be
+// opened), so they are returned as values instead of thrown.
+enum class QueryError : uint8_t
+{
+    None,
+    AccessDenied,
+    ProcessExited,
+    NotAvailable,
+    Unexpected,
+};
+
+constexpr size_t QueryErrorCount = static_cast<size_t>(QueryError::Unexpected) + 1;
+
+// Either a value or the QueryError describing why there isn't one.
+template <typename T>
+class QueryResult
+{
+public:
+    QueryResult(T value) : m_value(std::move(value)) {}
+    QueryResult(QueryError error) : m_error(error)
+    {
+        if (error == QueryError::None)
+        {
+            std::abort();
+        }
+    }
+
+    bool has_value() const { return m_value.has_value(); }
+    explicit operator bool() const { return has_value(); }
+    QueryError error() const { return m_error; }
+
+    T& value() { return *m_value; }
+    T const& value() const { return *m_value; }
+    T& operator*() { return *m_value; }
+    T const& operator*() const { return *m_value; }
+    T* operator->() { return &*m_value; }
+    T const* operator->() const { return &*m_value; }
+
+    std::optional<T> to_optional() &&
+    {
+        return std::move(m_value);
+    }
+
+private:
+    std::optional<T> m_value;
+    QueryError m_error = QueryError::None;
+};
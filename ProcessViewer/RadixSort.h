@@ -0,0 +1,86 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "ParallelTransform.h"
+
+// Below this many items the bookkeeping for threads costs more than it saves
+constexpr size_t ParallelRadixSortThreshold = 1 << 16;
+
+// Stable LSD radix sort of values by their 64-bit keys, one byte per pass.
+// Passes where every key has the same byte (e.g. the high bytes of small
+// keys) are skipped. Large inputs build their histograms and scatter on
+// up to maxConcurrency threads, each owning a contiguous chunk of the input
+// so the result stays stable.
+inline void RadixSortByKey(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, size_t maxConcurrency = GetDefaultConcurrency())
+{
+    const auto count = keys.size();
+    if (count < 2)
+    {
+        return;
+    }
+
+    size_t chunkCount = 1;
+    if (count >= ParallelRadixSortThreshold)
+    {
+        chunkCount = std::max<size_t>(1, std::min(maxConcurrency, count / (ParallelRadixSortThreshold / 4)));
+    }
+    const auto chunkSize = (count + chunkCount - 1) / chunkCount;
+
+    std::vector<uint64_t> scratchKeys(count);
+    std::vector<uint32_t> scratchValues(count);
+    std::vector<std::array<size_t, 256>> histograms(chunkCount);
+
+    for (uint32_t shift = 0; shift < 64; shift += 8)
+    {
+        ParallelFor(chunkCount, [&](size_t chunk)
+            {
+                auto& histogram = histograms[chunk];
+                histogram.fill(0);
+                auto end = std::min(count, (chunk + 1) * chunkSize);
+                for (auto i = chunk * chunkSize; i < end; i++)
+                {
+                    histogram[(keys[i] >> shift) & 0xFF]++;
+                }
+            }, chunkCount);
+
+        // Turn the per-chunk counts into per-chunk starting offsets. Digits
+        // are laid out in order, and within a digit the chunks are in order.
+        size_t offset = 0;
+        bool skipPass = false;
+        for (size_t digit = 0; digit < 256 && !skipPass; digit++)
+        {
+            size_t digitTotal = 0;
+            for (auto&& histogram : histograms)
+            {
+                digitTotal += histogram[digit];
+            }
+            skipPass = digitTotal == count;
+            for (auto&& histogram : histograms)
+            {
+                auto chunkTotal = histogram[digit];
+                histogram[digit] = offset;
+                offset += chunkTotal;
+            }
+        }
+        if (skipPass)
+        {
+            continue;
+        }
+
+        ParallelFor(chunkCount, [&](size_t chunk)
+            {
+                auto& offsets = histograms[chunk];
+                auto end = std::min(count, (chunk + 1) * chunkSize);
+                for (auto i = chunk * chunkSize; i < end; i++)
+                {
+                    auto destination = offsets[(keys[i] >> shift) & 0xFF]++;
+                    scratchKeys[destination] = keys[i];
+                    scratchValues[destination] = values[i];
+                }
+            }, chunkCount);
+
+        keys.swap(scratchKeys);
+        values.swap(scratchValues);
+    }
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include <algorithm>
+#include <cwctype>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ParallelTransform.h"
+#include "StringPool.h"
+
+inline wchar_t FoldCase(wchar_t value)
+{
+    return static_cast<wchar_t>(std::towlower(static_cast<std::wint_t>(value)));
+}
+
+inline std::wstring FoldCase(std::wstring_view value)
+{
+    std::wstring result(value);
+    for (auto&& character : result)
+    {
+        character = FoldCase(character);
+    }
+    return result;
+}
+
+// Case insensitive comparison that orders strings the same way sorting by
+// their FoldCase keys does.
+inline int CompareIgnoreCase(std::wstring_view left, std::wstring_view right)
+{
+    auto length = std::min(left.size(), right.size());
+    for (size_t i = 0; i < length; i++)
+    {
+        auto leftFolded = FoldCase(left[i]);
+        auto rightFolded = FoldCase(right[i]);
+        if (leftFolded != rightFolded)
+        {
+            return leftFolded < rightFolded ? -1 : 1;
+        }
+    }
+    if (left.size() == right.size())
+    {
+        return 0;
+    }
+    return left.size() < right.size() ? -1 : 1;
+}
+
+// Case folds every string in a StringPool once and ranks the folded strings,
+// so that sorting by name compares small integers instead of case folding
+// the same names over and over. Strings that fold to the same key share a
+// rank. Until the pool renumbers its ids it only grows, so updates only
+// fold the new strings.
+class FoldedStringRanks
+{
+public:
+    // Below this many new strings folding isn't worth spreading over threads
+    static constexpr size_t ParallelFoldThreshold = 4096;
+
+    void Update(StringPool const& pool, size_t maxConcurrency = GetDefaultConcurrency())
+    {
+        if (m_generation != pool.Generation())
+        {
+            m_folded.clear();
+            m_generation = pool.Generation();
+        }
+        auto first = m_folded.size();
+        auto count = pool.size();
+        if (first == count)
+        {
+            return;
+        }
+
+        m_folded.resize(count);
+        auto fold = [&](size_t id)
+        {
+            m_folded[id] = FoldCase(pool.Get(static_cast<uint32_t>(id)));
+        };
+        if (count - first >= ParallelFoldThreshold)
+        {
+            ParallelFor(count - first, [&](size_t index) { fold(first + index); }, maxConcurrency);
+        }
+        else
+        {
+            for (auto id = first; id < count; id++)
+            {
+                fold(id);
+            }
+        }
+
+        std::vector<uint32_t> ids(count);
+        std::iota(ids.begin(), ids.end(), 0);
+        std::sort(ids.begin(), ids.end(), [this](uint32_t left, uint32_t right)
+            {
+                return m_folded[left] < m_folded[right];
+            });
+        m_ranks.resize(count);
+        uint32_t rank = 0;
+        for (size_t i = 0; i < ids.size(); i++)
+        {
+            if (i > 0 && m_folded[ids[i]] != m_folded[ids[i - 1]])
+            {
+                rank++;
+            }
+            m_ranks[ids[i]] = rank;
+        }
+    }
+
+    std::wstring const& GetFolded(uint32_t id) const
+    {
+        return m_folded[id];
+    }
+
+    uint32_t GetRank(uint32_t id) const
+    {
+        return m_ranks[id];
+    }
+
+private:
+    std::vector<std::wstring> m_folded;
+    std::vector<uint32_t> m_ranks;
+    uint64_t m_generation = 0;
+};
+
+// Packs a column's sort value and the pid tie-breaker into one integer, so
+// that sorting the keys as plain integers gives the same order as comparing
+// the column and then the pid. Descending order is the exact reverse of
+// ascending (including the tie-breaker). The highest sort value is left to
+// MakePendingSortKey, so rows still waiting for the value sort last either
+// way.
+inline uint64_t MakeSortKey(uint32_t primary, uint32_t pid, bool descending)
+{
+    constexpr uint32_t MaxPrimary = UINT32_MAX - 1;
+    primary = std::min(primary, MaxPrimary);
+    if (descending)
+    {
+        return (static_cast<uint64_t>(MaxPrimary - primary) << 32) | static_cast<uint32_t>(~pid);
+    }
+    return (static_cast<uint64_t>(primary) << 32) | pid;
+}
+
+inline uint64_t MakePendingSortKey(uint32_t pid, bool descending)
+{
+    return (static_cast<uint64_t>(UINT32_MAX) << 32) | (descending ? static_cast<uint32_t>(~pid) : pid);
+}
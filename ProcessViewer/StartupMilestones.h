@@ -0,0 +1,83 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+
+enum class StartupMilestone : uint8_t
+{
+    // The list was first drawn, with or without rows
+    FirstPaint,
+    // The first batch of processes was shown
+    FirstRow,
+    // Every process of the startup snapshot was shown
+    FullSnapshot,
+};
+
+// When each startup milestone was reached, relative to when the timeline was
+// created. Milestones are only recorded the first time they are reached.
+class StartupTimeline
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr size_t MilestoneCount = 3;
+
+    explicit StartupTimeline(clock::time_point start = clock::now()) : m_start(start)
+    {
+    }
+
+    // Returns true if this is the first time the milestone was reached
+    bool Mark(StartupMilestone milestone, clock::time_point now = clock::now())
+    {
+        auto& time = m_times[static_cast<size_t>(milestone)];
+        if (time.has_value())
+        {
+            return false;
+        }
+        time = std::chrono::duration_cast<std::chrono::microseconds>(now - m_start);
+        return true;
+    }
+
+    std::optional<std::chrono::microseconds> Get(StartupMilestone milestone) const
+    {
+        return m_times[static_cast<size_t>(milestone)];
+    }
+
+    bool IsComplete() const
+    {
+        for (auto&& time : m_times)
+        {
+            if (!time.has_value())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static char const* GetCsvHeader()
+    {
+        return "first_paint_us,first_row_us,full_snapshot_us,processes";
+    }
+
+    // One line per startup, so runs can be appended to the same file and
+    // compared over time. Milestones that weren't reached are left empty.
+    void WriteCsvLine(std::ostream& stream, size_t processCount) const
+    {
+        for (auto&& time : m_times)
+        {
+            if (time.has_value())
+            {
+                stream << time->count();
+            }
+            stream << ',';
+        }
+        stream << processCount << '\n';
+    }
+
+private:
+    clock::time_point m_start;
+    std::array<std::optional<std::chrono::microseconds>, MilestoneCount> m_times;
+};
@@ -0,0 +1,111 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Stores each distinct string once and hands out 32-bit ids for them. Many
+// processes share a name and path (svchost.exe, conhost.exe, ...), so rows
+// that store ids instead of strings are both smaller and don't duplicate
+// the same characters over and over. Strings stay until the pool is cleared
+// or compacted, which renumbers the ids (see Generation).
+class StringPool
+{
+public:
+    static constexpr uint32_t EmptyId = 0;
+
+    StringPool()
+    {
+        Intern(std::wstring_view());
+    }
+
+    // Copying would leave the keys pointing into the other pool's strings
+    StringPool(StringPool const&) = delete;
+    StringPool& operator=(StringPool const&) = delete;
+
+    uint32_t Intern(std::wstring_view value)
+    {
+        auto search = m_ids.find(value);
+        if (search != m_ids.end())
+        {
+            return search->second;
+        }
+        auto id = static_cast<uint32_t>(m_strings.size());
+        // std::deque never moves existing elements, so the views used as
+        // keys stay valid as the pool grows.
+        auto& stored = m_strings.emplace_back(value);
+        m_ids.emplace(std::wstring_view(stored), id);
+        m_characterCount += stored.size();
+        return id;
+    }
+
+    std::wstring const& Get(uint32_t id) const
+    {
+        return m_strings[id];
+    }
+
+    size_t size() const
+    {
+        return m_strings.size();
+    }
+
+    // Changes whenever ids are renumbered, so anything indexed by id knows to
+    // start over
+    uint64_t Generation() const
+    {
+        return m_generation;
+    }
+
+    void clear()
+    {
+        m_ids.clear();
+        m_strings.clear();
+        m_characterCount = 0;
+        m_generation++;
+        Intern(std::wstring_view());
+    }
+
+    // Drops the strings keep(id) returns false for and renumbers the rest,
+    // keeping their order. Returns a map from old ids to new ones, dropped
+    // strings map to EmptyId.
+    template <typename TKeep>
+    std::vector<uint32_t> Compact(TKeep&& keep)
+    {
+        std::vector<uint32_t> remap(m_strings.size(), EmptyId);
+        std::deque<std::wstring> strings;
+        strings.emplace_back();
+        for (uint32_t id = 1; id < m_strings.size(); id++)
+        {
+            if (keep(id))
+            {
+                remap[id] = static_cast<uint32_t>(strings.size());
+                strings.push_back(std::move(m_strings[id]));
+            }
+        }
+        m_strings = std::move(strings);
+        m_ids.clear();
+        m_characterCount = 0;
+        for (uint32_t id = 0; id < m_strings.size(); id++)
+        {
+            m_ids.emplace(std::wstring_view(m_strings[id]), id);
+            m_characterCount += m_strings[id].size();
+        }
+        m_generation++;
+        return remap;
+    }
+
+    // Approximate number of bytes used by the pool
+    size_t GetMemoryUsage() const
+    {
+        return m_characterCount * sizeof(wchar_t) +
+            m_strings.size() * (sizeof(std::wstring) + sizeof(std::pair<std::wstring_view, uint32_t>) + sizeof(void*));
+    }
+
+private:
+    std::deque<std::wstring> m_strings;
+    std::unordered_map<std::wstring_view, uint32_t> m_ids;
+    size_t m_characterCount = 0;
+    uint64_t m_generation = 0;
+};
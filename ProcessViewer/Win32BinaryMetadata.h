@@ -0,0 +1,118 @@
+#pragma once
+#include "BinaryMetadataCache.h"
+
+struct IconPixels
+{
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    // BGRA, see IconBitmapView
+    std::vector<uint8_t> Pixels;
+};
+
+// Returns std::nullopt for icons without a color bitmap
+inline std::optional<IconPixels> GetIconPixels(HICON icon)
+{
+    ICONINFO info = {};
+    if (!GetIconInfo(icon, &info))
+    {
+        return std::nullopt;
+    }
+    wil::unique_hbitmap color(info.hbmColor);
+    wil::unique_hbitmap mask(info.hbmMask);
+    BITMAP bitmap = {};
+    if (!color || GetObjectW(color.get(), sizeof(bitmap), &bitmap) == 0 || bitmap.bmWidth <= 0 || bitmap.bmHeight <= 0)
+    {
+        return std::nullopt;
+    }
+
+    IconPixels result;
+    result.Width = static_cast<uint32_t>(bitmap.bmWidth);
+    result.Height = static_cast<uint32_t>(bitmap.bmHeight);
+    result.Pixels.resize(BinaryCacheFormat::GetPixelsSize(result.Width, result.Height));
+    BITMAPINFO bitmapInfo = {};
+    bitmapInfo.bmiHeader.biSize = sizeof(bitmapInfo.bmiHeader);
+    bitmapInfo.bmiHeader.biWidth = bitmap.bmWidth;
+    // Top-down
+    bitmapInfo.bmiHeader.biHeight = -bitmap.bmHeight;
+    bitmapInfo.bmiHeader.biPlanes = 1;
+    bitmapInfo.bmiHeader.biBitCount = 32;
+    bitmapInfo.bmiHeader.biCompression = BI_RGB;
+    auto dc = wil::GetDC(nullptr);
+    if (!GetDIBits(dc.get(), color.get(), 0, result.Height, result.Pixels.data(), &bitmapInfo, DIB_RGB_COLORS))
+    {
+        return std::nullopt;
+    }
+
+    // Icons without an alpha channel rely on their mask for transparency
+    auto hasAlpha = false;
+    for (size_t i = 3; i < result.Pixels.size(); i += 4)
+    {
+        hasAlpha = hasAlpha || result.Pixels[i] != 0;
+    }
+    if (!hasAlpha)
+    {
+        std::vector<uint8_t> maskPixels(result.Pixels.size());
+        if (!mask || !GetDIBits(dc.get(), mask.get(), 0, result.Height, maskPixels.data(), &bitmapInfo, DIB_RGB_COLORS))
+        {
+            return std::nullopt;
+        }
+        for (size_t i = 0; i < result.Pixels.size(); i += 4)
+        {
+            result.Pixels[i + 3] = maskPixels[i] != 0 ? 0 : 255;
+        }
+    }
+    return result;
+}
+
+inline wil::shared_hicon CreateIconFromPixels(IconBitmapView const& view)
+{
+    BITMAPV5HEADER header = {};
+    header.bV5Size = sizeof(header);
+    header.bV5Width = static_cast<LONG>(view.Width);
+    header.bV5Height = -static_cast<LONG>(view.Height);
+    header.bV5Planes = 1;
+    header.bV5BitCount = 32;
+    header.bV5Compression = BI_BITFIELDS;
+    header.bV5RedMask = 0x00FF0000;
+    header.bV5GreenMask = 0x0000FF00;
+    header.bV5BlueMask = 0x000000FF;
+    header.bV5AlphaMask = 0xFF000000;
+    void* bits = nullptr;
+    wil::unique_hbitmap color(CreateDIBSection(nullptr, reinterpret_cast<BITMAPINFO*>(&header), DIB_RGB_COLORS, &bits, nullptr, 0));
+    if (!color)
+    {
+        return nullptr;
+    }
+    memcpy(bits, view.Pixels, BinaryCacheFormat::GetPixelsSize(view.Width, view.Height));
+    // Ignored, transparency comes from the alpha channel
+    wil::unique_hbitmap mask(CreateBitmap(static_cast<int>(view.Width), static_cast<int>(view.Height), 1, 1, nullptr));
+    if (!mask)
+    {
+        return nullptr;
+    }
+    ICONINFO info = {};
+    info.fIcon = TRUE;
+    info.hbmColor = color.get();
+    info.hbmMask = mask.get();
+    return wil::shared_hicon(CreateIconIndirect(&info));
+}
+
+// From the version resource, 0 if the binary doesn't have one
+inline uint64_t GetBinaryFileVersion(std::wstring const& path)
+{
+    auto size = GetFileVersionInfoSizeW(path.c_str(), nullptr);
+    if (size == 0)
+    {
+        return 0;
+    }
+    std::vector<uint8_t> versionInfo(size);
+    VS_FIXEDFILEINFO* fixedInfo = nullptr;
+    UINT fixedInfoSize = 0;
+    if (!GetFileVersionInfoW(path.c_str(), 0, size, versionInfo.data()) ||
+        !VerQueryValueW(versionInfo.data(), L"\\", reinterpret_cast<void**>(&fixedInfo), &fixedInfoSize) ||
+        fixedInfoSize < sizeof(VS_FIXEDFILEINFO))
+    {
+        return 0;
+    }
+    return (static_cast<uint64_t>(fixedInfo->dwFileVersionMS) << 32) | fixedInfo->dwFileVersionLS;
+}
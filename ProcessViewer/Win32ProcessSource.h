@@ -0,0 +1,333 @@
+#pragma once
+#include "ProcessSource.h"
+
+inline QueryError QueryErrorFromWin32(DWORD error)
+{
+    switch (error)
+    {
+    case ERROR_ACCESS_DENIED:
+    case ERROR_NOACCESS:
+        return QueryError::AccessDenied;
+    case ERROR_INVALID_PARAMETER:
+        // OpenProcess fails this way when the pid no longer exists
+        return QueryError::ProcessExited;
+    default:
+        return QueryError::Unexpected;
+    }
+}
+
+inline QueryError GetLastQueryError()
+{
+    return QueryErrorFromWin32(GetLastError());
+}
+
+inline QueryResult<wil::unique_handle> GetProcessHandleFromPid(DWORD pid)
+{
+    wil::unique_handle processHandle(OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false, pid));
+    if (!processHandle)
+    {
+        return GetLastQueryError();
+    }
+    return processHandle;
+}
+
+inline QueryResult<wil::unique_handle> GetProcessToken(wil::unique_handle const& processHandle)
+{
+    wil::unique_handle processToken;
+    if (!OpenProcessToken(processHandle.get(), TOKEN_QUERY, processToken.put()))
+    {
+        return GetLastQueryError();
+    }
+    return processToken;
+}
+
+inline QueryResult<uint64_t> GetCreationTimeFromProcess(wil::unique_handle const& processHandle)
+{
+    FILETIME creationTime = {};
+    FILETIME exitTime = {};
+    FILETIME kernelTime = {};
+    FILETIME userTime = {};
+    if (!GetProcessTimes(processHandle.get(), &creationTime, &exitTime, &kernelTime, &userTime))
+    {
+        return GetLastQueryError();
+    }
+    return (static_cast<uint64_t>(creationTime.dwHighDateTime) << 32) | creationTime.dwLowDateTime;
+}
+
+inline QueryResult<USHORT> GetArchitectureValueFromProcess(wil::unique_handle const& processHandle)
+{
+    USHORT process = 0;
+    USHORT machine = 0;
+    if (!IsWow64Process2(processHandle.get(), &process, &machine))
+    {
+        return GetLastQueryError();
+    }
+    return process == IMAGE_FILE_MACHINE_UNKNOWN ? machine : process;
+}
+
+inline QueryResult<ProcessType> GetProcessTypeFromProcessToken(wil::unique_handle const& processToken)
+{
+    BOOL isAppContainer = FALSE;
+    DWORD length = 0;
+    if (!GetTokenInformation(processToken.get(), TokenIsAppContainer, &isAppContainer, sizeof(BOOL), &length))
+    {
+        return GetLastQueryError();
+    }
+    WINRT_VERIFY(length == sizeof(BOOL));
+    return isAppContainer ? ProcessType::AppContainer : ProcessType::Legacy;
+}
+
+inline QueryResult<IntegrityLevel> GetIntegrityLevelFromProcessToken(wil::unique_handle const& processToken)
+{
+    // Get the size of the data we'll get back
+    DWORD informationLength = 0;
+    if (!GetTokenInformation(processToken.get(), TokenIntegrityLevel, nullptr, 0, &informationLength))
+    {
+        auto error = GetLastError();
+        if (error != ERROR_INSUFFICIENT_BUFFER)
+        {
+            return QueryErrorFromWin32(error);
+        }
+    }
+
+    // Allocate the memory for the integrity level data
+    wil::unique_hlocal infoData(LocalAlloc(0, informationLength));
+    if (!infoData)
+    {
+        return QueryError::Unexpected;
+    }
+    auto info = (PTOKEN_MANDATORY_LABEL)infoData.get();
+
+    // Get the data for our integrity level
+    if (!GetTokenInformation(processToken.get(), TokenIntegrityLevel, info, informationLength, &informationLength))
+    {
+        return GetLastQueryError();
+    }
+
+    // Get the integrity level from the info we got back
+    auto authorityCountPointer = GetSidSubAuthorityCount(info->Label.Sid);
+    if (authorityCountPointer == nullptr)
+    {
+        return QueryError::Unexpected;
+    }
+    auto authorityCount = (DWORD)(UCHAR)*authorityCountPointer;
+    auto integrityLevelPointer = GetSidSubAuthority(info->Label.Sid, authorityCount - 1);
+    if (integrityLevelPointer == nullptr)
+    {
+        return QueryError::Unexpected;
+    }
+    auto integrityLevel = *integrityLevelPointer;
+
+    switch (integrityLevel)
+    {
+    case SECURITY_MANDATORY_UNTRUSTED_RID:
+    case SECURITY_MANDATORY_LOW_RID:
+    case SECURITY_MANDATORY_MEDIUM_RID:
+    case SECURITY_MANDATORY_HIGH_RID:
+    case SECURITY_MANDATORY_SYSTEM_RID:
+    case SECURITY_MANDATORY_PROTECTED_PROCESS_RID:
+        return static_cast<IntegrityLevel>(integrityLevel);
+    default:
+        return QueryError::NotAvailable;
+    }
+}
+
+inline QueryResult<std::wstring> GetExectuablePathFromProcess(wil::unique_handle const& processHandle)
+{
+    std::wstring exePath(MAX_PATH, L'\0');
+    DWORD length = static_cast<DWORD>(exePath.size());
+    if (!QueryFullProcessImageNameW(processHandle.get(), 0, exePath.data(), &length))
+    {
+        return GetLastQueryError();
+    }
+    exePath.resize(length, L'\0');
+    return exePath;
+}
+
+// Each field is queried on its own, so one failing query (e.g. the token of
+// a protected process) doesn't hide the fields that could be read.
+// Only the given fields are queried, the token is only opened when a field
+// that needs it is asked for
+inline QueryResult<Process> CreateProcessFromPid(DWORD pid, std::wstring const& processName, ProcessFields fields = ProcessFields::All)
+{
+    auto result = CreatePendingProcess({ pid, processName });
+    auto& errors = result.Errors;
+
+    auto handle = GetProcessHandleFromPid(pid);
+    if (!handle)
+    {
+        if (handle.error() == QueryError::ProcessExited)
+        {
+            return QueryError::ProcessExited;
+        }
+        errors.Set(fields, handle.error());
+        return result;
+    }
+
+    if (auto creationTime = GetCreationTimeFromProcess(*handle))
+    {
+        result.CreationTime = *creationTime;
+    }
+
+    if (HasAnyField(fields, ProcessFields::Architecture))
+    {
+        if (auto archValue = GetArchitectureValueFromProcess(*handle))
+        {
+            result.ArchitectureValue = *archValue;
+        }
+        else
+        {
+            errors.Architecture = archValue.error();
+        }
+    }
+
+    if (HasAnyField(fields, ProcessFields::ExecutablePath))
+    {
+        if (auto exePath = GetExectuablePathFromProcess(*handle))
+        {
+            result.ExecutablePath = std::move(*exePath);
+        }
+        else
+        {
+            errors.ExecutablePath = exePath.error();
+        }
+    }
+
+    auto tokenFields = fields & (ProcessFields::Type | ProcessFields::IntegrityLevel);
+    if (tokenFields == ProcessFields::None)
+    {
+        return result;
+    }
+
+    auto token = GetProcessToken(*handle);
+    if (!token)
+    {
+        errors.Set(tokenFields, token.error());
+        return result;
+    }
+
+    if (HasAnyField(fields, ProcessFields::Type))
+    {
+        if (auto processType = GetProcessTypeFromProcessToken(*token))
+        {
+            result.Type = *processType;
+        }
+        else
+        {
+            errors.Type = processType.error();
+        }
+    }
+
+    if (HasAnyField(fields, ProcessFields::IntegrityLevel))
+    {
+        if (auto ilevel = GetIntegrityLevelFromProcessToken(*token))
+        {
+            result.IntegrityLevel = *ilevel;
+        }
+        else
+        {
+            errors.IntegrityLevel = ilevel.error();
+        }
+    }
+
+    return result;
+}
+
+// Only has names, see GetProcessEntries
+inline std::vector<ProcessEntry> GetToolhelpProcessEntries()
+{
+    std::vector<ProcessEntry> result;
+    wil::unique_handle snapshot(winrt::check_pointer(CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0)));
+    PROCESSENTRY32W entry = {};
+    entry.dwSize = sizeof(entry);
+
+    if (Process32FirstW(snapshot.get(), &entry))
+    {
+        do
+        {
+            result.push_back({ entry.th32ProcessID, std::wstring(entry.szExeFile) });
+        } while (Process32NextW(snapshot.get(), &entry));
+    }
+    return result;
+}
+
+// Every process with its creation time, from one system call rather than an
+// OpenProcess and GetProcessTimes per process (which also fail for the
+// processes we can't open). Falls back to Toolhelp if the call fails.
+inline std::vector<ProcessEntry> GetProcessEntries()
+{
+    // Grown until the snapshot fits, with room for processes started since
+    std::vector<uint8_t> buffer(256 * 1024);
+    NTSTATUS status = 0;
+    for (;;)
+    {
+        ULONG length = 0;
+        status = NtQuerySystemInformation(SystemProcessInformation, buffer.data(), static_cast<ULONG>(buffer.size()), &length);
+        if (status != static_cast<NTSTATUS>(0xC0000004L)) // STATUS_INFO_LENGTH_MISMATCH
+        {
+            break;
+        }
+        buffer.resize(std::max<size_t>(buffer.size() * 2, length + 64 * 1024));
+    }
+    if (status < 0)
+    {
+        return GetToolhelpProcessEntries();
+    }
+
+    std::vector<ProcessEntry> result;
+    size_t offset = 0;
+    for (;;)
+    {
+        auto information = reinterpret_cast<SYSTEM_PROCESS_INFORMATION const*>(buffer.data() + offset);
+        // winternl.h hides CreateTime in Reserved1, after the private
+        // working set, hard fault count, thread high watermark and cycle time
+        LARGE_INTEGER creationTime = {};
+        std::memcpy(&creationTime, information->Reserved1 + 24, sizeof(creationTime));
+        auto pid = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(information->UniqueProcessId));
+        std::wstring name(information->ImageName.Buffer, information->ImageName.Length / sizeof(wchar_t));
+        if (name.empty() && pid == 0)
+        {
+            // What Toolhelp calls it
+            name = L"[System Process]";
+        }
+        result.push_back({ pid, std::move(name), static_cast<uint64_t>(creationTime.QuadPart) });
+        if (information->NextEntryOffset == 0)
+        {
+            break;
+        }
+        offset += information->NextEntryOffset;
+    }
+    return result;
+}
+
+class Win32ProcessSource : public ProcessSource
+{
+public:
+    std::vector<ProcessEntry> EnumerateProcesses() override
+    {
+        return GetProcessEntries();
+    }
+
+    // Enumerated entries have one already, this is for WMI's starts (and
+    // the Toolhelp fallback)
+    uint64_t QueryCreationTime(ProcessEntry const& entry) override
+    {
+        if (entry.CreationTime == 0)
+        {
+            if (auto handle = GetProcessHandleFromPid(entry.Pid))
+            {
+                if (auto creationTime = GetCreationTimeFromProcess(*handle))
+                {
+                    return *creationTime;
+                }
+            }
+        }
+        return entry.CreationTime;
+    }
+
+protected:
+    QueryResult<Process> TryEnrichProcess(ProcessEntry const& entry, ProcessFields fields) override
+    {
+        return CreateProcessFromPid(entry.Pid, entry.Name, fields);
+    }
+};
\ No newline at end of file
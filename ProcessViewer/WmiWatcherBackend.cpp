@@ -0,0 +1,94 @@
+#include "pch.h"
+#include "WmiWatcherBackend.h"
+#include "CimDateTime.h"
+
+WmiWatcherBackend::WmiWatcherBackend(std::chrono::milliseconds pollingInterval)
+{
+    m_pollingInterval = pollingInterval;
+}
+
+WmiWatcherBackend::~WmiWatcherBackend()
+{
+    Stop();
+}
+
+void WmiWatcherBackend::Start(ProcessStartedCallback started, ProcessExitedCallback exited)
+{
+    m_processStarted = started;
+    m_processExited = exited;
+
+    auto locator = winrt::create_instance<IWbemLocator>(CLSID_WbemLocator);
+    winrt::check_hresult(locator->ConnectServer(BSTR(L"ROOT\\CIMV2"), nullptr, nullptr, 0, 0, 0, 0, m_services.put()));
+
+    winrt::check_hresult(CoSetProxyBlanket(
+        m_services.get(),
+        RPC_C_AUTHN_WINNT,
+        RPC_C_AUTHZ_NONE,
+        nullptr,
+        RPC_C_AUTHN_LEVEL_CALL,
+        RPC_C_IMP_LEVEL_IMPERSONATE,
+        nullptr,
+        EOAC_NONE));
+
+    m_unsecuredApartment = winrt::create_instance<IUnsecuredApartment>(CLSID_UnsecuredApartment, CLSCTX_LOCAL_SERVER);
+    m_sink = winrt::make_self<EventSink>(EventSink::EventSinkCallback([&](winrt::array_view<IWbemClassObject*> const& objs)
+        {
+            for (auto& objRaw : objs)
+            {
+                winrt::com_ptr<IWbemClassObject> obj;
+                obj.copy_from(objRaw);
+                auto targetInstance = GetProperty<winrt::com_ptr<IUnknown>>(obj, L"TargetInstance");
+                auto win32Process = targetInstance.as<IWbemClassObject>();
+                
+                auto classNameBstr = GetProperty<wil::unique_bstr>(obj, L"__CLASS");
+                auto className = std::wstring(classNameBstr.get(), SysStringLen(classNameBstr.get()));
+                if (className == L"__InstanceCreationEvent")
+                {
+                    auto name = GetProperty<wil::unique_bstr>(win32Process, L"Name");
+                    auto processId = GetProperty<uint32_t>(win32Process, L"ProcessId");
+                    m_processStarted({ processId, std::wstring(name.get(), SysStringLen(name.get())) });
+                }
+                else if (className == L"__InstanceDeletionEvent")
+                {
+                    auto processId = GetProperty<uint32_t>(win32Process, L"ProcessId");
+                    auto name = GetProperty<wil::unique_bstr>(win32Process, L"Name");
+                    // Only good to the microsecond, which ProcessKey allows
+                    // for, but in local time with the current UTC offset, so
+                    // it is off for processes started before a daylight
+                    // saving change. The name lets the exit match anyway.
+                    // Starts don't use it: the creation time they need has
+                    // to match GetProcessTimes exactly.
+                    uint64_t creationTime = 0;
+                    auto creationDate = GetProperty<wil::unique_variant>(win32Process, L"CreationDate");
+                    if (creationDate.vt == VT_BSTR)
+                    {
+                        creationTime = ParseCimDateTime({ creationDate.bstrVal, SysStringLen(creationDate.bstrVal) });
+                    }
+                    m_processExited(ProcessKey::From(processId, creationTime), { name.get(), SysStringLen(name.get()) });
+                }
+            }
+        }));
+    winrt::com_ptr<IUnknown> stubUnknown;
+    winrt::check_hresult(m_unsecuredApartment->CreateObjectStub(m_sink.get(), stubUnknown.put()));
+    m_sinkStub = stubUnknown.as<IWbemObjectSink>();
+
+    // WITHIN takes (fractional) seconds
+    std::wstringstream query;
+    query << L"SELECT * FROM __InstanceOperationEvent WITHIN " << (m_pollingInterval.count() / 1000.0) << L" WHERE TargetInstance ISA 'Win32_Process'";
+    auto queryString = query.str();
+    winrt::check_hresult(m_services->ExecNotificationQueryAsync(
+        BSTR(L"WQL"),
+        BSTR(queryString.c_str()),
+        WBEM_FLAG_SEND_STATUS,
+        nullptr,
+        m_sinkStub.get()));
+}
+
+void WmiWatcherBackend::Stop()
+{
+    if (m_sinkStub)
+    {
+        winrt::check_hresult(m_services->CancelAsyncCall(m_sinkStub.get()));
+        m_sinkStub = nullptr;
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "ProcessWatcherBackend.h"
+
+// Process notifications from WMI's __InstanceOperationEvent. WMI polls for
+// these, so events can be up to the polling interval late and processes
+// that live for less than that can be missed entirely.
+class WmiWatcherBackend : public ProcessWatcherBackend
+{
+public:
+    WmiWatcherBackend(std::chrono::milliseconds pollingInterval = std::chrono::seconds(1));
+    ~WmiWatcherBackend() override;
+
+    void Start(ProcessStartedCallback started, ProcessExitedCallback exited) override;
+    void Stop() override;
+
+private:
+    std::chrono::milliseconds m_pollingInterval;
+    winrt::com_ptr<IWbemServices> m_services;
+    winrt::com_ptr<IUnsecuredApartment> m_unsecuredApartment;
+    winrt::com_ptr<EventSink> m_sink;
+    winrt::com_ptr<IWbemObjectSink> m_sinkStub;
+
+    ProcessStartedCallback m_processStarted;
+    ProcessExitedCallback m_processExited;
+};
\ No newline at end of file
@@ -47,23 +47,28 @@
 #include <functional>
 #include <cstring>
 #include <sstream>
+#include <fstream>
 
 // Windows tool helpers
 #include <tlhelp32.h>
+#include <winternl.h>
 
 // WMI
 #include <Wbemidl.h>
 #include "wmiHelpers.h"
 
-// WinMD
-#include <winmd_reader.h>
-
 // Controls
 #include <CommCtrl.h>
 
 // Icon extraction and defaults
 #include <shellapi.h>
 
+// Known folders
+#include <ShlObj.h>
+
+// Version resources
+#include <winver.h>
+
 // robmikh.common
 #include <robmikh.common/composition.interop.h>
 #include <robmikh.common/direct3d11.interop.h>
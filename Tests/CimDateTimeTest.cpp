@@ -0,0 +1,61 @@
+// Checks ParseCimDateTime against FILETIMEs worked out independently.
+// Returns non-zero if any of them differ.
+#include <cstdio>
+#include <iterator>
+#include "CimDateTime.h"
+
+namespace
+{
+    struct Case
+    {
+        wchar_t const* Text;
+        uint64_t Expected;
+    };
+
+    constexpr Case Cases[] = {
+        { L"19700101000000.000000+000", 116444736000000000 },
+        { L"16010101000000.000001+000", 10 },
+        { L"20001231235959.999999+000", 126227807999999990 },
+        // Leap day, an hour east of UTC
+        { L"20240229123456.789012+060", 133536800967890120 },
+        // Five hours west of UTC
+        { L"20231029023000.000000-300", 133430382000000000 },
+        { L"99991231235959.999999-720", 2650468175999999990 },
+
+        // Before the epoch, once the offset is applied
+        { L"16010101000000.000000+060", 0 },
+        { L"16001231235959.000000+000", 0 },
+        { L"20230229000000.000000+000", 0 },
+        { L"19000229000000.000000+000", 0 },
+        { L"20231301000000.000000+000", 0 },
+        { L"20231200000000.000000+000", 0 },
+        { L"20230431000000.000000+000", 0 },
+        { L"20230101240000.000000+000", 0 },
+        { L"20230101006000.000000+000", 0 },
+        { L"20230101000060.000000+000", 0 },
+        { L"20230101000000.000000*000", 0 },
+        { L"20230101000000,000000+000", 0 },
+        { L"2023010100000x.000000+000", 0 },
+        { L"20230101000000.000000+00", 0 },
+        { L"", 0 },
+    };
+}
+
+int main()
+{
+    int failed = 0;
+    for (auto&& test : Cases)
+    {
+        auto actual = ParseCimDateTime(test.Text);
+        if (actual != test.Expected)
+        {
+            std::printf("ParseCimDateTime(\"%ls\") = %llu, expected %llu\n", test.Text,
+                static_cast<unsigned long long>(actual), static_cast<unsigned long long>(test.Expected));
+            failed++;
+        }
+    }
+    static_assert(DaysSinceFileTimeEpoch(1601, 1, 1) == 0);
+    static_assert(DaysSinceFileTimeEpoch(1970, 1, 1) == 134774);
+    std::printf("%d of %zu failed\n", failed, std::size(Cases));
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,195 @@
+// Runs the process churn harness headless and prints how the watcher
+// pipeline held up, see ProcessChurnHarness.h.
+//
+//   ChurnHarness [--rate <spawns/s>] [--duration <ms>] [--latency <us>]
+//                [--trace <file>] [--write-trace <file>]
+//                [--max-rate <spawns/s>] [--no-search]
+//
+// A trace given with --trace is replayed as recorded, otherwise one is
+// generated at --rate. The search for the highest rate that keeps up always
+// uses generated traces of --duration, starting at --rate.
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include "ProcessChurnHarness.h"
+
+namespace
+{
+    struct Arguments
+    {
+        ChurnGeneratorOptions Generator;
+        ChurnHarnessOptions Harness;
+        std::string TracePath;
+        std::string WriteTracePath;
+        double MaxRate = 1'000'000;
+        bool Search = true;
+    };
+
+    void PrintUsage()
+    {
+        std::fprintf(stderr,
+            "Usage: ChurnHarness [--rate <spawns/s>] [--duration <ms>] [--latency <us>]\n"
+            "                    [--trace <file>] [--write-trace <file>]\n"
+            "                    [--max-rate <spawns/s>] [--no-search]\n");
+    }
+
+    bool ParseArguments(int argc, char** argv, Arguments& arguments)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            auto name = std::string(argv[i]);
+            if (name == "--no-search")
+            {
+                arguments.Search = false;
+                continue;
+            }
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+            auto value = argv[++i];
+            char* end = nullptr;
+            auto number = std::strtod(value, &end);
+            auto isNumber = end != value && *end == '\0' && number >= 0;
+            if (name == "--trace")
+            {
+                arguments.TracePath = value;
+            }
+            else if (name == "--write-trace")
+            {
+                arguments.WriteTracePath = value;
+            }
+            else if (!isNumber)
+            {
+                return false;
+            }
+            else if (name == "--rate")
+            {
+                arguments.Generator.SpawnsPerSecond = number;
+            }
+            else if (name == "--duration")
+            {
+                arguments.Generator.Duration = std::chrono::milliseconds(static_cast<int64_t>(number));
+            }
+            else if (name == "--latency")
+            {
+                arguments.Harness.QueryLatency = std::chrono::microseconds(static_cast<int64_t>(number));
+            }
+            else if (name == "--max-rate")
+            {
+                arguments.MaxRate = number;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Of the whole process so far, 0 if it isn't known
+    size_t GetPeakMemoryUsage()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters = {};
+        return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#else
+        rusage usage = {};
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+        {
+            return 0;
+        }
+#ifdef __APPLE__
+        return static_cast<size_t>(usage.ru_maxrss);
+#else
+        return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+    }
+
+    void PrintReport(ChurnReport const& report)
+    {
+        std::printf("events              %llu in %.3f s\n", static_cast<unsigned long long>(report.Events),
+            static_cast<double>(report.Elapsed.count()) / 1e6);
+        std::printf("starts              %llu, %.0f spawns/s\n", static_cast<unsigned long long>(report.Starts), report.StartsPerSecond);
+        std::printf("throughput          %.0f events/s\n", report.EventsPerSecond);
+        std::printf("batches             %llu\n", static_cast<unsigned long long>(report.Batches));
+        std::printf("lag                 %.1f ms average, %.1f ms max\n", static_cast<double>(report.AverageLag.count()) / 1e3,
+            static_cast<double>(report.MaxLag.count()) / 1e3);
+        std::printf("peak queue depth    %zu\n", report.PeakQueueDepth);
+        std::printf("degraded            %llu\n", static_cast<unsigned long long>(report.Enrichment.Degraded));
+        std::printf("ring overflows      %llu of %llu\n", static_cast<unsigned long long>(report.Ring.Overflowed),
+            static_cast<unsigned long long>(report.Ring.Pushed));
+        std::printf("rows                %zu peak, %zu final\n", report.PeakRows, report.FinalRows);
+        std::printf("model memory        %zu bytes peak\n", report.PeakModelMemory);
+        std::printf("kept up             %s\n", report.KeptUp ? "yes" : "no");
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Arguments arguments;
+    if (!ParseArguments(argc, argv, arguments))
+    {
+        PrintUsage();
+        return 2;
+    }
+
+    std::vector<ChurnEvent> trace;
+    ChurnTraceStatistics traceStatistics;
+    if (!arguments.TracePath.empty())
+    {
+        std::wifstream stream(arguments.TracePath);
+        if (!stream)
+        {
+            std::fprintf(stderr, "Can't open %s\n", arguments.TracePath.c_str());
+            return 1;
+        }
+        trace = ReadChurnTrace(stream);
+    }
+    else
+    {
+        trace = GenerateChurnTrace(arguments.Generator, &traceStatistics);
+        if (traceStatistics.DroppedStarts > 0)
+        {
+            std::printf("dropped starts      %llu of %llu, all %u pids in use\n",
+                static_cast<unsigned long long>(traceStatistics.DroppedStarts),
+                static_cast<unsigned long long>(traceStatistics.Starts + traceStatistics.DroppedStarts), traceStatistics.PidSpace);
+        }
+    }
+    if (!arguments.WriteTracePath.empty())
+    {
+        std::wofstream stream(arguments.WriteTracePath);
+        WriteChurnTrace(stream, trace);
+        if (!stream)
+        {
+            std::fprintf(stderr, "Can't write %s\n", arguments.WriteTracePath.c_str());
+            return 1;
+        }
+    }
+
+    PrintReport(RunChurnHarness(std::move(trace), arguments.Harness));
+    if (arguments.Search)
+    {
+        auto sustained = FindMaxSustainedRate(arguments.Generator, arguments.Harness, arguments.MaxRate);
+        if (sustained.ReachedCap)
+        {
+            std::printf("max sustained rate  >= %.0f spawns/s (--max-rate reached)\n", arguments.MaxRate);
+        }
+        else
+        {
+            std::printf("max sustained rate  %.0f spawns/s\n", sustained.SpawnsPerSecond);
+        }
+    }
+    std::printf("peak process memory %zu bytes\n", GetPeakMemoryUsage());
+    return 0;
+}
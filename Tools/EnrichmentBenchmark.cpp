@@ -0,0 +1,106 @@
+// Measures how a full refresh scales with the number of workers querying
+// processes, see GetAllProcesses in ProcessSource.h.
+//
+//   EnrichmentBenchmark [--processes <n>] [--latency <us>] [--max-workers <n>]
+//
+// The processes come from a SyntheticProcessSource where every query takes
+// --latency, like OpenProcess and friends do on a busy machine. Each worker
+// count from 1 up to --max-workers (doubling) refreshes without the
+// metadata cache and with a cold one; a warm cache doesn't query at all.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "ProcessChurnHarness.h"
+
+namespace
+{
+    template <typename TRefresh>
+    double MeasureMilliseconds(TRefresh&& refresh)
+    {
+        using namespace std::chrono;
+        auto start = steady_clock::now();
+        auto processes = refresh();
+        auto elapsed = duration<double, std::milli>(steady_clock::now() - start).count();
+        return processes.empty() ? -1 : elapsed;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t processCount = 300;
+    int64_t latency = 1000;
+    size_t maxWorkers = 64;
+    for (int i = 1; i < argc; i += 2)
+    {
+        char* end = nullptr;
+        auto number = i + 1 < argc ? std::strtoll(argv[i + 1], &end, 10) : -1;
+        if (number < 0 || *end != '\0')
+        {
+            number = -1;
+        }
+        if (std::strcmp(argv[i], "--processes") == 0 && number > 0)
+        {
+            processCount = static_cast<size_t>(number);
+        }
+        else if (std::strcmp(argv[i], "--latency") == 0 && number >= 0)
+        {
+            latency = number;
+        }
+        else if (std::strcmp(argv[i], "--max-workers") == 0 && number > 0)
+        {
+            maxWorkers = static_cast<size_t>(number);
+        }
+        else
+        {
+            std::fprintf(stderr, "Usage: EnrichmentBenchmark [--processes <n>] [--latency <us>] [--max-workers <n>]\n");
+            return 2;
+        }
+    }
+
+    SyntheticProcessSource source{ std::chrono::microseconds(latency) };
+    for (size_t i = 0; i < processCount; i++)
+    {
+        auto pid = static_cast<uint32_t>(i * 4 + 4);
+        source.OnStarted({ pid, L"Process" + std::to_wstring(i % 64) + L".exe", pid });
+    }
+
+    std::printf("%zu processes, %lld us per query\n", processCount, static_cast<long long>(latency));
+    std::printf("%8s %12s %9s %12s %9s\n", "workers", "no cache ms", "speedup", "cold ms", "speedup");
+    double noCacheBase = 0;
+    double coldBase = 0;
+    for (size_t workers = 1; workers <= maxWorkers; workers *= 2)
+    {
+        auto noCache = MeasureMilliseconds([&]()
+            {
+                return GetAllProcesses(source, true, workers);
+            });
+        auto cold = MeasureMilliseconds([&]()
+            {
+                ProcessMetadataCache cache;
+                return GetAllProcesses(source, cache, true, ProcessFields::All, workers);
+            });
+        if (noCache < 0 || cold < 0)
+        {
+            std::fprintf(stderr, "The refresh found no processes\n");
+            return 1;
+        }
+        if (workers == 1)
+        {
+            noCacheBase = noCache;
+            coldBase = cold;
+        }
+        std::printf("%8zu %12.1f %8.1fx %12.1f %8.1fx\n", workers, noCache, noCacheBase / noCache, cold, coldBase / cold);
+    }
+
+    ProcessMetadataCache cache;
+    GetAllProcesses(source, cache, true, ProcessFields::All, maxWorkers);
+    auto warm = MeasureMilliseconds([&]()
+        {
+            return GetAllProcesses(source, cache, true, ProcessFields::All, maxWorkers);
+        });
+    std::printf("warm cache, %zu workers: %.1f ms\n", maxWorkers, warm);
+    return 0;
+}
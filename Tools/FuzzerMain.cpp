@@ -0,0 +1,70 @@
+// Runs a libFuzzer target over files and directories of inputs, for
+// compilers without libFuzzer. Useful to replay a corpus or a crash. Without
+// arguments it runs the target's seed corpus, FUZZER_DEFAULT_CORPUS, if the
+// build defines one.
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(uint8_t const* data, size_t size);
+
+namespace
+{
+    bool RunInput(std::filesystem::path const& path)
+    {
+        std::ifstream stream(path, std::ios::binary);
+        if (!stream)
+        {
+            std::fprintf(stderr, "Can't open %s\n", path.string().c_str());
+            return false;
+        }
+        std::vector<char> contents(std::istreambuf_iterator<char>(stream), {});
+        // A copy of exactly the input's size, so reads past it are caught
+        // by the sanitizers like they are under libFuzzer
+        auto data = std::make_unique<uint8_t[]>(contents.size());
+        std::copy(contents.begin(), contents.end(), data.get());
+        LLVMFuzzerTestOneInput(data.get(), contents.size());
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::filesystem::path> paths(argv + 1, argv + argc);
+#ifdef FUZZER_DEFAULT_CORPUS
+    if (paths.empty())
+    {
+        paths.push_back(FUZZER_DEFAULT_CORPUS);
+    }
+#endif
+
+    size_t count = 0;
+    auto succeeded = true;
+    for (auto&& path : paths)
+    {
+        std::error_code error;
+        if (std::filesystem::is_directory(path, error))
+        {
+            for (auto&& entry : std::filesystem::recursive_directory_iterator(path, error))
+            {
+                if (entry.is_regular_file(error))
+                {
+                    succeeded = RunInput(entry.path()) && succeeded;
+                    count++;
+                }
+            }
+        }
+        else
+        {
+            succeeded = RunInput(path) && succeeded;
+            count++;
+        }
+    }
+    std::printf("Ran %zu inputs\n", count);
+    return succeeded ? 0 : 1;
+}
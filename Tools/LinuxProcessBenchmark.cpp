@@ -0,0 +1,104 @@
+// Refreshes the processes of this machine through LinuxProcessSource and
+// prints how long each way of doing it takes.
+//
+//   LinuxProcessBenchmark [--iterations <n>] [--list]
+//
+// Times enumerating /proc alone, GetAllProcesses without the metadata
+// cache, with a cold cache and with a warm one (the refresh the app does
+// every time after the first). --list prints the processes found.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "LinuxProcessSource.h"
+
+namespace
+{
+    // Median of the iterations, in milliseconds. refresh returns the
+    // processes it found, the count of the last run is kept in count.
+    template <typename TRefresh>
+    double MeasureMilliseconds(size_t iterations, size_t& count, TRefresh&& refresh)
+    {
+        using namespace std::chrono;
+        std::vector<double> times;
+        for (size_t i = 0; i < iterations; i++)
+        {
+            auto start = steady_clock::now();
+            count = refresh().size();
+            times.push_back(duration<double, std::milli>(steady_clock::now() - start).count());
+        }
+        std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+        return times[times.size() / 2];
+    }
+
+    void PrintProcesses(std::vector<Process> const& processes)
+    {
+        for (auto&& process : processes)
+        {
+            auto architecture = GetArchitectureName(MachineValueToArchitecture(process.ArchitectureValue));
+            std::printf("%8u  %-8.*ls %-16ls %ls\n", process.Pid, static_cast<int>(architecture.size()), architecture.data(),
+                process.Name.c_str(), process.ExecutablePath.c_str());
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t iterations = 20;
+    bool list = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--list") == 0)
+        {
+            list = true;
+        }
+        else if (std::strcmp(argv[i], "--iterations") == 0 && i + 1 < argc && std::atoi(argv[i + 1]) > 0)
+        {
+            iterations = static_cast<size_t>(std::atoi(argv[++i]));
+        }
+        else
+        {
+            std::fprintf(stderr, "Usage: LinuxProcessBenchmark [--iterations <n>] [--list]\n");
+            return 2;
+        }
+    }
+
+    LinuxProcessSource source;
+    size_t count = 0;
+    std::printf("median of %zu refreshes\n", iterations);
+
+    auto enumerate = MeasureMilliseconds(iterations, count, [&]()
+        {
+            return source.EnumerateProcesses();
+        });
+    std::printf("enumerate only      %8.2f ms  %zu processes\n", enumerate, count);
+
+    auto noCache = MeasureMilliseconds(iterations, count, [&]()
+        {
+            return GetAllProcesses(source);
+        });
+    std::printf("no cache            %8.2f ms  %zu processes\n", noCache, count);
+
+    auto cold = MeasureMilliseconds(iterations, count, [&]()
+        {
+            ProcessMetadataCache cache;
+            return GetAllProcesses(source, cache);
+        });
+    std::printf("cold cache          %8.2f ms  %zu processes\n", cold, count);
+
+    ProcessMetadataCache cache;
+    auto processes = GetAllProcesses(source, cache);
+    auto warm = MeasureMilliseconds(iterations, count, [&]()
+        {
+            return GetAllProcesses(source, cache);
+        });
+    std::printf("warm cache          %8.2f ms  %zu processes\n", warm, count);
+
+    if (list)
+    {
+        PrintProcesses(processes);
+    }
+    return 0;
+}
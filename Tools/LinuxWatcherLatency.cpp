@@ -0,0 +1,278 @@
+// Measures how long the Linux watcher backends take to report a process
+// starting, exec'ing and exiting, see LinuxWatcherBackends.h.
+//
+//   LinuxWatcherLatency [--iterations <n>] [--interval <ms>]
+//
+// Each iteration forks a child, lets it exec cat and then lets cat exit, and
+// times each step from just before it is triggered to the backend's
+// callback. The process connector needs CAP_NET_ADMIN and is skipped
+// without it; /proc polling runs at --interval.
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include <sys/wait.h>
+#include "LinuxWatcherBackends.h"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    constexpr std::chrono::milliseconds Target{ 10 };
+    constexpr std::chrono::seconds Timeout{ 2 };
+
+    struct Sighting
+    {
+        std::optional<Clock::time_point> Started;
+        std::optional<Clock::time_point> Execed;
+        std::optional<Clock::time_point> Exited;
+    };
+
+    // What the backend reported, by pid. Everything is recorded, the child's
+    // first events can come in before fork returns its pid.
+    class Sightings
+    {
+    public:
+        void OnStarted(ProcessEntry const& entry)
+        {
+            auto now = Clock::now();
+            {
+                std::scoped_lock lock(m_lock);
+                auto& sighting = m_sightings[entry.Pid];
+                if (!sighting.Started)
+                {
+                    sighting.Started = now;
+                }
+                if (entry.Name == L"cat" && !sighting.Execed)
+                {
+                    sighting.Execed = now;
+                }
+            }
+            m_changed.notify_all();
+        }
+
+        void OnExited(ProcessKey key)
+        {
+            auto now = Clock::now();
+            {
+                std::scoped_lock lock(m_lock);
+                auto& sighting = m_sightings[key.Pid()];
+                if (!sighting.Exited)
+                {
+                    sighting.Exited = now;
+                }
+            }
+            m_changed.notify_all();
+        }
+
+        // When field of the pid's sighting was reported, std::nullopt if it
+        // wasn't within the timeout
+        std::optional<Clock::time_point> Wait(uint32_t pid, std::optional<Clock::time_point> Sighting::* field)
+        {
+            std::unique_lock lock(m_lock);
+            m_changed.wait_for(lock, Timeout, [&]() { return (m_sightings[pid].*field).has_value(); });
+            return m_sightings[pid].*field;
+        }
+
+        void Forget(uint32_t pid)
+        {
+            std::scoped_lock lock(m_lock);
+            m_sightings.erase(pid);
+        }
+
+    private:
+        std::mutex m_lock;
+        std::condition_variable m_changed;
+        std::unordered_map<uint32_t, Sighting> m_sightings;
+    };
+
+    struct Latencies
+    {
+        std::vector<double> Start;
+        std::vector<double> Exec;
+        std::vector<double> Exit;
+        size_t Missed = 0;
+    };
+
+    double Milliseconds(Clock::duration duration)
+    {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    }
+
+    // Forks a child that execs cat once it reads a byte from the pipe, and
+    // cat exits once the pipe is closed
+    bool RunChild(char const* catPath, Sightings& sightings, Latencies& latencies)
+    {
+        int fds[2] = {};
+        if (pipe(fds) != 0)
+        {
+            return false;
+        }
+
+        auto forked = Clock::now();
+        auto pid = fork();
+        if (pid < 0)
+        {
+            close(fds[0]);
+            close(fds[1]);
+            return false;
+        }
+        if (pid == 0)
+        {
+            // Only async signal safe calls between fork and exec
+            close(fds[1]);
+            dup2(fds[0], STDIN_FILENO);
+            close(fds[0]);
+            auto null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+            char byte = 0;
+            if (read(STDIN_FILENO, &byte, 1) == 1)
+            {
+                execl(catPath, "cat", static_cast<char*>(nullptr));
+            }
+            _exit(127);
+        }
+        close(fds[0]);
+
+        auto childPid = static_cast<uint32_t>(pid);
+        auto started = sightings.Wait(childPid, &Sighting::Started);
+
+        auto execed = Clock::now();
+        char byte = 'x';
+        auto written = write(fds[1], &byte, 1) == 1;
+        auto execSeen = written ? sightings.Wait(childPid, &Sighting::Execed) : std::nullopt;
+
+        // Reaped right away, polling sees zombies as still running
+        auto exited = Clock::now();
+        close(fds[1]);
+        int status = 0;
+        waitpid(pid, &status, 0);
+        auto exitSeen = sightings.Wait(childPid, &Sighting::Exited);
+
+        if (started && execSeen && exitSeen)
+        {
+            latencies.Start.push_back(Milliseconds(*started - forked));
+            latencies.Exec.push_back(Milliseconds(*execSeen - execed));
+            latencies.Exit.push_back(Milliseconds(*exitSeen - exited));
+        }
+        else
+        {
+            latencies.Missed++;
+        }
+        sightings.Forget(childPid);
+        return true;
+    }
+
+    void PrintLatencies(char const* what, std::vector<double> values)
+    {
+        if (values.empty())
+        {
+            std::printf("  %-6s no samples\n", what);
+            return;
+        }
+        std::sort(values.begin(), values.end());
+        std::printf("  %-6s %8.3f ms median %8.3f ms max\n", what, values[values.size() / 2], values.back());
+    }
+
+    bool Measure(char const* name, ProcessWatcherBackend& backend, char const* catPath, size_t iterations)
+    {
+        Sightings sightings;
+        backend.Start(
+            ProcessWatcherBackend::ProcessStartedCallback([&](ProcessEntry entry)
+            {
+                sightings.OnStarted(entry);
+            }),
+            ProcessWatcherBackend::ProcessExitedCallback([&](ProcessKey key, std::wstring_view)
+            {
+                sightings.OnExited(key);
+            }));
+
+        Latencies latencies;
+        for (size_t i = 0; i < iterations; i++)
+        {
+            if (!RunChild(catPath, sightings, latencies))
+            {
+                std::perror("fork");
+                break;
+            }
+        }
+        backend.Stop();
+
+        std::printf("%s\n", name);
+        PrintLatencies("start", latencies.Start);
+        PrintLatencies("exec", latencies.Exec);
+        PrintLatencies("exit", latencies.Exit);
+        auto worst = 0.0;
+        for (auto* values : { &latencies.Start, &latencies.Exec, &latencies.Exit })
+        {
+            for (auto value : *values)
+            {
+                worst = std::max(worst, value);
+            }
+        }
+        auto met = latencies.Missed == 0 && !latencies.Start.empty() && worst < Milliseconds(Target);
+        std::printf("  missed %zu of %zu, under %lld ms: %s\n", latencies.Missed, iterations,
+            static_cast<long long>(Target.count()), met ? "yes" : "no");
+        return met;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t iterations = 20;
+    auto interval = ProcPollingWatcherBackend::DefaultInterval;
+    for (int i = 1; i < argc; i += 2)
+    {
+        auto number = i + 1 < argc ? std::atoi(argv[i + 1]) : 0;
+        if (std::strcmp(argv[i], "--iterations") == 0 && number > 0)
+        {
+            iterations = static_cast<size_t>(number);
+        }
+        else if (std::strcmp(argv[i], "--interval") == 0 && number > 0)
+        {
+            interval = std::chrono::milliseconds(number);
+        }
+        else
+        {
+            std::fprintf(stderr, "Usage: LinuxWatcherLatency [--iterations <n>] [--interval <ms>]\n");
+            return 2;
+        }
+    }
+
+    char const* catPath = nullptr;
+    for (auto path : { "/bin/cat", "/usr/bin/cat" })
+    {
+        if (access(path, X_OK) == 0)
+        {
+            catPath = path;
+            break;
+        }
+    }
+    if (!catPath)
+    {
+        std::fprintf(stderr, "Can't find cat\n");
+        return 1;
+    }
+
+    auto met = true;
+    if (auto connector = LinuxProcessConnectorBackend::TryCreate())
+    {
+        met = Measure("process connector", *connector, catPath, iterations) && met;
+    }
+    else
+    {
+        std::printf("process connector\n  not available, needs CAP_NET_ADMIN\n");
+    }
+
+    ProcPollingWatcherBackend poller(interval);
+    char name[64] = {};
+    std::snprintf(name, sizeof(name), "polling /proc every %lld ms", static_cast<long long>(interval.count()));
+    met = Measure(name, poller, catPath, iterations) && met;
+    return met ? 0 : 1;
+}
@@ -0,0 +1,46 @@
+// libFuzzer target for PeImage::Parse. Every accessor of a parsed image has
+// to stay within the input, which AddressSanitizer checks as the fuzzer
+// runs. Without libFuzzer, FuzzerMain.cpp runs it over a corpus instead.
+#include <cstdlib>
+#include "PeImage.h"
+
+namespace
+{
+    void Check(bool condition)
+    {
+        if (!condition)
+        {
+            std::abort();
+        }
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(uint8_t const* data, size_t size)
+{
+    auto image = PeImage::Parse(data, size);
+    if (!image)
+    {
+        Check(image.error() != PeError::Truncated || image.RequiredSize() > size);
+        return 0;
+    }
+
+    Check(image.RequiredSize() <= size);
+    Check(image.DosHeader().Magic == PeImage::DosSignature);
+    Check(image.SectionCount() > 0 && image.SectionCount() <= PeImage::MaxSections);
+    Check(reinterpret_cast<uint8_t const*>(image.end()) <= data + size);
+    Check((image.OptionalHeader32() == nullptr) == image.IsPe32Plus());
+
+    // Touch everything, so reads past the input show up
+    volatile uint32_t sum = image.Machine() + image.Subsystem() + image.FileHeader().Characteristics;
+    for (size_t i = 0; i < image.DataDirectoryCount(); i++)
+    {
+        sum += image.DataDirectory(i)->VirtualAddress + image.DataDirectory(i)->Size;
+    }
+    Check(image.DataDirectoryCount() <= PeImage::MaxDataDirectories);
+    Check(image.DataDirectory(image.DataDirectoryCount()) == nullptr);
+    for (auto&& section : image)
+    {
+        sum += section.VirtualAddress + section.SizeOfRawData + static_cast<uint8_t>(section.Name[7]);
+    }
+    return 0;
+}
@@ -0,0 +1,214 @@
+// Measures removing exited processes from the list by pid: ProcessIdIndex,
+// the list model's batched path on top of it, and the find_if + erase over
+// a vector of processes the list used before.
+//
+//   ProcessIdIndexBenchmark [--seconds <n>] [rows...]
+//
+// Rows default to 1000, 10000 and 100000. Every exit of a random listed
+// process is followed by a start with a new pid, so the list keeps its size.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "ProcessColumns.h"
+#include "ProcessIdIndex.h"
+#include "ProcessListModel.h"
+
+namespace
+{
+    constexpr uint32_t PidStep = 4;
+    constexpr size_t BatchSize = 50;
+
+    Process CreateProcess(uint32_t pid)
+    {
+        Process process;
+        process.Pid = pid;
+        process.CreationTime = pid;
+        process.Name = L"Process" + std::to_wstring(pid % 97) + L".exe";
+        process.Pending = ProcessFields::None;
+        return process;
+    }
+
+    // Runs rounds of BatchSize exits and starts until the time is up,
+    // returns microseconds per exit and start
+    template <typename TRound>
+    double Measure(double seconds, TRound&& round)
+    {
+        using namespace std::chrono;
+        auto start = steady_clock::now();
+        auto deadline = start + duration_cast<steady_clock::duration>(duration<double>(seconds));
+        uint64_t events = 0;
+        auto now = start;
+        do
+        {
+            round();
+            events += BatchSize;
+            now = steady_clock::now();
+        } while (now < deadline);
+        return duration<double, std::micro>(now - start).count() / static_cast<double>(events);
+    }
+
+    // Listed pids in no particular order, with a random one picked to exit
+    // next. Shared by every way of removing, so they all see the same churn.
+    class LivePids
+    {
+    public:
+        explicit LivePids(size_t count)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                m_pids.push_back(Next());
+            }
+        }
+
+        std::vector<uint32_t> const& Pids() const { return m_pids; }
+
+        // Replaces a random pid with a new one, returns both
+        std::pair<uint32_t, uint32_t> Churn()
+        {
+            auto& slot = m_pids[m_random() % m_pids.size()];
+            auto exited = slot;
+            slot = Next();
+            return { exited, slot };
+        }
+
+    private:
+        uint32_t Next()
+        {
+            m_nextPid += PidStep;
+            return m_nextPid;
+        }
+
+        std::vector<uint32_t> m_pids;
+        uint32_t m_nextPid = 0;
+        std::mt19937 m_random{ 1 };
+    };
+
+    void MeasureRows(size_t rows, double seconds)
+    {
+        // What RemoveProcessByProcessId did: a linear search by pid and an
+        // erase from the middle of the sorted vector. New pids are the
+        // highest, so starts go at the end.
+        double findIfErase = 0;
+        {
+            LivePids live(rows);
+            std::vector<Process> processes;
+            for (auto pid : live.Pids())
+            {
+                processes.push_back(CreateProcess(pid));
+            }
+            std::sort(processes.begin(), processes.end(), [](Process const& left, Process const& right) { return left.Pid < right.Pid; });
+            findIfErase = Measure(seconds, [&]()
+                {
+                    for (size_t i = 0; i < BatchSize; i++)
+                    {
+                        auto [exited, started] = live.Churn();
+                        auto it = std::find_if(processes.begin(), processes.end(), [exited = exited](Process const& process)
+                            {
+                                return process.Pid == exited;
+                            });
+                        if (it != processes.end())
+                        {
+                            processes.erase(it);
+                        }
+                        processes.push_back(CreateProcess(started));
+                    }
+                });
+        }
+
+        // The index on its own, the row of the exited process is reused
+        double index = 0;
+        {
+            LivePids live(rows);
+            ProcessIdIndex pids;
+            for (uint32_t row = 0; row < rows; row++)
+            {
+                pids.Insert(live.Pids()[row], row);
+            }
+            index = Measure(seconds, [&]()
+                {
+                    for (size_t i = 0; i < BatchSize; i++)
+                    {
+                        auto [exited, started] = live.Churn();
+                        if (auto row = pids.Find(exited))
+                        {
+                            pids.Erase(exited, *row);
+                            pids.Insert(started, *row);
+                        }
+                    }
+                    pids.Compact();
+                });
+        }
+
+        // What a watcher batch costs the list model sorted by pid
+        double model = 0;
+        {
+            LivePids live(rows);
+            std::vector<Process> processes;
+            for (auto pid : live.Pids())
+            {
+                processes.push_back(CreateProcess(pid));
+            }
+            ProcessListModel list;
+            list.Assign(processes);
+            list.Sort(ColumnLess<PidColumn, false>{ list.Table() });
+            std::vector<uint32_t> removedRows;
+            std::vector<Process> added;
+            model = Measure(seconds, [&]()
+                {
+                    removedRows.clear();
+                    added.clear();
+                    for (size_t i = 0; i < BatchSize; i++)
+                    {
+                        auto [exited, started] = live.Churn();
+                        if (auto row = list.FindRowByKey(ProcessKey::From(exited, exited)))
+                        {
+                            removedRows.push_back(*row);
+                        }
+                        added.push_back(CreateProcess(started));
+                    }
+                    list.ApplyChanges(removedRows, added, ColumnLess<PidColumn, false>{ list.Table() });
+                });
+        }
+
+        std::printf("%8zu %14.3f %14.3f %14.3f\n", rows, findIfErase, index, model);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = 0.5;
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+        {
+            seconds = std::atof(argv[++i]);
+        }
+        else if (auto rows = std::strtoull(argv[i], nullptr, 10); rows > 0)
+        {
+            sizes.push_back(static_cast<size_t>(rows));
+        }
+        else
+        {
+            std::fprintf(stderr, "Usage: ProcessIdIndexBenchmark [--seconds <n>] [rows...]\n");
+            return 2;
+        }
+    }
+    if (sizes.empty())
+    {
+        sizes = { 1000, 10000, 100000 };
+    }
+
+    std::printf("microseconds per exit and start, batches of %zu\n", BatchSize);
+    std::printf("%8s %14s %14s %14s\n", "rows", "find_if+erase", "ProcessIdIndex", "list model");
+    for (auto size : sizes)
+    {
+        MeasureRows(size, seconds);
+    }
+    return 0;
+}
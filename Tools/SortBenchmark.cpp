@@ -0,0 +1,182 @@
+// Measures sorting the process list by a column: the integer sort keys and
+// radix sort the list uses now, the ColumnLess comparator it still uses to
+// merge rows in, and the comparator over whole Process objects it used to
+// sort with.
+//
+//   SortBenchmark [--seconds <n>] [rows...]
+//
+// Rows default to 1000, 10000 and 100000 synthetic processes. Each sort
+// starts from a shuffled list.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "ProcessColumns.h"
+#include "ProcessListModel.h"
+
+namespace
+{
+    // IMAGE_FILE_MACHINE_*
+    constexpr uint16_t Machines[] = { 0x014c, 0x8664, 0xaa64 };
+
+    // Most processes share a few names (svchost.exe and the like), the rest
+    // are spread over many
+    std::vector<Process> CreateProcesses(size_t count)
+    {
+        static wchar_t const* const common[] = { L"svchost.exe", L"RuntimeBroker.exe", L"conhost.exe", L"chrome.exe",
+            L"msedge.exe", L"explorer.exe", L"dllhost.exe", L"backgroundTaskHost.exe" };
+        std::mt19937 random(1);
+        std::vector<Process> processes(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            auto& process = processes[i];
+            process.Pid = static_cast<uint32_t>(i * 4 + 4);
+            process.CreationTime = i + 1;
+            process.Name = random() % 2 == 0 ? std::wstring(common[random() % std::size(common)])
+                : L"Process" + std::to_wstring(random() % (count / 4 + 1)) + L".EXE";
+            process.ArchitectureValue = Machines[random() % std::size(Machines)];
+            process.Pending = ProcessFields::None;
+        }
+        return processes;
+    }
+
+    // How the list was sorted before it kept a table: a comparator over
+    // whole processes, switching on the column on every comparison. The
+    // original called _wcsicmp, CompareIgnoreCase stands in for it here.
+    bool CompareProcesses(Process const& left, Process const& right, bool descending, ProcessInformation column)
+    {
+        auto comparePids = [&]()
+        {
+            return descending ? left.Pid > right.Pid : left.Pid < right.Pid;
+        };
+        switch (column)
+        {
+        case ProcessInformation::Name:
+        {
+            auto value = CompareIgnoreCase(left.Name, right.Name);
+            if (value == 0)
+            {
+                return comparePids();
+            }
+            return descending ? value > 0 : value < 0;
+        }
+        case ProcessInformation::Architecture:
+            if (left.ArchitectureValue == right.ArchitectureValue)
+            {
+                return comparePids();
+            }
+            return descending ? left.ArchitectureValue > right.ArchitectureValue : left.ArchitectureValue < right.ArchitectureValue;
+        default:
+            return comparePids();
+        }
+    }
+
+    // Calls prepare() and then sort() until the time is up, returns the
+    // median time of sort() in milliseconds
+    template <typename TPrepare, typename TSort>
+    double Measure(double seconds, TPrepare&& prepare, TSort&& sort)
+    {
+        using namespace std::chrono;
+        auto deadline = steady_clock::now() + duration_cast<steady_clock::duration>(duration<double>(seconds));
+        std::vector<double> times;
+        do
+        {
+            prepare();
+            auto start = steady_clock::now();
+            sort();
+            times.push_back(duration<double, std::milli>(steady_clock::now() - start).count());
+        } while (steady_clock::now() < deadline || times.size() < 3);
+        std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+        return times[times.size() / 2];
+    }
+
+    template <typename TColumn>
+    void MeasureColumn(char const* name, std::vector<Process> const& processes, double seconds)
+    {
+        std::mt19937_64 random(2);
+        ProcessListModel model;
+        model.Assign(processes);
+        auto& table = model.Table();
+        FoldedStringRanks names;
+        auto shuffleModel = [&]()
+        {
+            auto seed = random();
+            model.SortByKey([seed](uint32_t row)
+                {
+                    return (static_cast<uint64_t>(row) + 1) * (seed | 1);
+                });
+        };
+
+        auto keys = Measure(seconds, shuffleModel, [&]()
+            {
+                if constexpr (std::is_same_v<TColumn, NameColumn>)
+                {
+                    names.Update(table.Strings());
+                }
+                model.SortByKey([&](uint32_t row)
+                    {
+                        return GetRowSortKey<TColumn>(table, row, names, false);
+                    });
+            });
+        auto columnLess = Measure(seconds, shuffleModel, [&]()
+            {
+                model.Sort(ColumnLess<TColumn, false>{ table });
+            });
+
+        std::vector<Process> shuffled = processes;
+        std::vector<Process> sorted;
+        auto old = Measure(seconds, [&]()
+            {
+                std::shuffle(shuffled.begin(), shuffled.end(), random);
+                sorted = shuffled;
+            }, [&]()
+            {
+                std::sort(sorted.begin(), sorted.end(), [](Process const& left, Process const& right)
+                    {
+                        return CompareProcesses(left, right, false, TColumn::Id);
+                    });
+            });
+
+        std::printf("%8zu  %-13s %10.3f %12.3f %16.3f\n", processes.size(), name, keys, columnLess, old);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = 0.5;
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+        {
+            seconds = std::atof(argv[++i]);
+        }
+        else if (auto rows = std::strtoull(argv[i], nullptr, 10); rows > 0)
+        {
+            sizes.push_back(static_cast<size_t>(rows));
+        }
+        else
+        {
+            std::fprintf(stderr, "Usage: SortBenchmark [--seconds <n>] [rows...]\n");
+            return 2;
+        }
+    }
+    if (sizes.empty())
+    {
+        sizes = { 1000, 10000, 100000 };
+    }
+
+    std::printf("milliseconds per sort, median\n");
+    std::printf("%8s  %-13s %10s %12s %16s\n", "rows", "column", "sort keys", "ColumnLess", "CompareProcesses");
+    for (auto size : sizes)
+    {
+        auto processes = CreateProcesses(size);
+        MeasureColumn<NameColumn>("Name", processes, seconds);
+        MeasureColumn<ArchitectureColumn>("Architecture", processes, seconds);
+    }
+    return 0;
+}